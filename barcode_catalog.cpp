@@ -0,0 +1,92 @@
+#include "barcode_catalog.h"
+
+#include <random>
+#include <stdexcept>
+
+#include "barcode_key.h"
+
+static_assert(kBarcodeLength % 2 == 0, "the Feistel network needs two equal halves");
+
+std::string generate_random_barcode(int length) {
+    static thread_local std::mt19937 generator(std::random_device{}());
+    std::uniform_int_distribution<> distribution(0, sizeof(kBarcodeCharset) - 2);
+
+    std::string result;
+    for (int i = 0; i < length; ++i) {
+        result += kBarcodeCharset[distribution(generator)];
+    }
+    return result;
+}
+
+
+// permutation
+static const uint64_t kHalfSpace = static_cast<uint64_t>(barcode_key_space(kBarcodeLength / 2));
+
+static uint64_t mix64(uint64_t x) {
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+BarcodePermutation::BarcodePermutation(uint64_t key) {
+    for (int n = 0; n < kRounds; ++n) {
+        key += 0x9e3779b97f4a7c15ULL;
+        round_keys_[n] = mix64(key);
+    }
+}
+
+uint32_t BarcodePermutation::round_function(int n, uint32_t half) const {
+    return static_cast<uint32_t>(mix64(half ^ round_keys_[n]) % kHalfSpace);
+}
+
+// index = left * kHalfSpace + right; each round maps (left, right) to
+// (right, left + F(right)), which is undone by subtracting F again.
+int64_t BarcodePermutation::permute(int64_t index) const {
+    uint64_t left = static_cast<uint64_t>(index) / kHalfSpace;
+    uint64_t right = static_cast<uint64_t>(index) % kHalfSpace;
+    for (int n = 0; n < kRounds; ++n) {
+        uint64_t next = (left + round_function(n, static_cast<uint32_t>(right))) % kHalfSpace;
+        left = right;
+        right = next;
+    }
+    return static_cast<int64_t>(left * kHalfSpace + right);
+}
+
+int64_t BarcodePermutation::invert(int64_t value) const {
+    uint64_t left = static_cast<uint64_t>(value) / kHalfSpace;
+    uint64_t right = static_cast<uint64_t>(value) % kHalfSpace;
+    for (int n = kRounds - 1; n >= 0; --n) {
+        uint64_t previous = (right + kHalfSpace - round_function(n, static_cast<uint32_t>(left))) % kHalfSpace;
+        right = left;
+        left = previous;
+    }
+    return static_cast<int64_t>(left * kHalfSpace + right);
+}
+
+std::string barcode_at(const BarcodePermutation& permutation, int64_t index) {
+    if (index < 0 || index >= barcode_key_space()) {
+        throw std::runtime_error("Barcode space exhausted");
+    }
+    return unpack_barcode(permutation.permute(index));
+}
+
+
+static bool barcode_seeded = false;
+static uint64_t barcode_seed = 0;
+
+uint64_t new_barcode_key() {
+    if (barcode_seeded) {
+        return barcode_seed;
+    }
+    std::random_device rd;
+    return (static_cast<uint64_t>(rd()) << 32) ^ rd();
+}
+
+void set_barcode_seed(uint64_t seed) {
+    barcode_seeded = true;
+    barcode_seed = seed;
+}
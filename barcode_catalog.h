@@ -0,0 +1,40 @@
+#ifndef BARCODE_CATALOG_H
+#define BARCODE_CATALOG_H
+
+#include <cstdint>
+#include <string>
+
+#include "barcode_code.h"
+
+// Random code of digits and uppercase letters.
+std::string generate_random_barcode(int length = kBarcodeLength);
+
+// Keyed bijection of [0, barcode_key_space()): a Feistel network over the
+// two halves of a packed code, each in Z_{36^6}. Consecutive indexes give
+// codes that look random, and two indexes never give the same code, so a
+// counter is enough to allocate unique codes. Not a cipher: anyone with the
+// key can run it backwards.
+class BarcodePermutation {
+public:
+    explicit BarcodePermutation(uint64_t key);
+
+    int64_t permute(int64_t index) const;
+    int64_t invert(int64_t value) const;
+
+private:
+    static const int kRounds = 6;
+    uint32_t round_function(int n, uint32_t half) const;
+
+    uint64_t round_keys_[kRounds];
+};
+
+// Code for allocation `index` under `permutation`.
+std::string barcode_at(const BarcodePermutation& permutation, int64_t index);
+
+// Permutation key for a catalog's new allocator (see migrate_schema()):
+// random, or fixed by set_barcode_seed() so benchmarks and tests get the
+// same codes on every run.
+uint64_t new_barcode_key();
+void set_barcode_seed(uint64_t seed);
+
+#endif // BARCODE_CATALOG_H
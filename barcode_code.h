@@ -0,0 +1,13 @@
+#ifndef BARCODE_CODE_H
+#define BARCODE_CODE_H
+
+// Codes generate() puts on labels, apart from how they are drawn
+// (barcode_format.h), so catalog and scanner code builds without zint.
+const int kBarcodeLength = 12;
+const char kBarcodeCharset[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+// Scan profile (scan_profile.h) that reads the labels; follows
+// kBarcodeSymbology.
+const char* const kBarcodeScanProfile = "code128-only";
+
+#endif // BARCODE_CODE_H
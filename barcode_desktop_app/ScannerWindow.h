@@ -4,8 +4,7 @@
 #include <QDialog>
 #include <string>
 
-// Предварительное объявление для sqlite3
-struct sqlite3;
+class ScanContext;
 
 namespace Ui {
 class ScannerWindow;
@@ -21,9 +20,12 @@ public:
 
 private slots:
     void on_choiceBarcode_clicked();
+    void on_profileBox_currentTextChanged(const QString &name);
 
 private:
     Ui::ScannerWindow *ui;
+    // Контекст потока GUI: сканер и буферы живут дольше одного окна
+    ScanContext *scanContext;
 };
 
 #endif // SCANNERWINDOW_H
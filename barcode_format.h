@@ -0,0 +1,14 @@
+#ifndef BARCODE_FORMAT_H
+#define BARCODE_FORMAT_H
+
+#include <zint.h>
+
+#include "barcode_code.h"
+
+// Labels produced by generate() and the desktop generator. Changing
+// kBarcodeSymbology also means changing kBarcodeScanProfile.
+const int kBarcodeSymbology = BARCODE_CODE128;
+const float kBarcodeHeight = 50;
+const float kBarcodeScale = 2.0f;
+
+#endif // BARCODE_FORMAT_H
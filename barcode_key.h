@@ -0,0 +1,57 @@
+#ifndef BARCODE_KEY_H
+#define BARCODE_KEY_H
+
+#include <cstdint>
+#include <string>
+
+#include "barcode_code.h"
+
+// Codes from generate_random_barcode() read as base-36 numbers (0-9 = 0..9,
+// A-Z = 10..35). 36^12 < 2^63, so a code fits a signed 64-bit INTEGER key,
+// and keys sort in the same order as the codes.
+constexpr int64_t barcode_key_space(int length = kBarcodeLength) {
+    return length == 0 ? 1 : 36 * barcode_key_space(length - 1);
+}
+
+static_assert(kBarcodeLength <= 12, "packed barcodes must fit in 63 bits");
+
+// False when `barcode` is not kBarcodeLength characters of 0-9A-Z.
+inline bool pack_barcode(const char* barcode, size_t length, int64_t& key) {
+    if (length != static_cast<size_t>(kBarcodeLength)) {
+        return false;
+    }
+    int64_t value = 0;
+    for (size_t i = 0; i < length; ++i) {
+        unsigned c = static_cast<unsigned char>(barcode[i]);
+        unsigned digit;
+        if (c - '0' < 10) {
+            digit = c - '0';
+        }
+        else if (c - 'A' < 26) {
+            digit = c - 'A' + 10;
+        }
+        else {
+            return false;
+        }
+        value = value * 36 + digit;
+    }
+    key = value;
+    return true;
+}
+
+inline bool pack_barcode(const std::string& barcode, int64_t& key) {
+    return pack_barcode(barcode.data(), barcode.size(), key);
+}
+
+// Inverse of pack_barcode() for 0 <= key < barcode_key_space().
+inline std::string unpack_barcode(int64_t key) {
+    std::string barcode(kBarcodeLength, '0');
+    uint64_t value = static_cast<uint64_t>(key);
+    for (int i = kBarcodeLength - 1; i >= 0; --i) {
+        barcode[i] = kBarcodeCharset[value % 36];
+        value /= 36;
+    }
+    return barcode;
+}
+
+#endif // BARCODE_KEY_H
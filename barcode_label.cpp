@@ -0,0 +1,72 @@
+#include "barcode_label.h"
+
+#include <zint.h>
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "barcode_format.h"
+#include "code128.h"
+#include "metrics.h"
+
+LabelRenderer::LabelRenderer() : symbol_(ZBarcode_Create()) {
+    if (!symbol_) {
+        throw std::runtime_error("Creation error Zint");
+    }
+}
+
+LabelRenderer::~LabelRenderer() {
+    ZBarcode_Delete(symbol_);
+}
+
+void LabelRenderer::encode(const std::string& barcode) {
+    // Clear keeps the options but not the last bitmap; zint may adjust the
+    // height while encoding, so the layout is set again every time.
+    ZBarcode_Clear(symbol_);
+    symbol_->symbology = kBarcodeSymbology;
+    symbol_->height = kBarcodeHeight;
+    symbol_->scale = kBarcodeScale;
+
+    if (timed(Stage::ZintEncode, [&] { return ZBarcode_Encode(symbol_, (unsigned char*)barcode.c_str(), static_cast<int>(barcode.size())); }) != 0) {
+        throw std::runtime_error("Encode error: " + std::string(symbol_->errtxt));
+    }
+}
+
+LabelBitmap LabelRenderer::render(const std::string& barcode) {
+    // zint draws 2 * scale pixels per module and kBarcodeHeight modules high
+    float module_px = 2 * kBarcodeScale;
+    if (kBarcodeSymbology == BARCODE_CODE128 && module_px == std::floor(module_px) && module_px >= 1) {
+        StageTimer timer(Stage::Code128Render);
+        int px = static_cast<int>(module_px);
+        int width = code128_width(barcode, px);
+        if (width > 0) {
+            int height = static_cast<int>(kBarcodeHeight * px + 0.5f);
+            gray_.resize(static_cast<size_t>(width) * height);
+            code128_render(barcode, px, height, RowFormat::Gray8, gray_.data(), static_cast<size_t>(width));
+            return {gray_.data(), width, height, 1};
+        }
+        // characters zint encodes with code set A or FNC4
+    }
+
+    encode(barcode);
+    if (timed(Stage::ZintBuffer, [&] { return ZBarcode_Buffer(symbol_, 0); }) != 0) {
+        throw std::runtime_error("Buffer error: " + std::string(symbol_->errtxt));
+    }
+    return {symbol_->bitmap, symbol_->bitmap_width, symbol_->bitmap_height, 3};
+}
+
+void LabelRenderer::save(const std::string& barcode, const std::string& path) {
+    if (path.size() >= sizeof(symbol_->outfile)) {
+        throw std::runtime_error("File path too long: " + path);
+    }
+    encode(barcode);
+    strcpy(symbol_->outfile, path.c_str());
+    if (timed(Stage::ZintPrint, [&] { return ZBarcode_Print(symbol_, 0); }) != 0) {
+        throw std::runtime_error("Print error: " + std::string(symbol_->errtxt));
+    }
+}
+
+std::string label_path(const std::string& barcode, const std::string& dir) {
+    return dir + "/" + barcode + "_barcode.png";
+}
@@ -0,0 +1,50 @@
+#ifndef BARCODE_LABEL_H
+#define BARCODE_LABEL_H
+
+#include <string>
+#include <vector>
+
+struct zint_symbol;
+
+// Pixels of a rendered label, rows top to bottom without padding: 8-bit gray
+// from the native Code128 encoder (channels 1) or RGB from zint (channels 3).
+// Owned by the LabelRenderer and valid until its next call.
+struct LabelBitmap {
+    const unsigned char* pixels;
+    int width;
+    int height;
+    int channels;
+};
+
+// One zint_symbol set up for kBarcodeSymbology, kept across labels and
+// reset with ZBarcode_Clear between them. render() stays in memory, so a
+// caller that only shows, prints or sends the label pays no file write or
+// PNG deflate; save() is the opt-in disk path. For Code128 at a whole
+// number of pixels per module, render() skips zint and draws the bars with
+// code128_render(), the same pixels zint draws without its text line
+// (show_hrt = 0). Use from one thread at a time. Errors throw
+// std::runtime_error.
+class LabelRenderer {
+public:
+    LabelRenderer();
+    ~LabelRenderer();
+    LabelRenderer(const LabelRenderer&) = delete;
+    LabelRenderer& operator=(const LabelRenderer&) = delete;
+
+    // Timed as Code128Render, or as ZintEncode and ZintBuffer.
+    LabelBitmap render(const std::string& barcode);
+
+    // Writes the label of `barcode` as a PNG to `path` (ZBarcode_Print).
+    void save(const std::string& barcode, const std::string& path);
+
+private:
+    void encode(const std::string& barcode);
+
+    zint_symbol* symbol_;
+    std::vector<unsigned char> gray_;
+};
+
+// Where generate() and the generators save the label of `barcode`.
+std::string label_path(const std::string& barcode, const std::string& dir = "test_barcodes");
+
+#endif // BARCODE_LABEL_H
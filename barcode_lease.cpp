@@ -0,0 +1,187 @@
+#include "barcode_lease.h"
+
+#include <sqlite3.h>
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+
+#include <unistd.h>
+
+#include "db_session.h"
+
+static std::string host_name() {
+    char name[256] = {};
+    if (gethostname(name, sizeof(name) - 1) != 0) {
+        return "localhost";
+    }
+    return name;
+}
+
+BarcodeLease::BarcodeLease(DbSession& session) : session_(session) {
+    static std::atomic<int> sessions{0};
+    owner_ = host_name() + ":" + std::to_string(getpid()) + ":" + std::to_string(sessions++);
+}
+
+BarcodeLease::~BarcodeLease() {
+    try {
+        release();
+    } catch (const std::runtime_error&) {
+    }
+}
+
+int64_t BarcodeLease::next(bool& verify) {
+    std::time_t now = std::time(nullptr);
+    if (!leased_ || next_ >= end_ || now >= expires_at_ - kSeconds / 2) {
+        if (!leased_ || next_ >= end_ || !renew(now)) {
+            acquire(now);
+        }
+    }
+    verify = verify_;
+    return next_++;
+}
+
+bool BarcodeLease::renew(std::time_t now) {
+    DbStatement stmt = session_.prepare("UPDATE barcode_allocations SET next = ?, expires_at = ? WHERE start = ? AND owner = ?;");
+    sqlite3_bind_int64(stmt, 1, next_);
+    sqlite3_bind_int64(stmt, 2, now + kSeconds);
+    sqlite3_bind_int64(stmt, 3, start_);
+    sqlite3_bind_text(stmt, 4, owner_.data(), static_cast<int>(owner_.size()), SQLITE_STATIC);
+    if (stmt.step() != SQLITE_DONE) {
+        throw std::runtime_error("Barcode lease renewal failed: " + std::string(sqlite3_errmsg(session_.handle())));
+    }
+    if (sqlite3_changes(session_.handle()) == 0) {
+        // expired and taken over by another session
+        leased_ = false;
+        return false;
+    }
+    expires_at_ = now + kSeconds;
+    return true;
+}
+
+// Owners on this host whose process is gone lose their lease now instead of
+// after kSeconds. A reused pid only delays that until the lease expires.
+void BarcodeLease::expire_dead_owners(std::time_t now) {
+    std::string prefix = host_name() + ":";
+    std::vector<int64_t> dead;
+    {
+        DbStatement stmt = session_.prepare("SELECT start, owner FROM barcode_allocations WHERE owner IS NOT NULL AND expires_at > ?;");
+        sqlite3_bind_int64(stmt, 1, now);
+        while (stmt.step() == SQLITE_ROW) {
+            std::string owner = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+            if (owner.compare(0, prefix.size(), prefix) != 0) {
+                continue;
+            }
+            pid_t pid = static_cast<pid_t>(std::atol(owner.c_str() + prefix.size()));
+            if (pid > 0 && pid != getpid() && kill(pid, 0) != 0 && errno == ESRCH) {
+                dead.push_back(sqlite3_column_int64(stmt, 0));
+            }
+        }
+    }
+
+    for (int64_t start : dead) {
+        DbStatement stmt = session_.prepare("UPDATE barcode_allocations SET expires_at = 0 WHERE start = ?;");
+        sqlite3_bind_int64(stmt, 1, start);
+        stmt.step();
+    }
+}
+
+void BarcodeLease::acquire(std::time_t now) {
+    sqlite3* db = session_.handle();
+    auto check = [db](int rc, int expected) {
+        if (rc != expected) {
+            throw std::runtime_error("Barcode lease failed: " + std::string(sqlite3_errmsg(db)));
+        }
+    };
+
+    check(session_.prepare("BEGIN IMMEDIATE;").step(), SQLITE_DONE);
+    try {
+        if (leased_) {
+            DbStatement stmt = session_.prepare("DELETE FROM barcode_allocations WHERE start = ? AND owner = ?;");
+            sqlite3_bind_int64(stmt, 1, start_);
+            sqlite3_bind_text(stmt, 2, owner_.data(), static_cast<int>(owner_.size()), SQLITE_STATIC);
+            check(stmt.step(), SQLITE_DONE);
+            leased_ = false;
+        }
+        expire_dead_owners(now);
+
+        bool found;
+        {
+            DbStatement stmt = session_.prepare(
+                "SELECT start, end, next, owner IS NOT NULL FROM barcode_allocations "
+                "WHERE (owner IS NULL OR expires_at <= ?) AND next < end ORDER BY start LIMIT 1;");
+            sqlite3_bind_int64(stmt, 1, now);
+            int rc = stmt.step();
+            found = rc == SQLITE_ROW;
+            if (found) {
+                start_ = sqlite3_column_int64(stmt, 0);
+                end_ = sqlite3_column_int64(stmt, 1);
+                next_ = sqlite3_column_int64(stmt, 2);
+                verify_ = sqlite3_column_int(stmt, 3) != 0;
+            }
+            else {
+                check(rc, SQLITE_DONE);
+            }
+        }
+
+        if (found) {
+            DbStatement stmt = session_.prepare("UPDATE barcode_allocations SET owner = ?, expires_at = ? WHERE start = ?;");
+            sqlite3_bind_text(stmt, 1, owner_.data(), static_cast<int>(owner_.size()), SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 2, now + kSeconds);
+            sqlite3_bind_int64(stmt, 3, start_);
+            check(stmt.step(), SQLITE_DONE);
+        }
+        else {
+            {
+                DbStatement stmt = session_.prepare("UPDATE barcode_allocator SET next_index = next_index + ? WHERE id = 0 RETURNING next_index - ?;");
+                sqlite3_bind_int64(stmt, 1, kBlockSize);
+                sqlite3_bind_int64(stmt, 2, kBlockSize);
+                check(stmt.step(), SQLITE_ROW);
+                start_ = next_ = sqlite3_column_int64(stmt, 0);
+                end_ = start_ + kBlockSize;
+                verify_ = false;
+                check(stmt.step(), SQLITE_DONE);
+            }
+            DbStatement stmt = session_.prepare("INSERT INTO barcode_allocations (start, end, next, owner, expires_at) VALUES (?, ?, ?, ?, ?);");
+            sqlite3_bind_int64(stmt, 1, start_);
+            sqlite3_bind_int64(stmt, 2, end_);
+            sqlite3_bind_int64(stmt, 3, next_);
+            sqlite3_bind_text(stmt, 4, owner_.data(), static_cast<int>(owner_.size()), SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 5, now + kSeconds);
+            check(stmt.step(), SQLITE_DONE);
+        }
+
+        check(session_.prepare("COMMIT;").step(), SQLITE_DONE);
+    } catch (const std::runtime_error&) {
+        session_.prepare("ROLLBACK;").step();
+        throw;
+    }
+    leased_ = true;
+    expires_at_ = now + kSeconds;
+}
+
+void BarcodeLease::release() {
+    if (!leased_) {
+        return;
+    }
+    leased_ = false;
+
+    // A taken-over block stays marked as expired rather than free, so its
+    // next owner keeps checking what the dead one may have used.
+    DbStatement stmt = session_.prepare(next_ >= end_
+        ? "DELETE FROM barcode_allocations WHERE start = ?1 AND owner = ?2;"
+        : verify_
+            ? "UPDATE barcode_allocations SET next = ?3, expires_at = 0 WHERE start = ?1 AND owner = ?2;"
+            : "UPDATE barcode_allocations SET next = ?3, owner = NULL WHERE start = ?1 AND owner = ?2;");
+    sqlite3_bind_int64(stmt, 1, start_);
+    sqlite3_bind_text(stmt, 2, owner_.data(), static_cast<int>(owner_.size()), SQLITE_STATIC);
+    if (next_ < end_) {
+        sqlite3_bind_int64(stmt, 3, next_);
+    }
+    if (stmt.step() != SQLITE_DONE) {
+        throw std::runtime_error("Barcode lease release failed: " + std::string(sqlite3_errmsg(session_.handle())));
+    }
+}
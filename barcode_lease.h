@@ -0,0 +1,58 @@
+#ifndef BARCODE_LEASE_H
+#define BARCODE_LEASE_H
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+class DbSession;
+
+// A block of barcode_allocator indexes reserved by one session, so several
+// generator processes share a catalog without taking the write lock for
+// every code. Each block is a row of barcode_allocations:
+//
+//   start, end   the indexes [start, end) of the block
+//   next         first index not handed out, as last written by the owner
+//   owner        "host:pid:session" while leased, NULL once released
+//   expires_at   unix time the lease runs out unless renewed
+//
+// Indexes are handed out locally while the lease has more than half of
+// kSeconds left; after that the next index first renews it. A released
+// block, or one whose lease expired or whose process is gone (same host),
+// is taken over by the next session that needs a block. Indexes of an
+// expired block past its recorded `next` may have been used without being
+// recorded, so next() marks them for checking against the catalog.
+class BarcodeLease {
+public:
+    static const int64_t kBlockSize = 1024;
+    static const int kSeconds = 600;
+
+    explicit BarcodeLease(DbSession& session);
+    // Releases the block; errors are ignored, the lease then just expires.
+    ~BarcodeLease();
+    BarcodeLease(const BarcodeLease&) = delete;
+    BarcodeLease& operator=(const BarcodeLease&) = delete;
+
+    // Next allocator index. `verify` is set when the index comes from a
+    // block taken over after its owner died. Throws std::runtime_error.
+    int64_t next(bool& verify);
+
+    // Writes back the position and frees the block for other sessions.
+    void release();
+
+private:
+    void acquire(std::time_t now);
+    bool renew(std::time_t now);
+    void expire_dead_owners(std::time_t now);
+
+    DbSession& session_;
+    std::string owner_;
+    bool leased_ = false;
+    bool verify_ = false;
+    int64_t start_ = 0;
+    int64_t end_ = 0;
+    int64_t next_ = 0;
+    std::time_t expires_at_ = 0;
+};
+
+#endif // BARCODE_LEASE_H
@@ -0,0 +1,530 @@
+// barcode_scand: long-running scanner that keeps its scan contexts, database
+// connections and prepared statements warm and answers scan requests over a
+// Unix domain socket (see scan_protocol.h for the framing).
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "barcode_key.h"
+#include "db_profile.h"
+#include "decode_cache.h"
+#include "metrics.h"
+#include "product_filter.h"
+#include "scan_context.h"
+#include "scan_protocol.h"
+
+struct DaemonOptions {
+    std::string socket = kDefaultScanSocket;
+    mode_t socket_mode = 0600;
+    std::string database = "products.db";
+    unsigned threads = 0;                 // 0 uses every hardware thread
+    const ScanProfile* profile = nullptr;
+    int pyramid_levels = 0;
+    int bar_width = 0;
+    size_t pixel_budget = 0;
+    size_t decode_cache_bytes = 0;
+};
+
+// Seconds a worker waits for the whole of a request, and then for the client
+// to take the whole reply, before it drops the connection.
+static const int kRequestTimeoutSeconds = 10;
+
+static FrameDeadline request_deadline() {
+    return std::chrono::steady_clock::now() + std::chrono::seconds(kRequestTimeoutSeconds);
+}
+
+// Idle connections are parked with the poller, and a worker only takes one
+// while it has a request waiting, so idle clients never hold a worker.
+static std::mutex connections_mutex;
+static std::condition_variable connection_ready;
+static std::deque<int> ready_connections;    // a request is waiting
+static std::vector<int> served_connections;  // answered, for the poller to watch again
+static std::set<int> busy_connections;       // being served, so shutdown can wake the workers
+static int wake_pipe[2] = {-1, -1};
+static bool stopping = false;
+
+static void wake_poller() {
+    char byte = 0;
+    // non-blocking: a full pipe already wakes the poller
+    while (write(wake_pipe[1], &byte, 1) < 0 && errno == EINTR) {
+    }
+}
+
+
+// One read-only connection per worker with the lookup prepared once, behind
+// a ProductFilter of its own.
+class ProductStatement {
+public:
+    explicit ProductStatement(const std::string& database) {
+        db_ = open_database(database, *find_db_profile("scanner-readonly"));
+        try {
+            layout_ = catalog_layout(db_);
+        } catch (const std::runtime_error&) {
+            sqlite3_close(db_);
+            throw;
+        }
+        const char* sql = layout_ == CatalogLayout::Compact
+            ? "SELECT id, product_name, price_cents FROM products WHERE code = ?;"
+            : "SELECT id, product_name, price_cents FROM products WHERE barcode = ?;";
+        if (timed(Stage::DbPrepare, [&] { return sqlite3_prepare_v3(db_, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt_, nullptr); }) != SQLITE_OK) {
+            std::string error = "SQL error: " + std::string(sqlite3_errmsg(db_));
+            sqlite3_close(db_);
+            throw std::runtime_error(error);
+        }
+        try {
+            filter_.reset(new ProductFilter(db_, layout_, product_filter_path(database)));
+        } catch (const std::runtime_error&) {
+            sqlite3_finalize(stmt_);
+            sqlite3_close(db_);
+            throw;
+        }
+    }
+
+    ~ProductStatement() {
+        filter_.reset();
+        sqlite3_finalize(stmt_);
+        sqlite3_close(db_);
+    }
+
+    ProductStatement(const ProductStatement&) = delete;
+    ProductStatement& operator=(const ProductStatement&) = delete;
+
+    bool find(const std::string& barcode, Product& product) {
+        ProductFilter::Snapshot snapshot(*filter_);
+        if (!filter_->may_contain(barcode)) {
+            count_event(Counter::ProductFilterSkipped);
+            return false;
+        }
+
+        sqlite3_reset(stmt_);
+        int64_t key;
+        if (layout_ == CatalogLayout::Text) {
+            sqlite3_bind_text(stmt_, 1, barcode.data(), static_cast<int>(barcode.size()), SQLITE_STATIC);
+        }
+        else if (pack_barcode(barcode, key)) {
+            sqlite3_bind_int64(stmt_, 1, key);
+        }
+        else {
+            return false;
+        }
+
+        int rc = timed(Stage::DbStep, [&] { return sqlite3_step(stmt_); });
+        if (rc == SQLITE_ROW) {
+            product.id = sqlite3_column_int(stmt_, 0);
+            product.name = reinterpret_cast<const char*>(sqlite3_column_text(stmt_, 1));
+            product.price = sqlite3_column_int64(stmt_, 2) / 100.0;
+        }
+        else if (rc != SQLITE_DONE) {
+            throw std::runtime_error("Lookup failed: " + std::string(sqlite3_errmsg(db_)));
+        }
+        sqlite3_reset(stmt_);
+        return rc == SQLITE_ROW;
+    }
+
+private:
+    sqlite3* db_ = nullptr;
+    sqlite3_stmt* stmt_ = nullptr;
+    CatalogLayout layout_ = CatalogLayout::Text;
+    std::unique_ptr<ProductFilter> filter_;
+};
+
+
+static ScanReplySymbol reply_symbol(const ScannedSymbol& symbol) {
+    ScanReplySymbol reply;
+    reply.type = symbol.type_name;
+    reply.data = symbol.data;
+    reply.quality = symbol.quality;
+    reply.level = symbol.level;
+    reply.x = reply.y = reply.width = reply.height = 0;
+    if (!symbol.polygon.empty()) {
+        int x0 = symbol.polygon[0].x, x1 = x0;
+        int y0 = symbol.polygon[0].y, y1 = y0;
+        for (const ScanPoint& point : symbol.polygon) {
+            x0 = std::min(x0, point.x);
+            x1 = std::max(x1, point.x);
+            y0 = std::min(y0, point.y);
+            y1 = std::max(y1, point.y);
+        }
+        reply.x = x0;
+        reply.y = y0;
+        reply.width = x1 - x0 + 1;
+        reply.height = y1 - y0 + 1;
+    }
+    reply.found = false;
+    reply.product = Product();
+    return reply;
+}
+
+// Path requests make the daemon open a file with its own permissions, so
+// they are only taken from its own user (or root, who could read the file
+// anyway). Anyone else who can reach the socket sends the image bytes.
+static bool may_open_paths(int fd) {
+    ucred peer;
+    socklen_t size = sizeof(peer);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &size) == 0 && (peer.uid == getuid() || peer.uid == 0);
+}
+
+// Answers the request waiting on `fd`. False when the client hung up instead.
+static bool serve_request(int fd, ScanContext& ctx, ProductStatement& products,
+                          std::vector<unsigned char>& request, std::vector<unsigned char>& response) {
+    FrameHeader header;
+    if (!read_frame(fd, header, request, request_deadline())) {
+        return false;
+    }
+
+    const std::vector<ScannedSymbol>* symbols = nullptr;
+    if (header.kind == static_cast<uint8_t>(ScanRequestKind::Path) && may_open_paths(fd)) {
+        std::string path(request.begin(), request.end());
+        symbols = &barcode_symbols(ctx, path.c_str());
+    }
+    else if (header.kind == static_cast<uint8_t>(ScanRequestKind::Path)) {
+        std::string error = "Path requests are only served to the daemon's user, send the image instead";
+        write_frame(fd, static_cast<uint8_t>(ScanStatus::Error), 0, error.data(), error.size(), request_deadline());
+        return true;
+    }
+    else if (header.kind == static_cast<uint8_t>(ScanRequestKind::Image)) {
+        symbols = &barcode_symbols_from_memory(ctx, request.data(), request.size());
+    }
+    else {
+        std::string error = "Unknown request kind " + std::to_string(header.kind);
+        write_frame(fd, static_cast<uint8_t>(ScanStatus::Error), 0, error.data(), error.size(), request_deadline());
+        return true;
+    }
+
+    response.clear();
+    size_t count = std::min<size_t>(symbols->size(), 0xffff);
+    try {
+        for (size_t i = 0; i < count; ++i) {
+            ScanReplySymbol symbol = reply_symbol((*symbols)[i]);
+            symbol.found = products.find(symbol.data, symbol.product);
+            encode_reply_symbol(response, symbol);
+        }
+    } catch (const std::runtime_error& e) {
+        std::string error = e.what();
+        write_frame(fd, static_cast<uint8_t>(ScanStatus::Error), 0, error.data(), error.size(), request_deadline());
+        return true;
+    }
+
+    ScanStatus status = count ? ScanStatus::Ok : ScanStatus::NoBarcode;
+    write_frame(fd, static_cast<uint8_t>(status), static_cast<uint16_t>(count), response.data(), response.size(),
+                request_deadline());
+    return true;
+}
+
+static void run_worker(const DaemonOptions& options, ProductStatement& products) {
+    ScanContext& ctx = ScanContext::for_this_thread();
+    if (options.profile) {
+        ctx.set_profile(*options.profile);
+    }
+    ctx.set_pyramid_levels(options.pyramid_levels);
+    ctx.set_bar_width(options.bar_width);
+    ctx.set_pixel_budget(options.pixel_budget);
+    if (options.decode_cache_bytes > 0) {
+        try {
+            ctx.open_decode_cache(decode_cache_path(options.database), options.decode_cache_bytes);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    std::vector<unsigned char> request;
+    std::vector<unsigned char> response;
+    for (;;) {
+        int fd;
+        {
+            std::unique_lock<std::mutex> lock(connections_mutex);
+            connection_ready.wait(lock, [] { return stopping || !ready_connections.empty(); });
+            if (stopping) {
+                break;
+            }
+            fd = ready_connections.front();
+            ready_connections.pop_front();
+            busy_connections.insert(fd);
+        }
+
+        bool keep = false;
+        try {
+            keep = serve_request(fd, ctx, products, request, response);
+        } catch (const std::runtime_error& e) {
+            std::cerr << "Connection dropped: " << e.what() << std::endl;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(connections_mutex);
+            busy_connections.erase(fd);
+            if (keep && !stopping) {
+                served_connections.push_back(fd);
+                fd = -1;
+            }
+        }
+        if (fd < 0) {
+            wake_poller();
+        }
+        else {
+            close(fd);
+        }
+    }
+}
+
+// Accepts connections and waits on the idle ones; one with a request
+// waiting goes to the workers and comes back once it is answered.
+static void run_poller(int listener) {
+    std::vector<int> idle;
+    std::vector<int> ready;
+    std::vector<pollfd> fds;
+    for (;;) {
+        fds.clear();
+        fds.push_back({wake_pipe[0], POLLIN, 0});
+        fds.push_back({listener, POLLIN, 0});
+        for (int fd : idle) {
+            fds.push_back({fd, POLLIN, 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) {
+            std::cerr << "poll failed: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        if (fds[0].revents) {
+            char drain[64];
+            while (read(wake_pipe[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+        ready.clear();
+        idle.clear();
+        for (size_t i = 2; i < fds.size(); ++i) {
+            (fds[i].revents ? ready : idle).push_back(fds[i].fd);
+        }
+        if (fds[1].revents & POLLIN) {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                idle.push_back(fd);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(connections_mutex);
+            if (stopping) {
+                ready_connections.insert(ready_connections.end(), ready.begin(), ready.end());
+                break;
+            }
+            idle.insert(idle.end(), served_connections.begin(), served_connections.end());
+            served_connections.clear();
+            ready_connections.insert(ready_connections.end(), ready.begin(), ready.end());
+        }
+        for (size_t i = 0; i < ready.size(); ++i) {
+            connection_ready.notify_one();
+        }
+    }
+    for (int fd : idle) {
+        close(fd);
+    }
+}
+
+
+static int open_listener(const std::string& path, mode_t mode) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Socket path too long: " + path);
+    }
+    std::strcpy(address.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot create socket: " + std::string(strerror(errno)));
+    }
+
+    // A socket file nobody answers on is left over from a daemon that died.
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+        close(fd);
+        throw std::runtime_error("Another barcode_scand is listening on " + path);
+    }
+    unlink(path.c_str());
+
+    // bind() creates the socket file; the umask gives it `mode` from the
+    // start. No other thread runs yet.
+    mode_t old_umask = umask(~mode & 0777);
+    int bound = bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    umask(old_umask);
+    if (bound != 0 || listen(fd, SOMAXCONN) != 0) {
+        std::string error = "Cannot listen on " + path + ": " + strerror(errno);
+        close(fd);
+        throw std::runtime_error(error);
+    }
+    return fd;
+}
+
+static void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [--socket PATH] [--socket-mode OCTAL] [--database FILE] [--threads N] [--profile NAME] [--pyramid 0-3] [--bar-width PX] [--max-megapixels MP] [--decode-cache MB] [--metrics PREFIX]\n"
+              << "Scan profiles: " << scan_profile_names() << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    // Termination signals are taken by sigwait() at the end of main. Blocked
+    // before anything else, so every thread inherits the mask, including
+    // the one --metrics starts while the arguments are read; one that comes
+    // during startup waits for sigwait().
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    DaemonOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--socket" && has_value) {
+            options.socket = argv[++i];
+        }
+        else if (arg == "--socket-mode" && has_value) {
+            char* end;
+            long mode = std::strtol(argv[++i], &end, 8);
+            if (*end || mode < 0 || mode > 0777) {
+                usage(argv[0]);
+                return 1;
+            }
+            options.socket_mode = static_cast<mode_t>(mode);
+        }
+        else if (arg == "--database" && has_value) {
+            options.database = argv[++i];
+        }
+        else if (arg == "--threads" && has_value) {
+            options.threads = static_cast<unsigned>(std::max(0, std::atoi(argv[++i])));
+        }
+        else if (arg == "--profile" && has_value) {
+            options.profile = find_scan_profile(argv[++i]);
+            if (!options.profile) {
+                std::cerr << "Unknown scan profile: " << argv[i] << " (available: " << scan_profile_names() << ")" << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--metrics" && has_value) {
+            enable_metrics_dump(argv[++i]);
+        }
+        else if (arg == "--pyramid" && has_value) {
+            options.pyramid_levels = std::atoi(argv[++i]);
+            if (options.pyramid_levels < 0 || options.pyramid_levels > kMaxPyramidLevels) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--bar-width" && has_value) {
+            options.bar_width = std::atoi(argv[++i]);
+            if (options.bar_width < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--max-megapixels" && has_value) {
+            double megapixels = std::atof(argv[++i]);
+            if (megapixels <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            options.pixel_budget = static_cast<size_t>(megapixels * 1e6);
+        }
+        else if (arg == "--decode-cache" && has_value) {
+            double megabytes = std::atof(argv[++i]);
+            if (megabytes <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            options.decode_cache_bytes = static_cast<size_t>(megabytes * 1048576);
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Every worker's connection is opened up front, so a missing or locked
+    // catalog stops the daemon at startup instead of leaving it short of
+    // workers, or with none to answer the connections it accepts.
+    unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::unique_ptr<ProductStatement>> statements;
+    try {
+        for (unsigned t = 0; t < threads; ++t) {
+            statements.emplace_back(new ProductStatement(options.database));
+        }
+        if (options.decode_cache_bytes > 0) {
+            DecodeCache cache(decode_cache_path(options.database), options.decode_cache_bytes);
+        }
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    int listener;
+    try {
+        listener = open_listener(options.socket, options.socket_mode);
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (pipe2(wake_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        std::cerr << "Error: cannot create pipe: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back(run_worker, std::cref(options), std::ref(*statements[t]));
+    }
+    std::thread poller(run_poller, listener);
+    std::cerr << "barcode_scand listening on " << options.socket << " with " << threads << " workers" << std::endl;
+
+    int signal_number;
+    sigwait(&signals, &signal_number);
+
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        stopping = true;
+        for (int fd : busy_connections) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+    connection_ready.notify_all();
+    wake_poller();
+    poller.join();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    for (int fd : ready_connections) {
+        close(fd);
+    }
+    for (int fd : served_connections) {
+        close(fd);
+    }
+    close(listener);
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    unlink(options.socket.c_str());
+
+    std::cerr << "barcode_scand stopped" << std::endl;
+    return 0;
+}
@@ -0,0 +1,413 @@
+#include "batch_scan.h"
+
+#include <sqlite3.h>
+#include <glob.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "db_profile.h"
+#include "decode_cache.h"
+#include "metrics.h"
+#include "product_filter.h"
+#include "product_lookup.h"
+#include "scan_context.h"
+
+namespace fs = std::filesystem;
+
+struct SymbolResult {
+    ScannedSymbol symbol;
+    bool found;
+    Product product;
+};
+
+struct BatchResult {
+    size_t index;
+    std::string path;
+    double decode_ms;
+    std::vector<SymbolResult> symbols;
+};
+
+
+// inputs
+static bool is_image_path(const fs::path& path) {
+    static const char* const extensions[] = {".png", ".jpg", ".jpeg", ".bmp", ".gif", ".tga", ".pgm", ".ppm", ".pnm"};
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    return std::find(std::begin(extensions), std::end(extensions), ext) != std::end(extensions);
+}
+
+std::vector<std::string> collect_batch_inputs(const std::string& input) {
+    std::vector<std::string> paths;
+    std::error_code ec;
+
+    if (input != "-" && fs::is_directory(input, ec)) {
+        for (fs::recursive_directory_iterator it(input, ec), end; !ec && it != end; it.increment(ec)) {
+            if (it->is_regular_file(ec) && is_image_path(it->path())) {
+                paths.push_back(it->path().string());
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+    }
+    else if (input.find_first_of("*?[") != std::string::npos) {
+        glob_t matches;
+        if (glob(input.c_str(), 0, nullptr, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; ++i) {
+                paths.push_back(matches.gl_pathv[i]);
+            }
+        }
+        globfree(&matches);
+    }
+    else {
+        std::ifstream file;
+        std::istream* in = &std::cin;
+        if (input != "-") {
+            file.open(input);
+            if (!file) {
+                throw std::runtime_error("Cannot open input list: " + input);
+            }
+            in = &file;
+        }
+
+        std::string line;
+        while (std::getline(*in, line)) {
+            while (!line.empty() && std::isspace(static_cast<unsigned char>(line.back()))) {
+                line.pop_back();
+            }
+            if (!line.empty()) {
+                paths.push_back(line);
+            }
+        }
+    }
+
+    return paths;
+}
+
+
+// output
+std::string json_string(const std::string& value) {
+    std::string out = "\"";
+    for (unsigned char c : value) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out += static_cast<char>(c);
+                }
+        }
+    }
+    return out + "\"";
+}
+
+std::string csv_field(const std::string& value) {
+    if (value.find_first_of(",\"\r\n") == std::string::npos) {
+        return value;
+    }
+    std::string out = "\"";
+    for (char c : value) {
+        if (c == '"') {
+            out += '"';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+static const char* symbol_status(const SymbolResult& result) {
+    return result.found ? "found" : "not_found";
+}
+
+static void write_result(std::ostream& out, BatchFormat format, const BatchResult& result) {
+    char number[64];
+    snprintf(number, sizeof(number), "%.3f", result.decode_ms);
+    std::string decode_ms = number;
+
+    if (format == BatchFormat::Jsonl) {
+        out << "{\"index\":" << result.index
+            << ",\"file\":" << json_string(result.path)
+            << ",\"status\":\"" << (result.symbols.empty() ? "no_barcode" : "decoded") << "\""
+            << ",\"decode_ms\":" << decode_ms
+            << ",\"symbols\":[";
+        for (size_t i = 0; i < result.symbols.size(); ++i) {
+            const SymbolResult& symbol = result.symbols[i];
+            out << (i ? "," : "")
+                << "{\"barcode\":" << json_string(symbol.symbol.data)
+                << ",\"type\":" << json_string(symbol.symbol.type_name)
+                << ",\"quality\":" << symbol.symbol.quality
+                << ",\"level\":" << symbol.symbol.level
+                << ",\"polygon\":[";
+            for (size_t p = 0; p < symbol.symbol.polygon.size(); ++p) {
+                out << (p ? "," : "") << "[" << symbol.symbol.polygon[p].x << "," << symbol.symbol.polygon[p].y << "]";
+            }
+            out << "],\"status\":\"" << symbol_status(symbol) << "\"";
+            if (symbol.found) {
+                snprintf(number, sizeof(number), "%.2f", symbol.product.price);
+                out << ",\"id\":" << symbol.product.id
+                    << ",\"name\":" << json_string(symbol.product.name)
+                    << ",\"price\":" << number;
+            }
+            out << "}";
+        }
+        out << "]}\n";
+        return;
+    }
+
+    // one row per symbol; an image without symbols still gets a row
+    if (result.symbols.empty()) {
+        out << result.index << ',' << csv_field(result.path) << ",,,,no_barcode,,,," << decode_ms << '\n';
+    }
+    for (const SymbolResult& symbol : result.symbols) {
+        out << result.index << ',' << csv_field(result.path) << ',' << csv_field(symbol.symbol.data) << ','
+            << csv_field(symbol.symbol.type_name) << ',' << symbol.symbol.level << ',' << symbol_status(symbol) << ',';
+        if (symbol.found) {
+            snprintf(number, sizeof(number), "%.2f", symbol.product.price);
+            out << symbol.product.id << ',' << csv_field(symbol.product.name) << ',' << number;
+        } else {
+            out << ",,";
+        }
+        out << ',' << decode_ms << '\n';
+    }
+}
+
+
+int run_batch_scan(const BatchOptions& options, std::ostream& out, std::ostream& log) {
+    std::vector<std::string> paths;
+    try {
+        paths = collect_batch_inputs(options.input);
+    } catch (const std::runtime_error& e) {
+        log << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    if (paths.empty()) {
+        log << "No images found for: " << options.input << std::endl;
+        return 1;
+    }
+
+    sqlite3* db = nullptr;
+    CatalogLayout layout;
+    std::unique_ptr<ProductFilter> filter;
+    try {
+        db = open_database(options.database, *find_db_profile("scanner-readonly"));
+        layout = catalog_layout(db);
+        filter.reset(new ProductFilter(db, layout, product_filter_path(options.database)));
+        if (options.decode_cache_bytes > 0) {
+            // sets the cache file up once, before the workers open it
+            DecodeCache check(decode_cache_path(options.database), options.decode_cache_bytes);
+        }
+    } catch (const std::runtime_error& e) {
+        log << e.what() << std::endl;
+        filter.reset();
+        sqlite3_close(db);
+        return 1;
+    }
+
+    unsigned jobs = options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    jobs = static_cast<unsigned>(std::min<size_t>(jobs, paths.size()));
+    size_t group_size = std::max<size_t>(1, options.lookup_group);
+
+    // Workers hand decoded records to this thread, which owns the connection.
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::vector<BatchResult> decoded;
+    std::atomic<size_t> next(0);
+
+    auto started = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (unsigned j = 0; j < jobs; ++j) {
+        workers.emplace_back([&]() {
+            ScanContext& ctx = ScanContext::for_this_thread();
+            if (options.profile) {
+                ctx.set_profile(*options.profile);
+            }
+            ctx.set_pyramid_levels(options.pyramid_levels);
+            ctx.set_bar_width(options.bar_width);
+            ctx.set_pixel_budget(options.pixel_budget);
+            if (options.decode_cache_bytes > 0 && !ctx.decode_cache()) {
+                try {
+                    ctx.open_decode_cache(decode_cache_path(options.database), options.decode_cache_bytes);
+                } catch (const std::runtime_error&) {
+                    // a worker without the cache still decodes everything itself
+                }
+            }
+
+            size_t index;
+            while ((index = next.fetch_add(1)) < paths.size()) {
+                auto t0 = std::chrono::steady_clock::now();
+                BatchResult result{index, paths[index], 0.0, {}};
+                for (const ScannedSymbol& symbol : barcode_symbols(ctx, paths[index].c_str())) {
+                    result.symbols.push_back({symbol, false, Product()});
+                }
+                result.decode_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+                std::lock_guard<std::mutex> lock(mutex);
+                decoded.push_back(std::move(result));
+                ready.notify_one();
+            }
+        });
+    }
+
+    if (options.format == BatchFormat::Csv) {
+        out << "index,file,barcode,type,level,status,id,name,price,decode_ms\n";
+    }
+
+    std::vector<BatchResult> group;
+    std::map<size_t, BatchResult> reorder;
+    size_t received = 0;
+    size_t next_to_emit = 0;
+    size_t decoded_count = 0;
+    size_t symbol_count = 0;
+    size_t found_count = 0;
+    size_t level_counts[kMaxPyramidLevels + 1] = {};
+    int status = 0;
+
+    auto emit = [&](BatchResult& result) {
+        decoded_count += result.symbols.empty() ? 0 : 1;
+        symbol_count += result.symbols.size();
+        for (const SymbolResult& symbol : result.symbols) {
+            found_count += symbol.found ? 1 : 0;
+            ++level_counts[symbol.symbol.level];
+        }
+        write_result(out, options.format, result);
+    };
+
+    // Resolves the pending group with grouped lookups, then writes what is ready.
+    auto flush_group = [&]() {
+        std::vector<std::string> barcodes;
+        for (const BatchResult& result : group) {
+            for (const SymbolResult& symbol : result.symbols) {
+                barcodes.push_back(symbol.symbol.data);
+            }
+        }
+
+        barcodes = unique_barcodes(barcodes);
+        std::unordered_map<std::string, Product> products;
+        {
+            ProductFilter::Snapshot snapshot(*filter);
+            filter->remove_absent(barcodes);
+            products = lookup_products(db, layout, barcodes);
+        }
+        for (BatchResult& result : group) {
+            for (SymbolResult& symbol : result.symbols) {
+                auto it = products.find(symbol.symbol.data);
+                if (it != products.end()) {
+                    symbol.found = true;
+                    symbol.product = it->second;
+                }
+            }
+
+            if (options.order == BatchOrder::Completion) {
+                emit(result);
+            } else {
+                reorder.emplace(result.index, std::move(result));
+            }
+        }
+        group.clear();
+
+        for (auto it = reorder.begin(); it != reorder.end() && it->first == next_to_emit; it = reorder.erase(it)) {
+            emit(it->second);
+            ++next_to_emit;
+        }
+        out.flush();
+    };
+
+    try {
+        while (received < paths.size()) {
+            std::vector<BatchResult> arrived;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait_for(lock, std::chrono::milliseconds(100), [&]() { return !decoded.empty(); });
+                arrived.swap(decoded);
+            }
+
+            received += arrived.size();
+            for (BatchResult& result : arrived) {
+                group.push_back(std::move(result));
+            }
+
+            // A quiet interval also flushes, so slow inputs still stream out.
+            if (!group.empty() && (group.size() >= group_size || arrived.empty() || received == paths.size())) {
+                flush_group();
+            }
+        }
+    } catch (const std::runtime_error& e) {
+        log << e.what() << std::endl;
+        next = paths.size();
+        status = 1;
+    }
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    filter.reset();
+    sqlite3_close(db);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    char rate[64];
+    snprintf(rate, sizeof(rate), "%.1f", seconds > 0 ? received / seconds : 0.0);
+    log << "Scanned " << received << " images in " << seconds << " s (" << rate << " images/s) with "
+        << jobs << " jobs: " << decoded_count << " decoded, " << symbol_count << " symbols, " << found_count << " found" << std::endl;
+    if (options.pyramid_levels > 0) {
+        log << "Symbols by pyramid level:";
+        for (int level = 0; level <= kMaxPyramidLevels; ++level) {
+            log << " L" << level << "=" << level_counts[level];
+        }
+        log << std::endl;
+    }
+    if (options.pixel_budget > 0) {
+        std::vector<uint64_t> counters = counter_totals();
+        log << "Pixel budget: " << counters[static_cast<int>(Counter::ImageDownscaled)] << " images downscaled, "
+            << counters[static_cast<int>(Counter::ImageRejected)] << " rejected" << std::endl;
+    }
+    if (options.decode_cache_bytes > 0) {
+        std::vector<uint64_t> counters = counter_totals();
+        uint64_t hits = counters[static_cast<int>(Counter::DecodeCacheHit)];
+        uint64_t misses = counters[static_cast<int>(Counter::DecodeCacheMiss)];
+        char line[160];
+        snprintf(line, sizeof(line), "Decode cache: %llu hits, %llu misses (%.1f%% hit), %llu entries evicted",
+                 static_cast<unsigned long long>(hits), static_cast<unsigned long long>(misses),
+                 hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+                 static_cast<unsigned long long>(counters[static_cast<int>(Counter::DecodeCacheEvicted)]));
+        log << line << std::endl;
+    }
+    if (symbol_count > 0) {
+        log << "Product filter: " << counter_totals()[static_cast<int>(Counter::ProductFilterSkipped)]
+            << " barcodes ruled out without a database lookup" << std::endl;
+    }
+    const ScanProfile& profile = options.profile ? *options.profile : default_scan_profile();
+    if (profile.fast_code128) {
+        std::vector<StageSummary> stages = stage_summaries();
+        const StageSummary& hit = stages[static_cast<int>(Stage::Code128Hit)];
+        const StageSummary& miss = stages[static_cast<int>(Stage::Code128Miss)];
+        uint64_t tries = hit.count + miss.count;
+        if (tries > 0) {
+            char line[160];
+            snprintf(line, sizeof(line), "Code128 fast path: %llu of %llu images (%.1f%%), p50 %.1f us per hit, %.1f us per miss before zbar",
+                     static_cast<unsigned long long>(hit.count), static_cast<unsigned long long>(tries),
+                     100.0 * hit.count / tries, hit.count ? hit.p50 / 1e3 : 0.0, miss.count ? miss.p50 / 1e3 : 0.0);
+            log << line << std::endl;
+        }
+    }
+
+    return status;
+}
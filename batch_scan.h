@@ -0,0 +1,41 @@
+#ifndef BATCH_SCAN_H
+#define BATCH_SCAN_H
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+struct ScanProfile;
+
+enum class BatchFormat { Jsonl, Csv };
+enum class BatchOrder { Input, Completion };
+
+struct BatchOptions {
+    // A directory, a glob pattern, or a file with one image path per line ("-" for stdin).
+    std::string input;
+    BatchFormat format = BatchFormat::Jsonl;
+    BatchOrder order = BatchOrder::Input;
+    unsigned jobs = 0;                    // 0 uses every hardware thread
+    size_t lookup_group = 256;            // decoded barcodes per grouped lookup
+    const ScanProfile* profile = nullptr; // nullptr keeps default_scan_profile()
+    int pyramid_levels = 0;               // see ScanContext::set_pyramid_levels()
+    int bar_width = 0;                    // see ScanContext::set_bar_width()
+    size_t pixel_budget = 0;              // see ScanContext::set_pixel_budget()
+    size_t decode_cache_bytes = 0;        // decode cache next to `database`; 0 scans without
+    std::string database = "products.db";
+};
+
+// Expands BatchOptions::input into a sorted list of image paths.
+std::vector<std::string> collect_batch_inputs(const std::string& input);
+
+// `value` as a quoted JSON string / as a CSV field, quoted when needed.
+std::string json_string(const std::string& value);
+std::string csv_field(const std::string& value);
+
+// Decodes every input on a pool of `jobs` threads, each with its own
+// ScanContext, resolves the barcodes in grouped lookups over a single
+// read-only connection and streams one record per image to `out`.
+// A summary with the images/s rate goes to `log`. Returns the exit status.
+int run_batch_scan(const BatchOptions& options, std::ostream& out, std::ostream& log);
+
+#endif // BATCH_SCAN_H
@@ -0,0 +1,185 @@
+// barcode_alloc_stress: K generator processes allocating codes from one
+// catalog at once. Every code handed out is collected and checked for
+// repeats. With --kill, some processes die with SIGKILL halfway, holding
+// their lease, and a second wave has to take their blocks over.
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "db_session.h"
+
+struct StressOptions {
+    std::string database = "alloc_stress.db";
+    int processes = 8;
+    int codes = 20000;
+    int kill = 0;
+    bool insert = false;
+};
+
+static std::string codes_path(const StressOptions& options, int wave, int process) {
+    return options.database + ".codes." + std::to_string(wave) + "." + std::to_string(process);
+}
+
+// Runs in the child; never returns.
+static void generator(const StressOptions& options, int wave, int process, bool dies) {
+    int status = 0;
+    try {
+        DbSession session(options.database);
+        std::ofstream out(codes_path(options, wave, process));
+        int count = dies ? options.codes / 2 : options.codes;
+        for (int i = 0; i < count; ++i) {
+            std::string barcode;
+            if (options.insert) {
+                session.create_product("Stress product", 1.0, barcode);
+            }
+            else {
+                barcode = session.generate_unique_barcode();
+            }
+            out << barcode << '\n';
+        }
+        out.flush();
+        if (dies) {
+            raise(SIGKILL);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Process " << process << ": " << e.what() << std::endl;
+        status = 1;
+    }
+    std::exit(status);
+}
+
+// Starts one wave of generators and waits for all of them. Returns false
+// when one of them failed (other than the ones told to die).
+static bool run_wave(const StressOptions& options, int wave, int dying) {
+    std::vector<pid_t> children;
+    for (int process = 0; process < options.processes; ++process) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            throw std::runtime_error("fork failed");
+        }
+        if (pid == 0) {
+            generator(options, wave, process, process < dying);
+        }
+        children.push_back(pid);
+    }
+
+    bool ok = true;
+    for (size_t process = 0; process < children.size(); ++process) {
+        int status;
+        waitpid(children[process], &status, 0);
+        bool killed = WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL && static_cast<int>(process) < dying;
+        if (!killed && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static int64_t query_int(sqlite3* db, const char* sql) {
+    sqlite3_stmt* stmt;
+    int64_t value = 0;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+        value = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return value;
+}
+
+static void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [--database FILE] [--processes K] [--codes N] [--insert] [--kill M]" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    StressOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--database" && has_value) {
+            options.database = argv[++i];
+        }
+        else if (arg == "--processes" && has_value) {
+            options.processes = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--codes" && has_value) {
+            options.codes = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--kill" && has_value) {
+            options.kill = std::max(0, std::atoi(argv[++i]));
+        }
+        else if (arg == "--insert") {
+            options.insert = true;
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    // Codes a dead process handed out but never inserted may be handed out
+    // again, by design, so only inserted codes can be checked after a kill.
+    if (options.kill > 0) {
+        options.insert = true;
+    }
+
+    try {
+        for (const char* suffix : {"", "-wal", "-shm", "-journal"}) {
+            std::filesystem::remove(options.database + suffix);
+        }
+        {
+            DbSession session(options.database);
+        }
+
+        int waves = options.kill > 0 ? 2 : 1;
+        auto start = std::chrono::steady_clock::now();
+        bool ok = run_wave(options, 0, options.kill);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (waves == 2) {
+            ok = run_wave(options, 1, 0) && ok;
+        }
+
+        std::unordered_set<std::string> seen;
+        size_t total = 0, first_wave = 0, repeats = 0;
+        for (int wave = 0; wave < waves; ++wave) {
+            for (int process = 0; process < options.processes; ++process) {
+                std::string path = codes_path(options, wave, process);
+                std::ifstream in(path);
+                std::string barcode;
+                while (std::getline(in, barcode)) {
+                    ++total;
+                    repeats += !seen.insert(barcode).second;
+                }
+                std::filesystem::remove(path);
+            }
+            if (wave == 0) {
+                first_wave = total;
+            }
+        }
+
+        sqlite3* db;
+        sqlite3_open(options.database.c_str(), &db);
+        std::cout << options.processes << " processes, " << total << " codes, " << repeats << " repeated\n"
+                  << "first wave: " << first_wave / seconds << " codes/s"
+                  << (options.insert ? " (with inserts)" : "") << "\n"
+                  << "allocator blocks: " << query_int(db, "SELECT next_index FROM barcode_allocator;") / BarcodeLease::kBlockSize
+                  << ", leases left: " << query_int(db, "SELECT count(*) FROM barcode_allocations;")
+                  << ", products: " << query_int(db, "SELECT count(*) FROM products;") << std::endl;
+        sqlite3_close(db);
+        return ok && repeats == 0 ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,49 @@
+#include "bench.h"
+
+#include <chrono>
+#include <cstdio>
+
+double bench_min_seconds = 0.5;
+
+BenchResult run_benchmark(const std::string& name, size_t bytes_per_op, const std::function<void()>& op) {
+    op();
+
+    uint64_t iterations = 1;
+    for (;;) {
+        uint64_t allocations = allocation_count();
+        auto started = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < iterations; ++i) {
+            op();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        allocations = allocation_count() - allocations;
+
+        if (seconds >= bench_min_seconds || iterations >= (uint64_t(1) << 40)) {
+            BenchResult result;
+            result.name = name;
+            result.iterations = iterations;
+            result.ns_per_op = seconds * 1e9 / iterations;
+            result.mb_per_s = bytes_per_op ? bytes_per_op * iterations / seconds / 1e6 : 0.0;
+            result.allocs_per_op = static_cast<double>(allocations) / iterations;
+            return result;
+        }
+
+        // aim straight for the target once the batch is long enough to time
+        double grow = seconds > 0.01 ? bench_min_seconds / seconds * 1.2 : 10.0;
+        iterations = static_cast<uint64_t>(iterations * (grow < 2.0 ? 2.0 : grow));
+    }
+}
+
+void print_header() {
+    printf("%-40s %12s %14s %10s %12s\n", "benchmark", "iterations", "ns/op", "MB/s", "allocs/op");
+}
+
+void print_result(const BenchResult& result) {
+    char rate[32] = "-";
+    if (result.mb_per_s > 0) {
+        snprintf(rate, sizeof(rate), "%.1f", result.mb_per_s);
+    }
+    printf("%-40s %12llu %14.1f %10s %12.2f\n", result.name.c_str(), static_cast<unsigned long long>(result.iterations),
+           result.ns_per_op, rate, result.allocs_per_op);
+    fflush(stdout);
+}
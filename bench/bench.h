@@ -0,0 +1,32 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Heap allocations (malloc, calloc, realloc and therefore operator new) made
+// by the process so far. Counted by alloc_counter.cpp.
+uint64_t allocation_count();
+
+struct BenchResult {
+    std::string name;
+    uint64_t iterations;
+    double ns_per_op;
+    double mb_per_s;        // 0 when the benchmark has no byte size
+    double allocs_per_op;
+};
+
+// Minimum duration of the measured batch, set by --min-time.
+extern double bench_min_seconds;
+
+// Calls `op` once to warm up, then in doubling batches until one batch takes
+// at least bench_min_seconds, and reports that batch. `bytes_per_op` is the
+// input size one call processes, for the MB/s column.
+BenchResult run_benchmark(const std::string& name, size_t bytes_per_op, const std::function<void()>& op);
+
+void print_header();
+void print_result(const BenchResult& result);
+
+#endif // BENCH_H
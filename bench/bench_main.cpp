@@ -0,0 +1,651 @@
+// barcode_bench: micro-benchmarks for the decode and generate hot paths.
+#include <sqlite3.h>
+#include <zint.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "barcode_catalog.h"
+#include "barcode_format.h"
+#include "barcode_label.h"
+#include "bench.h"
+#include "code128.h"
+#include "code128_decode.h"
+#include "corpus.h"
+#include "db_profile.h"
+#include "db_session.h"
+#include "decode_cache.h"
+#include "gray_convert.h"
+#include "jpeg_gray.h"
+#include "png_gray.h"
+#include "product_filter.h"
+#include "product_lookup.h"
+#include "scan_context.h"
+#include "schema_migrations.h"
+#include "stb_image.h"
+
+struct BenchOptions {
+    std::string corpus = "bench_corpus";
+    std::string filter;
+    std::vector<int> catalog_rows = {1000, 1000000};
+};
+
+static BenchOptions options;
+
+static void bench(const std::string& name, size_t bytes_per_op, const std::function<void()>& op) {
+    if (name.find(options.filter) != std::string::npos) {
+        print_result(run_benchmark(name, bytes_per_op, op));
+    }
+}
+
+static std::string size_name(int width, int height) {
+    return std::to_string(width) + "x" + std::to_string(height);
+}
+
+struct GrayImage {
+    std::vector<unsigned char> pixels;
+    int width;
+    int height;
+};
+
+
+static void bench_gray() {
+    const int width = 1920, height = 1080;
+    const size_t pixels = static_cast<size_t>(width) * height;
+    std::vector<unsigned char> src(pixels * 4);
+    std::vector<unsigned char> dst(pixels);
+    std::mt19937 rng(1);
+    for (unsigned char& byte : src) {
+        byte = static_cast<unsigned char>(rng());
+    }
+
+    for (int channels = 1; channels <= 4; ++channels) {
+        bench("gray/" + std::to_string(channels) + "ch/" + size_name(width, height) + "/" + gray_convert_backend(), pixels * channels,
+              [&]() { convert_to_gray(src.data(), channels, pixels, dst.data()); });
+    }
+    bench("downscale_half/" + size_name(width, height), pixels,
+          [&]() { downscale_half(src.data(), width, height, dst.data()); });
+
+    // RGB to gray at 1/factor in one pass, as for images over the pixel budget
+    GrayShrinker shrinker;
+    for (int factor : {1, 2, 3, 4}) {
+        bench("gray_shrink/3ch/" + size_name(width, height) + "/1:" + std::to_string(factor) + "/" + gray_convert_backend(), pixels * 3, [&]() {
+            shrinker.start(width, 3, factor, dst.data());
+            for (int y = 0; y < height; ++y) {
+                shrinker.add_row(src.data() + static_cast<size_t>(y) * width * 3);
+            }
+        });
+    }
+}
+
+static void bench_scan(const std::vector<CorpusImage>& corpus) {
+    // decoded once up front so only the scanner is timed
+    std::map<std::string, std::vector<GrayImage>> by_size;
+    for (const CorpusImage& image : corpus) {
+        int width, height, channels;
+        unsigned char* data = stbi_load(image.path.c_str(), &width, &height, &channels, 1);
+        if (!data) {
+            throw std::runtime_error("Cannot load " + image.path);
+        }
+        by_size[size_name(width, height)].push_back({std::vector<unsigned char>(data, data + static_cast<size_t>(width) * height), width, height});
+        stbi_image_free(data);
+    }
+
+    // code128-only without the native decoder, to see what it saves
+    std::vector<ScanProfile> profiles = scan_profiles();
+    profiles.push_back(*find_scan_profile("code128-only"));
+    profiles.back().name = "code128-zbar";
+    profiles.back().fast_code128 = false;
+
+    ScanContext& ctx = ScanContext::for_this_thread();
+    for (const ScanProfile& profile : profiles) {
+        ctx.set_profile(profile);
+        for (const auto& group : by_size) {
+            const std::vector<GrayImage>& images = group.second;
+            size_t next = 0;
+            bench("scan/" + profile.name + "/" + group.first, images[0].pixels.size(), [&]() {
+                const GrayImage& image = images[next++ % images.size()];
+                ctx.scan_gray(image.pixels.data(), image.width, image.height);
+            });
+        }
+    }
+    ctx.set_profile(default_scan_profile());
+
+    for (const auto& group : by_size) {
+        const std::vector<GrayImage>& images = group.second;
+        std::string name = std::string("code128/decode/") + group.first + "/" + code128_decode_backend();
+        if (name.find(options.filter) == std::string::npos) {
+            continue;
+        }
+        Code128Read read;
+        size_t hits = 0;
+        for (const GrayImage& image : images) {
+            hits += code128_decode(image.pixels.data(), image.width, image.height, read) ? 1 : 0;
+        }
+        std::cerr << name << ": " << hits << " of " << images.size() << " images read" << std::endl;
+
+        size_t next = 0;
+        bench(name, images[0].pixels.size(), [&]() {
+            const GrayImage& image = images[next++ % images.size()];
+            code128_decode(image.pixels.data(), image.width, image.height, read);
+        });
+    }
+}
+
+static void bench_reader(const std::vector<CorpusImage>& corpus) {
+    std::map<std::string, std::vector<std::string>> by_size;
+    std::map<std::string, size_t> bytes;
+    for (const CorpusImage& image : corpus) {
+        std::string size = size_name(image.width, image.height);
+        by_size[size].push_back(image.path);
+        bytes[size] += std::filesystem::file_size(image.path);
+    }
+
+    ScanContext& ctx = ScanContext::for_this_thread();
+    for (const auto& group : by_size) {
+        const std::vector<std::string>& paths = group.second;
+        size_t next = 0;
+        bench("barcode_reader/" + group.first, bytes[group.first] / paths.size(), [&]() {
+            barcode_reader(ctx, paths[next++ % paths.size()].c_str());
+        });
+    }
+
+    // The same files again once each is in a fresh decode cache: a file read,
+    // a hash and a lookup.
+    std::string cache = (std::filesystem::path(options.corpus) / "decode_cache.db").string();
+    for (const char* suffix : {"", "-wal", "-shm"}) {
+        std::filesystem::remove(cache + suffix);
+    }
+    ctx.open_decode_cache(cache, 64 << 20);
+    for (const auto& group : by_size) {
+        const std::vector<std::string>& paths = group.second;
+        for (const std::string& path : paths) {
+            barcode_reader(ctx, path.c_str());
+        }
+        size_t next = 0;
+        bench("barcode_reader/cached/" + group.first, bytes[group.first] / paths.size(), [&]() {
+            barcode_reader(ctx, paths[next++ % paths.size()].c_str());
+        });
+    }
+    ctx.close_decode_cache();
+
+    std::vector<unsigned char> data(1 << 20);
+    std::mt19937 rng(1);
+    std::generate(data.begin(), data.end(), [&]() { return static_cast<unsigned char>(rng()); });
+    bench("xxh64/1MB", data.size(), [&]() { xxh64(data.data(), data.size()); });
+}
+
+// A 20 MP camera JPEG through stbi (RGB, then luma) against the luma-only
+// libjpeg decoder at every DCT scale, and the whole reader with and without
+// the bar width that allows scaling.
+static void bench_jpeg() {
+    std::string code;
+    std::string path = build_photo_jpeg(options.corpus, code);
+    std::ifstream file(path, std::ios::binary);
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const int width = 5472, height = 3648;
+    std::vector<unsigned char> gray(static_cast<size_t>(width) * height);
+    std::string size = size_name(width, height);
+
+    bench("jpeg/stbi/" + size, data.size(), [&]() {
+        int w, h, channels;
+        unsigned char* image = stbi_load_from_memory(data.data(), static_cast<int>(data.size()), &w, &h, &channels, 0);
+        convert_to_gray(image, channels, static_cast<size_t>(w) * h, gray.data());
+        stbi_image_free(image);
+    });
+
+    JpegGrayDecoder jpeg;
+    for (int scale : {1, 2, 4, 8}) {
+        bench("jpeg/luma/" + size + "/1:" + std::to_string(scale), data.size(), [&]() {
+            if (jpeg.start(data.data(), data.size(), scale)) {
+                jpeg.read(gray.data());
+            }
+        });
+    }
+
+    ScanContext& ctx = ScanContext::for_this_thread();
+    for (int bar_width : {0, 8}) {
+        ctx.set_bar_width(bar_width);
+        std::string name = "barcode_reader/jpeg/" + size + "/bar" + std::to_string(bar_width);
+        if (name.find(options.filter) != std::string::npos && barcode_reader(ctx, path.c_str()) != code) {
+            std::cerr << name << ": label not read" << std::endl;
+        }
+        bench(name, data.size(), [&]() { barcode_reader(ctx, path.c_str()); });
+    }
+    ctx.set_bar_width(0);
+}
+
+// A 35 MP scanned label sheet through stbi (RGB, then luma) against the
+// row-by-row PNG decoder.
+static void bench_png() {
+    std::string path = build_sheet_png(options.corpus);
+    std::ifstream file(path, std::ios::binary);
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const int width = 4960, height = 7016;
+    std::vector<unsigned char> gray(static_cast<size_t>(width) * height);
+    std::string size = size_name(width, height);
+
+    bench("png/stbi/" + size, data.size(), [&]() {
+        int w, h, channels;
+        unsigned char* image = stbi_load_from_memory(data.data(), static_cast<int>(data.size()), &w, &h, &channels, 0);
+        convert_to_gray(image, channels, static_cast<size_t>(w) * h, gray.data());
+        stbi_image_free(image);
+    });
+
+    PngGrayDecoder png;
+    bench("png/rows/" + size, data.size(), [&]() {
+        if (png.start(data.data(), data.size())) {
+            png.read(gray.data());
+        }
+    });
+}
+
+
+// Reuses the catalog file when it already has `rows` products.
+static std::string build_catalog(int rows) {
+    std::string path = (std::filesystem::path(options.corpus) / ("catalog_" + std::to_string(rows) + ".db")).string();
+
+    sqlite3* db;
+    if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+        throw std::runtime_error("Error opening database: " + std::string(sqlite3_errmsg(db)));
+    }
+    migrate_schema(db);
+
+    sqlite3_stmt* stmt;
+    int existing = 0;
+    if (sqlite3_prepare_v2(db, "SELECT count(*) FROM products;", -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            existing = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    if (existing != rows) {
+        std::cerr << "Building " << path << " with " << rows << " products" << std::endl;
+        sqlite3_exec(db, "DELETE FROM products; BEGIN;", nullptr, nullptr, nullptr);
+        sqlite3_prepare_v2(db, "INSERT OR IGNORE INTO products (barcode, product_name, price_cents) VALUES (?, ?, ?);", -1, &stmt, nullptr);
+        std::mt19937 rng(static_cast<unsigned>(rows));
+        for (int i = 0; i < rows; ++i) {
+            std::string code = corpus_code(rng);
+            std::string name = "Product " + std::to_string(i);
+            sqlite3_bind_text(stmt, 1, code.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(stmt, 2, name.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int(stmt, 3, 100 + i % 100 * 100);
+            sqlite3_step(stmt);
+            sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+        if (sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+            std::string error = sqlite3_errmsg(db);
+            sqlite3_close(db);
+            throw std::runtime_error("Catalog build failed: " + error);
+        }
+    }
+
+    sqlite3_close(db);
+    return path;
+}
+
+static void bench_generate() {
+    bench("generate_random_barcode", 0, []() { generate_random_barcode(); });
+    BarcodePermutation permutation(1);
+    int64_t index = 0;
+    bench("barcode_at", 0, [&]() { barcode_at(permutation, index++); });
+
+    for (int rows : options.catalog_rows) {
+        DbSession session(build_catalog(rows));
+        bench("generate_unique_barcode/" + std::to_string(rows), 0, [&]() { session.generate_unique_barcode(); });
+    }
+
+    // Inserts go into a copy, so the cached catalog keeps its row count.
+    for (int rows : options.catalog_rows) {
+        std::string path = (std::filesystem::path(options.corpus) / ("create_" + std::to_string(rows) + ".db")).string();
+        for (const char* suffix : {"", "-wal", "-shm", "-journal"}) {
+            std::filesystem::remove(path + suffix);
+        }
+        std::filesystem::copy_file(build_catalog(rows), path);
+        DbSession session(path);
+        std::string barcode;
+        bench("create_product/" + std::to_string(rows), 0, [&]() { session.create_product("Bench product", 1.0, barcode); });
+    }
+}
+
+// Each profile gets its own copy of the smallest catalog, so journal mode
+// changes and inserted rows do not leak into the next one. sqlite-default is
+// a plain sqlite3_open() for comparison.
+static void bench_db_profiles() {
+    int rows = *std::min_element(options.catalog_rows.begin(), options.catalog_rows.end());
+    std::string catalog = build_catalog(rows);
+
+    std::vector<std::string> codes;
+    std::mt19937 rng(static_cast<unsigned>(rows));
+    for (int i = 0; i < rows; ++i) {
+        codes.push_back(corpus_code(rng));
+    }
+
+    std::vector<DbProfile> profiles = {{"sqlite-default", false, 0, "", false}};
+    profiles.insert(profiles.end(), db_profiles().begin(), db_profiles().end());
+    for (const DbProfile& profile : profiles) {
+        std::string path = (std::filesystem::path(options.corpus) / ("profile_" + profile.name + ".db")).string();
+        for (const char* suffix : {"", "-wal", "-shm", "-journal"}) {
+            std::filesystem::remove(path + suffix);
+        }
+        std::filesystem::copy_file(catalog, path);
+        {
+            // Start each writing profile from the rollback journal a new file
+            // has. Scanners read what the writer profile left, which is WAL.
+            sqlite3* db;
+            sqlite3_open(path.c_str(), &db);
+            sqlite3_exec(db, profile.read_only ? "PRAGMA journal_mode = WAL;" : "PRAGMA journal_mode = DELETE;", nullptr, nullptr, nullptr);
+            sqlite3_close(db);
+        }
+
+        DbSession session(path, profile);
+        std::string prefix = "db/" + profile.name + "/";
+        size_t next = 0;
+        bench(prefix + "lookup/" + std::to_string(rows), 0, [&]() { session.lookup({codes[next++ % codes.size()]}); });
+        if (!profile.read_only) {
+            int inserted = 0;
+            bench(prefix + "insert", 0, [&]() {
+                std::string code = std::to_string(++inserted);
+                session.add_product("B" + std::string(11 - code.size(), '0') + code, "Bench product", 1.0);
+            });
+        }
+    }
+}
+
+// Building the product filter from each catalog and loading it back, a
+// probe, and single-code lookups of codes in the catalog and of foreign
+// ones, on the cached statement alone and through DbSession::lookup(),
+// which asks the filter first.
+static void bench_product_filter() {
+    for (int rows : options.catalog_rows) {
+        std::string catalog = build_catalog(rows);
+        std::string path = product_filter_path(catalog);
+        DbSession session(catalog);
+        std::string suffix = "/" + std::to_string(rows);
+
+        bench("product_filter/build" + suffix, 0, [&]() {
+            std::filesystem::remove(path);
+            ProductFilter filter(session.handle(), session.layout(), path);
+        });
+        bench("product_filter/load" + suffix, 0, [&]() { ProductFilter filter(session.handle(), session.layout(), path); });
+
+        std::vector<std::string> present, foreign;
+        std::mt19937 rng(static_cast<unsigned>(rows));
+        for (int i = 0; i < rows; ++i) {
+            present.push_back(corpus_code(rng));
+        }
+        std::mt19937 other(12345);
+        for (int i = 0; i < 10000; ++i) {
+            foreign.push_back(corpus_code(other));
+        }
+
+        ProductFilter& filter = session.filter();
+        size_t passed = 0;
+        for (const std::string& code : foreign) {
+            passed += filter.may_contain(code) ? 1 : 0;
+        }
+        std::cerr << "product_filter" << suffix << ": " << filter.size_bytes() << " bytes, "
+                  << passed << " of " << foreign.size() << " foreign codes pass" << std::endl;
+        size_t next = 0;
+        bench("product_filter/probe" + suffix + "/" + product_filter_backend(), 0, [&]() { filter.may_contain(foreign[next++ % foreign.size()]); });
+
+        for (const char* kind : {"hit", "miss"}) {
+            const std::vector<std::string>& codes = kind[0] == 'h' ? present : foreign;
+            std::unordered_map<std::string, Product> found;
+            next = 0;
+            bench("lookup" + suffix + "/" + kind + "/sqlite", 0, [&]() {
+                DbStatement stmt = session.prepare(lookup_products_sql(session.layout(), 1));
+                collect_products(stmt, session.layout(), &codes[next++ % codes.size()], 1, found);
+            });
+            next = 0;
+            bench("lookup" + suffix + "/" + kind + "/filter", 0, [&]() { session.lookup({codes[next++ % codes.size()]}); });
+        }
+
+        // a batch group of foreign codes, as one IN query or none
+        std::vector<std::string> group(foreign.begin(), foreign.begin() + 100);
+        std::unordered_map<std::string, Product> found;
+        bench("lookup" + suffix + "/miss100/sqlite", 0, [&]() {
+            DbStatement stmt = session.prepare(lookup_products_sql(session.layout(), group.size()));
+            collect_products(stmt, session.layout(), group.data(), group.size(), found);
+        });
+        bench("lookup" + suffix + "/miss100/filter", 0, [&]() { session.lookup(group); });
+    }
+}
+
+// Both layouts of every catalog, on copies. Besides the timings, the file
+// size and the pages a lookup visits (page cache hits + misses) go to stderr.
+static void bench_layouts() {
+    for (int rows : options.catalog_rows) {
+        std::string catalog = build_catalog(rows);
+        std::vector<std::string> codes;
+        std::mt19937 rng(static_cast<unsigned>(rows));
+        for (int i = 0; i < rows; ++i) {
+            codes.push_back(corpus_code(rng));
+        }
+
+        for (CatalogLayout layout : {CatalogLayout::Text, CatalogLayout::Compact}) {
+            std::string name = layout == CatalogLayout::Compact ? "compact" : "text";
+            std::string path = (std::filesystem::path(options.corpus) / ("layout_" + name + "_" + std::to_string(rows) + ".db")).string();
+            for (const char* suffix : {"", "-wal", "-shm", "-journal"}) {
+                std::filesystem::remove(path + suffix);
+            }
+            std::filesystem::copy_file(catalog, path);
+
+            {
+                // closed before measuring: the VACUUM only reaches the file
+                // at the final checkpoint
+                DbSession session(path, *find_db_profile("writer"));
+                convert_catalog(session.handle(), layout);
+                sqlite3_exec(session.handle(), "VACUUM;", nullptr, nullptr, nullptr);
+            }
+
+            int hits, misses, unused;
+            {
+                // pages read through the mmap bypass the cache counters
+                DbProfile counting = *find_db_profile("scanner-readonly");
+                counting.pragmas += "PRAGMA mmap_size = 0;";
+                DbSession probe(path, counting);
+                sqlite3_db_status(probe.handle(), SQLITE_DBSTATUS_CACHE_HIT, &hits, &unused, 1);
+                sqlite3_db_status(probe.handle(), SQLITE_DBSTATUS_CACHE_MISS, &misses, &unused, 1);
+                for (int i = 0; i < 1000; ++i) {
+                    probe.lookup({codes[i % codes.size()]});
+                }
+                sqlite3_db_status(probe.handle(), SQLITE_DBSTATUS_CACHE_HIT, &hits, &unused, 0);
+                sqlite3_db_status(probe.handle(), SQLITE_DBSTATUS_CACHE_MISS, &misses, &unused, 0);
+            }
+            DbSession converted(path, *find_db_profile("writer"));
+            std::cerr << name << " layout, " << rows << " products: " << std::filesystem::file_size(path) / 1e6 << " MB, "
+                      << (hits + misses) / 1000.0 << " pages per lookup" << std::endl;
+
+            std::string prefix = "db/layout/" + name + "/";
+            size_t next = 0;
+            bench(prefix + "lookup/" + std::to_string(rows), 0, [&]() { converted.lookup({codes[next++ % codes.size()]}); });
+            int inserted = 0;
+            bench(prefix + "insert/" + std::to_string(rows), 0, [&]() {
+                std::string code = std::to_string(++inserted);
+                converted.add_product("B" + std::string(11 - code.size(), '0') + code, "Bench product", 1.0);
+            });
+        }
+    }
+}
+
+static void bench_zint() {
+    zint_symbol* symbol = ZBarcode_Create();
+    if (!symbol) {
+        throw std::runtime_error("Creation error Zint");
+    }
+    const unsigned char* code = reinterpret_cast<const unsigned char*>("ABC123DEF456");
+    std::string outfile = (std::filesystem::path(options.corpus) / "print.png").string();
+
+    bench("zint/encode", 0, [&]() {
+        ZBarcode_Clear(symbol);
+        symbol->symbology = BARCODE_CODE128;
+        symbol->height = 50;
+        symbol->scale = 2.0f;
+        ZBarcode_Encode(symbol, code, 0);
+    });
+
+    if (outfile.size() < sizeof(symbol->outfile)) {
+        strcpy(symbol->outfile, outfile.c_str());
+        if (ZBarcode_Print(symbol, 0) != 0) {
+            std::string error = symbol->errtxt;
+            ZBarcode_Delete(symbol);
+            throw std::runtime_error("Zint error: " + error);
+        }
+        size_t bytes = std::filesystem::file_size(outfile);
+        bench("zint/print_png", bytes, [&]() { ZBarcode_Print(symbol, 0); });
+    }
+    ZBarcode_Delete(symbol);
+
+    std::vector<unsigned char> row(static_cast<size_t>(code128_width("ABC123DEF456", 4)));
+    bench("code128/encode_row", row.size(), [&]() {
+        uint8_t values[32];
+        int count = code128_encode("ABC123DEF456", 12, values, 32);
+        code128_row(values, count, 4, RowFormat::Gray8, row.data());
+    });
+
+    // the whole label either way: in memory, or through a PNG file
+    LabelRenderer renderer;
+    LabelBitmap bitmap = renderer.render("ABC123DEF456");
+    bench("label/render", static_cast<size_t>(bitmap.width) * bitmap.height * bitmap.channels, [&]() { renderer.render("ABC123DEF456"); });
+    bench("label/save", 0, [&]() { renderer.save("ABC123DEF456", outfile); });
+}
+
+// Compares code128_render() with zint's bitmap, text line off, for the
+// corpus labels, 10000 more generator codes and some data that switches
+// code sets. Returns the number of labels that differ.
+static int verify_code128(const std::vector<CorpusImage>& corpus) {
+    std::vector<std::pair<std::string, float>> labels;
+    for (const CorpusImage& image : corpus) {
+        if (std::find(labels.begin(), labels.end(), std::make_pair(image.code, image.scale)) == labels.end()) {
+            labels.emplace_back(image.code, image.scale);
+        }
+    }
+    std::mt19937 rng(128);
+    for (int i = 0; i < 10000; ++i) {
+        labels.emplace_back(corpus_code(rng), kBarcodeScale);
+    }
+    for (const char* code : {"12", "123", "1234", "12345", "A1234B", "A12345", "1234A", "X123456Y", "000000000000", "hello world"}) {
+        labels.emplace_back(code, kBarcodeScale);
+    }
+
+    zint_symbol* symbol = ZBarcode_Create();
+    if (!symbol) {
+        throw std::runtime_error("Creation error Zint");
+    }
+    std::vector<unsigned char> native;
+    int differ = 0;
+    for (const auto& label : labels) {
+        const std::string& code = label.first;
+        ZBarcode_Clear(symbol);
+        symbol->symbology = BARCODE_CODE128;
+        symbol->height = kBarcodeHeight;
+        symbol->scale = label.second;
+        symbol->show_hrt = 0;
+        if (ZBarcode_Encode_and_Buffer(symbol, reinterpret_cast<const unsigned char*>(code.c_str()), 0, 0) != 0) {
+            std::string error = symbol->errtxt;
+            ZBarcode_Delete(symbol);
+            throw std::runtime_error("Zint error: " + error);
+        }
+
+        int px = static_cast<int>(2 * label.second);
+        int width = code128_width(code, px);
+        int height = static_cast<int>(kBarcodeHeight * px + 0.5f);
+        bool same = width == symbol->bitmap_width && height == symbol->bitmap_height;
+        if (same) {
+            native.resize(static_cast<size_t>(width) * height);
+            code128_render(code, px, height, RowFormat::Gray8, native.data(), static_cast<size_t>(width));
+            for (size_t i = 0; same && i < native.size(); ++i) {
+                same = native[i] == symbol->bitmap[3 * i];
+            }
+        }
+        if (!same && differ++ < 5) {
+            std::cerr << "code128 differs from zint: \"" << code << "\" at scale " << label.second << " (" << width << "x" << height
+                      << " against " << symbol->bitmap_width << "x" << symbol->bitmap_height << ")" << std::endl;
+        }
+    }
+    ZBarcode_Delete(symbol);
+
+    std::cerr << "code128: " << labels.size() - differ << " of " << labels.size() << " labels match zint" << std::endl;
+    return differ;
+}
+
+
+static void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [--corpus DIR] [--filter TEXT] [--min-time SECONDS] [--catalog-rows N[,N...]] [--verify-code128]" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    bool verify = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--corpus" && has_value) {
+            options.corpus = argv[++i];
+        }
+        else if (arg == "--filter" && has_value) {
+            options.filter = argv[++i];
+        }
+        else if (arg == "--min-time" && has_value) {
+            bench_min_seconds = std::atof(argv[++i]);
+        }
+        else if (arg == "--catalog-rows" && has_value) {
+            options.catalog_rows.clear();
+            std::stringstream list(argv[++i]);
+            std::string rows;
+            while (std::getline(list, rows, ',')) {
+                options.catalog_rows.push_back(std::atoi(rows.c_str()));
+            }
+        }
+        else if (arg == "--verify-code128") {
+            verify = true;
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // catalogs get the same allocator key, and so the same codes, on every run
+    set_barcode_seed(1);
+
+    try {
+        std::vector<CorpusImage> corpus = build_corpus(options.corpus);
+        std::cerr << "Corpus: " << corpus.size() << " images in " << options.corpus << std::endl;
+        if (verify) {
+            return verify_code128(corpus) == 0 ? 0 : 1;
+        }
+
+        print_header();
+        bench_gray();
+        bench_scan(corpus);
+        bench_reader(corpus);
+        bench_jpeg();
+        bench_png();
+        bench_generate();
+        bench_db_profiles();
+        bench_product_filter();
+        bench_layouts();
+        bench_zint();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include "corpus.h"
+
+#include <png.h>
+#include <jpeglib.h>  // after png.h, which brings the stdio.h it needs
+#include <zint.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+
+#include "barcode_code.h"
+#include "code128.h"
+#include "gray_convert.h"
+
+static const int kCanvasSizes[][2] = {{640, 480}, {1280, 720}, {1920, 1080}};
+static const float kScales[] = {1.0f, 2.0f, 3.0f};
+static const int kNoiseLevels[] = {0, 16, 48};
+
+void write_gray_png(const std::string& path, const unsigned char* pixels, int width, int height) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error("Cannot write " + path);
+    }
+
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info = png ? png_create_info_struct(png) : nullptr;
+    if (!info || setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        fclose(file);
+        throw std::runtime_error("PNG encoding failed: " + path);
+    }
+
+    png_init_io(png, file);
+    png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    for (int y = 0; y < height; ++y) {
+        png_write_row(png, pixels + static_cast<size_t>(y) * width);
+    }
+    png_write_end(png, nullptr);
+
+    png_destroy_write_struct(&png, &info);
+    fclose(file);
+}
+
+std::string corpus_code(std::mt19937& rng) {
+    std::uniform_int_distribution<int> pick(0, sizeof(kBarcodeCharset) - 2);
+    std::string code;
+    for (int i = 0; i < kBarcodeLength; ++i) {
+        code += kBarcodeCharset[pick(rng)];
+    }
+    return code;
+}
+
+std::vector<CorpusImage> build_corpus(const std::string& dir) {
+    std::filesystem::create_directories(dir);
+
+    std::vector<CorpusImage> corpus;
+    std::vector<unsigned char> label;
+    std::vector<unsigned char> canvas;
+    std::mt19937 codes(20240601);
+
+    for (float scale : kScales) {
+        std::string code = corpus_code(codes);
+
+        zint_symbol* symbol = ZBarcode_Create();
+        if (!symbol) {
+            throw std::runtime_error("Creation error Zint");
+        }
+        symbol->symbology = BARCODE_CODE128;
+        symbol->height = 50;
+        symbol->scale = scale;
+        if (ZBarcode_Encode_and_Buffer(symbol, reinterpret_cast<const unsigned char*>(code.c_str()), 0, 0) != 0) {
+            std::string error = symbol->errtxt;
+            ZBarcode_Delete(symbol);
+            throw std::runtime_error("Zint error: " + error);
+        }
+
+        int label_width = symbol->bitmap_width;
+        int label_height = symbol->bitmap_height;
+        label.resize(static_cast<size_t>(label_width) * label_height);
+        convert_to_gray(symbol->bitmap, 3, label.size(), label.data());
+        ZBarcode_Delete(symbol);
+
+        for (const auto& size : kCanvasSizes) {
+            int width = size[0];
+            int height = size[1];
+            if (label_width > width || label_height > height) {
+                continue;
+            }
+
+            for (int noise : kNoiseLevels) {
+                canvas.assign(static_cast<size_t>(width) * height, 255);
+                int x0 = (width - label_width) / 2;
+                int y0 = (height - label_height) / 2;
+                for (int y = 0; y < label_height; ++y) {
+                    std::copy_n(&label[static_cast<size_t>(y) * label_width], label_width,
+                                &canvas[static_cast<size_t>(y0 + y) * width + x0]);
+                }
+
+                if (noise > 0) {
+                    std::mt19937 rng(static_cast<unsigned>(corpus.size() + 1));
+                    std::uniform_int_distribution<int> delta(-noise, noise);
+                    for (unsigned char& pixel : canvas) {
+                        pixel = static_cast<unsigned char>(std::clamp(pixel + delta(rng), 0, 255));
+                    }
+                }
+
+                char name[96];
+                snprintf(name, sizeof(name), "code128_%dx%d_s%d_n%d.png", width, height, static_cast<int>(scale), noise);
+                std::string path = (std::filesystem::path(dir) / name).string();
+                write_gray_png(path, canvas.data(), width, height);
+                corpus.push_back({path, code, width, height, scale, noise});
+            }
+        }
+    }
+
+    return corpus;
+}
+
+std::string build_photo_jpeg(const std::string& dir, std::string& code) {
+    const int width = 5472, height = 3648, module_px = 8;
+    std::mt19937 rng(20240602);
+    code = corpus_code(rng);
+    std::string path = (std::filesystem::path(dir) / "photo_5472x3648.jpg").string();
+    if (std::filesystem::exists(path)) {
+        return path;
+    }
+    std::filesystem::create_directories(dir);
+
+    int label_width = code128_width(code, module_px);
+    int label_height = 100 * module_px;
+    std::vector<unsigned char> label(static_cast<size_t>(label_width) * label_height);
+    code128_render(code, module_px, label_height, RowFormat::Gray8, label.data(), static_cast<size_t>(label_width));
+
+    // paper-coloured background, the label printed on it in the middle
+    std::vector<unsigned char> rgb(static_cast<size_t>(width) * height * 3);
+    std::uniform_int_distribution<int> delta(-12, 12);
+    int x0 = (width - label_width) / 2;
+    int y0 = (height - label_height) / 2;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            bool inside = x >= x0 && x < x0 + label_width && y >= y0 && y < y0 + label_height;
+            int base = inside ? label[static_cast<size_t>(y - y0) * label_width + (x - x0)] : 235;
+            unsigned char* p = &rgb[(static_cast<size_t>(y) * width + x) * 3];
+            int n = delta(rng);
+            p[0] = static_cast<unsigned char>(std::clamp(base + n, 0, 255));
+            p[1] = static_cast<unsigned char>(std::clamp(base + n - 6, 0, 255));
+            p[2] = static_cast<unsigned char>(std::clamp(base + n - 18, 0, 255));
+        }
+    }
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error("Cannot write " + path);
+    }
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr error;
+    cinfo.err = jpeg_std_error(&error);
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, file);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 90, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = &rgb[static_cast<size_t>(cinfo.next_scanline) * width * 3];
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    fclose(file);
+    return path;
+}
+
+std::string build_sheet_png(const std::string& dir) {
+    const int width = 4960, height = 7016, module_px = 4, columns = 3, rows = 8;
+    std::string path = (std::filesystem::path(dir) / "sheet_4960x7016.png").string();
+    if (std::filesystem::exists(path)) {
+        return path;
+    }
+    std::filesystem::create_directories(dir);
+
+    std::mt19937 rng(20240603);
+    std::uniform_int_distribution<int> delta(-8, 8);
+    std::vector<unsigned char> rgb(static_cast<size_t>(width) * height * 3);
+    for (unsigned char& byte : rgb) {
+        byte = static_cast<unsigned char>(245 + delta(rng));
+    }
+
+    std::vector<unsigned char> label;
+    int cell_width = width / columns, cell_height = height / rows;
+    for (int row = 0; row < rows; ++row) {
+        for (int column = 0; column < columns; ++column) {
+            std::string code = corpus_code(rng);
+            int label_width = code128_width(code, module_px);
+            int label_height = 50 * module_px;
+            label.resize(static_cast<size_t>(label_width) * label_height);
+            code128_render(code, module_px, label_height, RowFormat::Gray8, label.data(), static_cast<size_t>(label_width));
+            int x0 = column * cell_width + (cell_width - label_width) / 2;
+            int y0 = row * cell_height + (cell_height - label_height) / 2;
+            for (int y = 0; y < label_height; ++y) {
+                for (int x = 0; x < label_width; ++x) {
+                    if (label[static_cast<size_t>(y) * label_width + x] == 0) {
+                        unsigned char* p = &rgb[(static_cast<size_t>(y0 + y) * width + x0 + x) * 3];
+                        p[0] = p[1] = p[2] = static_cast<unsigned char>(20 + delta(rng));
+                    }
+                }
+            }
+        }
+    }
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error("Cannot write " + path);
+    }
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info = png ? png_create_info_struct(png) : nullptr;
+    if (!info || setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        fclose(file);
+        throw std::runtime_error("PNG encoding failed: " + path);
+    }
+    png_init_io(png, file);
+    png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    for (int y = 0; y < height; ++y) {
+        png_write_row(png, &rgb[static_cast<size_t>(y) * width * 3]);
+    }
+    png_write_end(png, nullptr);
+    png_destroy_write_struct(&png, &info);
+    fclose(file);
+    return path;
+}
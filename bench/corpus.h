@@ -0,0 +1,39 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <random>
+#include <string>
+#include <vector>
+
+struct CorpusImage {
+    std::string path;
+    std::string code;
+    int width;
+    int height;
+    float scale;        // zint scale; 1.0 draws 2 px per module
+    int noise;          // amplitude of the uniform noise, in gray levels
+};
+
+// Renders the benchmark corpus into `dir`, which is created if needed: a
+// Code128 label per scale, centred on each canvas size that fits it, with
+// each noise level. Codes and noise come from fixed seeds, so every run
+// writes the same images. Throws std::runtime_error on failure.
+std::vector<CorpusImage> build_corpus(const std::string& dir);
+
+// 12 characters from the generator's alphabet, drawn from `rng`.
+std::string corpus_code(std::mt19937& rng);
+
+// 8-bit grayscale PNG through libpng.
+void write_gray_png(const std::string& path, const unsigned char* pixels, int width, int height);
+
+// A camera-sized (5472x3648, 20 MP) colour JPEG of one Code128 label with
+// 8 px modules on a tinted, noisy background, written to `dir` on the first
+// call and reused after. Returns its path; `code` gets the label's data.
+std::string build_photo_jpeg(const std::string& dir, std::string& code);
+
+// An A4 sheet scanned at 600 dpi (4960x7016 RGB PNG) with a grid of Code128
+// labels, 4 px modules, on slightly noisy paper; written once like the JPEG.
+// Returns its path.
+std::string build_sheet_png(const std::string& dir);
+
+#endif // CORPUS_H
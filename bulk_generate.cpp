@@ -0,0 +1,668 @@
+#include "bulk_generate.h"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "barcode_label.h"
+#include "db_session.h"
+
+namespace fs = std::filesystem;
+
+struct BulkRow {
+    size_t row;
+    std::string name;
+    double price;
+    std::string barcode;
+    int id;
+};
+
+
+// input
+static std::string lower(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return std::tolower(c); });
+    return value;
+}
+
+static std::string trim(const std::string& value) {
+    size_t begin = value.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    return value.substr(begin, value.find_last_not_of(" \t\r\n") - begin + 1);
+}
+
+static bool parse_price(const std::string& text, double& price) {
+    std::string value = trim(text);
+    if (value.empty()) {
+        return false;
+    }
+    char* end;
+    price = std::strtod(value.c_str(), &end);
+    return *end == '\0' && std::isfinite(price) && price >= 0;
+}
+
+// Minimal reader for one flat JSON object per line. Values other than
+// strings and numbers (nested objects, arrays, literals) are skipped.
+class JsonObject {
+public:
+    JsonObject(const std::string& text) : text_(text) {}
+
+    // Top-level members as text: strings unescaped, numbers as written.
+    std::map<std::string, std::string> members() {
+        std::map<std::string, std::string> members;
+        expect('{');
+        if (peek() == '}') {
+            return members;
+        }
+        for (;;) {
+            std::string key = string();
+            expect(':');
+            char c = peek();
+            if (c == '"') {
+                members[key] = string();
+            }
+            else if (c == '-' || std::isdigit(static_cast<unsigned char>(c))) {
+                size_t start = pos_;
+                while (pos_ < text_.size() && std::strchr("+-.eE0123456789", text_[pos_])) {
+                    ++pos_;
+                }
+                members[key] = text_.substr(start, pos_ - start);
+            }
+            else {
+                skip_value();
+            }
+
+            char separator = peek();
+            ++pos_;
+            if (separator == '}') {
+                return members;
+            }
+            if (separator != ',') {
+                fail();
+            }
+        }
+    }
+
+private:
+    char peek() {
+        while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) {
+            ++pos_;
+        }
+        return pos_ < text_.size() ? text_[pos_] : '\0';
+    }
+
+    void expect(char c) {
+        if (peek() != c) {
+            fail();
+        }
+        ++pos_;
+    }
+
+    [[noreturn]] void fail() {
+        throw std::runtime_error("invalid JSON");
+    }
+
+    static void append_utf8(std::string& out, unsigned code) {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        }
+        else if (code < 0x800) {
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+        else if (code < 0x10000) {
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+        else {
+            out += static_cast<char>(0xF0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+
+    unsigned hex4() {
+        if (pos_ + 4 > text_.size()) {
+            fail();
+        }
+        unsigned code = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = text_[pos_++];
+            code <<= 4;
+            if (c >= '0' && c <= '9') code |= c - '0';
+            else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+            else fail();
+        }
+        return code;
+    }
+
+    std::string string() {
+        expect('"');
+        std::string out;
+        while (pos_ < text_.size()) {
+            char c = text_[pos_++];
+            if (c == '"') {
+                return out;
+            }
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos_ >= text_.size()) {
+                break;
+            }
+            switch (text_[pos_++]) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    // a surrogate is only valid as the first half of a
+                    // pair; anything else would not be UTF-8
+                    unsigned code = hex4();
+                    if (code >= 0xDC00 && code < 0xE000) {
+                        fail();
+                    }
+                    if (code >= 0xD800 && code < 0xDC00) {
+                        if (text_.compare(pos_, 2, "\\u") != 0) {
+                            fail();
+                        }
+                        pos_ += 2;
+                        unsigned low = hex4();
+                        if (low < 0xDC00 || low >= 0xE000) {
+                            fail();
+                        }
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    append_utf8(out, code);
+                    break;
+                }
+                default: fail();
+            }
+        }
+        fail();
+    }
+
+    void skip_value() {
+        char c = peek();
+        if (c == '"') {
+            string();
+            return;
+        }
+        if (c == '{' || c == '[') {
+            int depth = 0;
+            while (pos_ < text_.size()) {
+                char d = text_[pos_];
+                if (d == '"') {
+                    string();
+                    continue;
+                }
+                ++pos_;
+                depth += (d == '{' || d == '[') ? 1 : (d == '}' || d == ']') ? -1 : 0;
+                if (depth == 0) {
+                    return;
+                }
+            }
+            fail();
+        }
+        while (pos_ < text_.size() && std::isalnum(static_cast<unsigned char>(text_[pos_]))) {
+            ++pos_;
+        }
+    }
+
+    const std::string& text_;
+    size_t pos_ = 0;
+};
+
+// Reads BulkOptions::input one record at a time.
+class BulkReader {
+public:
+    explicit BulkReader(std::istream& in) : in_(in) {}
+
+    // False at the end of the input. Throws std::runtime_error naming the
+    // line of a record without a name or a valid price.
+    bool next(std::string& name, double& price) {
+        std::vector<std::string> fields;
+        for (;;) {
+            std::string line;
+            if (!std::getline(in_, line)) {
+                return false;
+            }
+            ++line_;
+            if (trim(line).empty()) {
+                continue;
+            }
+
+            std::string price_text;
+            try {
+                if (trim(line)[0] == '{') {
+                    std::map<std::string, std::string> members = JsonObject(line).members();
+                    name = members["name"];
+                    price_text = members["price"];
+                }
+                else {
+                    size_t first_line = line_;
+                    csv_record(line, fields);
+                    if (first_line == 1 && is_header(fields)) {
+                        continue;
+                    }
+                    name = name_column_ < fields.size() ? fields[name_column_] : "";
+                    price_text = price_column_ < fields.size() ? fields[price_column_] : "";
+                }
+            } catch (const std::runtime_error& e) {
+                throw std::runtime_error("line " + std::to_string(line_) + ": " + e.what());
+            }
+
+            name = trim(name);
+            if (name.empty()) {
+                throw std::runtime_error("line " + std::to_string(line_) + ": missing name");
+            }
+            if (!parse_price(price_text, price)) {
+                throw std::runtime_error("line " + std::to_string(line_) + ": invalid price \"" + price_text + "\"");
+            }
+            return true;
+        }
+    }
+
+private:
+    // Splits a CSV record; a quoted field may go on over several lines.
+    void csv_record(std::string line, std::vector<std::string>& fields) {
+        fields.assign(1, "");
+        bool quoted = false;
+        for (size_t i = 0;; ++i) {
+            if (i == line.size()) {
+                if (!quoted) {
+                    break;
+                }
+                std::string more;
+                if (!std::getline(in_, more)) {
+                    throw std::runtime_error("unterminated quoted field");
+                }
+                ++line_;
+                fields.back() += '\n';
+                line = more;
+                i = static_cast<size_t>(-1);
+                continue;
+            }
+            char c = line[i];
+            if (quoted) {
+                if (c == '"' && i + 1 < line.size() && line[i + 1] == '"') {
+                    fields.back() += '"';
+                    ++i;
+                }
+                else if (c == '"') {
+                    quoted = false;
+                }
+                else {
+                    fields.back() += c;
+                }
+            }
+            else if (c == '"') {
+                quoted = true;
+            }
+            else if (c == ',') {
+                fields.emplace_back();
+            }
+            else if (c != '\r') {
+                fields.back() += c;
+            }
+        }
+    }
+
+    // A first row names the columns when it has a known column name and no
+    // price in the second field. Any other first row is data, so a bad
+    // price there is reported like on every other line.
+    bool is_header(const std::vector<std::string>& fields) {
+        double price;
+        if (fields.size() > 1 && parse_price(fields[1], price)) {
+            return false;
+        }
+        size_t name_column = name_column_;
+        size_t price_column = price_column_;
+        bool named = false;
+        for (size_t i = 0; i < fields.size(); ++i) {
+            std::string field = lower(trim(fields[i]));
+            if (field == "name" || field == "product_name") {
+                name_column = i;
+                named = true;
+            }
+            else if (field == "price" || field == "cost") {
+                price_column = i;
+                named = true;
+            }
+        }
+        if (named) {
+            name_column_ = name_column;
+            price_column_ = price_column;
+        }
+        return named;
+    }
+
+    std::istream& in_;
+    size_t line_ = 0;
+    size_t name_column_ = 0;
+    size_t price_column_ = 1;
+};
+
+
+// rendering
+// Threads writing labels, each with its own LabelRenderer.
+// Work is tagged with the batch it belongs to, so the caller can wait for
+// one batch while the next one renders.
+class LabelPool {
+public:
+    LabelPool(const std::string& dir, unsigned jobs) : dir_(dir) {
+        for (unsigned j = 0; j < jobs; ++j) {
+            workers_.emplace_back([this]() { run(); });
+        }
+    }
+
+    ~LabelPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        work_.notify_all();
+        for (std::thread& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    void submit(size_t batch, const std::string& barcode) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.emplace_back(batch, barcode);
+            ++pending_[batch];
+        }
+        work_.notify_one();
+    }
+
+    // Blocks until every label of `batch` is written. Throws
+    // std::runtime_error with the first rendering error.
+    void wait(size_t batch) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [&]() { return !error_.empty() || pending_.find(batch) == pending_.end(); });
+        if (!error_.empty()) {
+            throw std::runtime_error(error_);
+        }
+    }
+
+    std::string path(const std::string& barcode) const {
+        return label_path(barcode, dir_);
+    }
+
+private:
+    void run() {
+        std::unique_ptr<LabelRenderer> renderer;
+        std::string setup_error;
+        try {
+            renderer.reset(new LabelRenderer());
+        } catch (const std::runtime_error& e) {
+            setup_error = e.what();
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            work_.wait(lock, [&]() { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                break;
+            }
+            std::pair<size_t, std::string> job = std::move(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+
+            std::string error = setup_error;
+            if (renderer) {
+                try {
+                    renderer->save(job.second, path(job.second));
+                } catch (const std::runtime_error& e) {
+                    error = e.what();
+                }
+            }
+
+            lock.lock();
+            if (!error.empty() && error_.empty()) {
+                error_ = error;
+            }
+            if (--pending_[job.first] == 0) {
+                pending_.erase(job.first);
+            }
+            done_.notify_all();
+        }
+    }
+
+    std::string dir_;
+    std::mutex mutex_;
+    std::condition_variable work_;
+    std::condition_variable done_;
+    std::deque<std::pair<size_t, std::string>> queue_;
+    std::map<size_t, size_t> pending_;
+    std::string error_;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+};
+
+
+// output
+static void write_row(std::ostream& out, BatchFormat format, const BulkRow& row, const std::string& file) {
+    char price[64];
+    snprintf(price, sizeof(price), "%.2f", row.price);
+    if (format == BatchFormat::Jsonl) {
+        out << "{\"row\":" << row.row
+            << ",\"id\":" << row.id
+            << ",\"barcode\":" << json_string(row.barcode)
+            << ",\"name\":" << json_string(row.name)
+            << ",\"price\":" << price
+            << ",\"file\":" << json_string(file) << "}\n";
+        return;
+    }
+    out << row.row << ',' << row.id << ',' << row.barcode << ',' << csv_field(row.name) << ',' << price << ',' << csv_field(file) << '\n';
+}
+
+
+// database
+class BulkImport {
+public:
+    BulkImport(DbSession& session, const std::string& source) : session_(session), source_(source) {}
+
+    // Rows of the input committed by earlier runs.
+    size_t done() {
+        if (source_.empty()) {
+            return 0;
+        }
+        DbStatement stmt = session_.prepare("SELECT rows FROM bulk_imports WHERE source = ?;");
+        sqlite3_bind_text(stmt, 1, source_.data(), static_cast<int>(source_.size()), SQLITE_STATIC);
+        return stmt.step() == SQLITE_ROW ? static_cast<size_t>(sqlite3_column_int64(stmt, 0)) : 0;
+    }
+
+    // Inserts `rows` and records the input position after them in one
+    // transaction. A code that turns out to be taken (only random codes
+    // from before the allocator, or codes of a block taken over from a
+    // dead process) rolls the batch back; it gets a new code and label and
+    // the batch is tried again.
+    void commit(std::vector<BulkRow>& rows, size_t batch, LabelPool& labels) {
+        for (;;) {
+            std::vector<BulkRow*> taken;
+            step("BEGIN IMMEDIATE;");
+            try {
+                for (BulkRow& row : rows) {
+                    if (!session_.try_add_product(row.barcode, row.name, row.price, row.id)) {
+                        taken.push_back(&row);
+                    }
+                }
+                if (taken.empty()) {
+                    if (!source_.empty()) {
+                        DbStatement stmt = session_.prepare(
+                            "INSERT INTO bulk_imports (source, rows, updated_at) VALUES (?, ?, ?) "
+                            "ON CONFLICT (source) DO UPDATE SET rows = excluded.rows, updated_at = excluded.updated_at;");
+                        sqlite3_bind_text(stmt, 1, source_.data(), static_cast<int>(source_.size()), SQLITE_STATIC);
+                        sqlite3_bind_int64(stmt, 2, static_cast<int64_t>(rows.back().row));
+                        sqlite3_bind_int64(stmt, 3, std::time(nullptr));
+                        if (stmt.step() != SQLITE_DONE) {
+                            throw std::runtime_error("Import progress update failed: " + std::string(sqlite3_errmsg(session_.handle())));
+                        }
+                    }
+                    step("COMMIT;");
+                    return;
+                }
+                step("ROLLBACK;");
+            } catch (const std::runtime_error&) {
+                if (!sqlite3_get_autocommit(session_.handle())) {
+                    session_.prepare("ROLLBACK;").step();
+                }
+                throw;
+            }
+
+            for (BulkRow* row : taken) {
+                row->barcode = session_.generate_unique_barcode();
+                labels.submit(batch, row->barcode);
+            }
+            labels.wait(batch);
+        }
+    }
+
+private:
+    void step(const char* sql) {
+        if (session_.prepare(sql).step() != SQLITE_DONE) {
+            throw std::runtime_error(std::string("Bulk insert failed: ") + sqlite3_errmsg(session_.handle()));
+        }
+    }
+
+    DbSession& session_;
+    std::string source_;
+};
+
+
+int run_bulk_generate(const BulkOptions& options, std::ostream& out, std::ostream& log) {
+    std::ifstream file;
+    std::istream* in = &std::cin;
+    std::string source;
+    if (options.input != "-") {
+        file.open(options.input);
+        if (!file) {
+            log << "Cannot open input: " << options.input << std::endl;
+            return 1;
+        }
+        in = &file;
+        std::error_code ec;
+        source = fs::weakly_canonical(options.input, ec).string();
+        if (ec) {
+            source = fs::absolute(options.input).string();
+        }
+    }
+    else {
+        log << "Reading stdin: an interrupted run cannot be resumed" << std::endl;
+    }
+
+    unsigned jobs = options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    size_t batch_rows = std::max<size_t>(1, options.batch_rows);
+    size_t generated = 0;
+    size_t skipped = 0;
+    auto started = std::chrono::steady_clock::now();
+    int status = 0;
+
+    if (options.format == BatchFormat::Csv) {
+        out << "row,id,barcode,name,price,file\n";
+    }
+
+    try {
+        DbSession session(options.database);
+        BulkImport import(session, source);
+        BulkReader reader(*in);
+
+        std::string name;
+        double price;
+        skipped = import.done();
+        for (size_t row = 0; row < skipped; ++row) {
+            if (!reader.next(name, price)) {
+                throw std::runtime_error("Input has fewer rows than the " + std::to_string(skipped) + " already imported from it");
+            }
+        }
+        if (skipped > 0) {
+            log << "Skipping " << skipped << " rows imported by an earlier run" << std::endl;
+        }
+
+        fs::create_directories(options.output_dir);
+        LabelPool labels(options.output_dir, jobs);
+
+        // Batch N renders while batch N - 1, whose labels are done, is
+        // inserted; a committed product always has its label on disk.
+        std::vector<BulkRow> rendering;
+        std::vector<BulkRow> committing;
+        size_t row = skipped;
+        size_t batch = 0;
+        auto reported = started;
+        bool more = true;
+        while (more || !committing.empty()) {
+            while (more && rendering.size() < batch_rows) {
+                more = reader.next(name, price);
+                if (more) {
+                    rendering.push_back({++row, name, price, session.generate_unique_barcode(), 0});
+                    labels.submit(batch, rendering.back().barcode);
+                }
+            }
+
+            if (!committing.empty()) {
+                labels.wait(batch - 1);
+                import.commit(committing, batch - 1, labels);
+                for (const BulkRow& done : committing) {
+                    write_row(out, options.format, done, labels.path(done.barcode));
+                }
+                out.flush();
+                generated += committing.size();
+                committing.clear();
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if (now - reported >= std::chrono::seconds(1)) {
+                double seconds = std::chrono::duration<double>(now - started).count();
+                char rate[64];
+                snprintf(rate, sizeof(rate), "%.1f", generated / seconds);
+                log << "Generated " << generated << " products (" << rate << " rows/s)" << std::endl;
+                reported = now;
+            }
+
+            committing.swap(rendering);
+            ++batch;
+        }
+    } catch (const std::runtime_error& e) {
+        log << "Error: " << e.what() << std::endl;
+        status = 1;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    char rate[64];
+    snprintf(rate, sizeof(rate), "%.1f", seconds > 0 ? generated / seconds : 0.0);
+    log << "Generated " << generated << " products in " << seconds << " s (" << rate << " rows/s) with "
+        << jobs << " render jobs, " << batch_rows << " rows per transaction" << std::endl;
+    if (status != 0 && !source.empty()) {
+        log << "Run the same command again to continue after row " << skipped + generated << std::endl;
+    }
+    return status;
+}
@@ -0,0 +1,32 @@
+#ifndef BULK_GENERATE_H
+#define BULK_GENERATE_H
+
+#include <iosfwd>
+#include <string>
+
+#include "batch_scan.h"
+
+struct BulkOptions {
+    // Products to create, one per record, read as a stream ("-" for stdin).
+    // A line starting with '{' is a JSON object with "name" and "price";
+    // any other line is CSV. A CSV header row picks the name and price
+    // columns by name; without one they are the first two.
+    std::string input;
+    BatchFormat format = BatchFormat::Jsonl;  // records written to `out`
+    size_t batch_rows = 1000;                 // products per transaction
+    unsigned jobs = 0;                        // label render threads; 0 uses every hardware thread
+    std::string output_dir = "test_barcodes";
+    std::string database = "products.db";
+};
+
+// Creates a product and a PNG label for every input record. Codes come from
+// the session's allocator lease; labels are rendered on a pool of `jobs`
+// threads, each with one LabelRenderer; products are inserted
+// `batch_rows` per transaction, once their labels are written. The same
+// transaction records how many rows of the input are done, so running
+// again on the same file after a crash skips them and goes on. Writes one
+// record per product to `out`, progress and the rows/s rate to `log`.
+// Returns the exit status.
+int run_bulk_generate(const BulkOptions& options, std::ostream& out, std::ostream& log);
+
+#endif // BULK_GENERATE_H
@@ -0,0 +1,160 @@
+#include "code128.h"
+
+#include <cstring>
+
+struct CodeSetBlock {
+    bool set_c;
+    size_t start;
+    size_t length;
+};
+
+// Longest data code128_encode() takes; one block per character at most.
+static const size_t kMaxLength = 128;
+// Values of the longest data, for the stack buffers below.
+static const int kMaxValues = 2 * kMaxLength + 2;
+
+int code128_encode(const char* data, size_t length, uint8_t* values, int capacity) {
+    if (length == 0 || length > kMaxLength) {
+        return 0;
+    }
+
+    // runs of digits and of other characters
+    CodeSetBlock runs[kMaxLength];
+    size_t run_count = 0;
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char c = static_cast<unsigned char>(data[i]);
+        if (c < 32 || c > 127) {
+            return 0;
+        }
+        bool digit = c >= '0' && c <= '9';
+        if (run_count == 0 || runs[run_count - 1].set_c != digit) {
+            runs[run_count++] = {digit, i, 0};
+        }
+        ++runs[run_count - 1].length;
+    }
+
+    // Annex E rules 1 and 3: short digit runs stay in set B
+    CodeSetBlock blocks[kMaxLength + 1];
+    size_t block_count = 0;
+    for (size_t r = 0; r < run_count; ++r) {
+        const CodeSetBlock& run = runs[r];
+        bool set_c = run.set_c && (run.length >= 4 || (run_count == 1 && run.length == 2));
+        if (block_count > 0 && !blocks[block_count - 1].set_c && !set_c) {
+            blocks[block_count - 1].length += run.length;
+        }
+        else {
+            blocks[block_count++] = {set_c, run.start, run.length};
+        }
+    }
+
+    // rules 2 and 3b: set C takes digit pairs only
+    if (block_count > 0 && blocks[0].set_c && blocks[0].length % 2 != 0) {
+        --blocks[0].length;
+        if (block_count == 1) {
+            blocks[block_count++] = {false, blocks[0].start + blocks[0].length + 1, 0};
+        }
+        --blocks[1].start;
+        ++blocks[1].length;
+    }
+    for (size_t b = 1; b < block_count; ++b) {
+        if (blocks[b].set_c && blocks[b].length % 2 != 0) {
+            ++blocks[b - 1].length;
+            ++blocks[b].start;
+            --blocks[b].length;
+        }
+    }
+
+    int count = 0;
+    auto put = [&](int value) {
+        if (count < capacity) {
+            values[count] = static_cast<uint8_t>(value);
+        }
+        ++count;
+    };
+
+    for (size_t b = 0; b < block_count; ++b) {
+        const CodeSetBlock& block = blocks[b];
+        if (b == 0) {
+            put(block.set_c ? kCode128StartC : kCode128StartB);
+        }
+        else {
+            put(block.set_c ? kCode128CodeC : kCode128CodeB);
+        }
+        const char* text = data + block.start;
+        if (block.set_c) {
+            for (size_t i = 0; i < block.length; i += 2) {
+                put((text[i] - '0') * 10 + (text[i + 1] - '0'));
+            }
+        }
+        else {
+            for (size_t i = 0; i < block.length; ++i) {
+                put(static_cast<unsigned char>(text[i]) - 32);
+            }
+        }
+    }
+    if (count >= capacity) {
+        return 0;
+    }
+
+    int check = values[0];
+    for (int i = 1; i < count; ++i) {
+        check += values[i] * i;
+    }
+    values[count++] = static_cast<uint8_t>(check % 103);
+    return count;
+}
+
+void code128_row(const uint8_t* values, int count, int module_px, RowFormat format, unsigned char* row) {
+    int width = code128_modules(count) * module_px;
+    if (format == RowFormat::Gray8) {
+        std::memset(row, 255, static_cast<size_t>(width));
+    }
+    else {
+        std::memset(row, 0, row_bytes(format, width));
+    }
+
+    int x = 0;
+    for (int s = 0; s <= count; ++s) {
+        const char* pattern = kCode128Patterns[s < count ? values[s] : kCode128Stop];
+        for (int e = 0; pattern[e] != '\0'; ++e) {
+            int run = (pattern[e] - '0') * module_px;
+            if (e % 2 == 0) {
+                if (format == RowFormat::Gray8) {
+                    std::memset(row + x, 0, static_cast<size_t>(run));
+                }
+                else {
+                    for (int p = x; p < x + run; ++p) {
+                        row[p >> 3] |= static_cast<unsigned char>(0x80 >> (p & 7));
+                    }
+                }
+            }
+            x += run;
+        }
+    }
+}
+
+int code128_width(const std::string& data, int module_px) {
+    uint8_t values[kMaxValues];
+    int count = code128_encode(data.data(), data.size(), values, kMaxValues);
+    return count > 0 && module_px > 0 ? code128_modules(count) * module_px : 0;
+}
+
+int code128_render(const std::string& data, int module_px, int height, RowFormat format,
+                   unsigned char* pixels, size_t stride) {
+    uint8_t values[kMaxValues];
+    int count = code128_encode(data.data(), data.size(), values, kMaxValues);
+    if (count == 0 || module_px <= 0) {
+        return 0;
+    }
+    int width = code128_modules(count) * module_px;
+    size_t bytes = row_bytes(format, width);
+    if (bytes > stride) {
+        return 0;
+    }
+
+    code128_row(values, count, module_px, format, pixels);
+    for (int y = 1; y < height; ++y) {
+        std::memcpy(pixels + static_cast<size_t>(y) * stride, pixels, bytes);
+    }
+    return width;
+}
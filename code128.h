@@ -0,0 +1,101 @@
+#ifndef CODE128_H
+#define CODE128_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Code128 symbol values used by the encoder (ISO/IEC 15417).
+const int kCode128CodeC = 99;
+const int kCode128CodeB = 100;
+const int kCode128StartB = 104;
+const int kCode128StartC = 105;
+const int kCode128Stop = 106;
+
+// Element widths in modules of every symbol value: bar, space, bar, space,
+// bar, space. The stop pattern has a seventh element, its final bar.
+constexpr char kCode128Patterns[107][8] = {
+    "212222", "222122", "222221", "121223", "121322", "131222", "122213", "122312", "132212", "221213",
+    "221312", "231212", "112232", "122132", "122231", "113222", "123122", "123221", "223211", "221132",
+    "221231", "213212", "223112", "312131", "311222", "321122", "321221", "312212", "322112", "322211",
+    "212123", "212321", "232121", "111323", "131123", "131321", "112313", "132113", "132311", "211313",
+    "231113", "231311", "112133", "112331", "132131", "113123", "113321", "133121", "313121", "211331",
+    "231131", "213113", "213311", "213131", "311123", "311321", "331121", "312113", "312311", "332111",
+    "314111", "221411", "431111", "111224", "111422", "121124", "121421", "141122", "141221", "112214",
+    "112412", "122114", "122411", "142112", "142211", "241211", "221114", "413111", "241112", "134111",
+    "111242", "121142", "121241", "114212", "124112", "124211", "411212", "421112", "421211", "212141",
+    "214121", "412121", "111143", "111341", "131141", "114113", "114311", "411113", "411311", "113141",
+    "114131", "311141", "411131", "211412", "211214", "211232", "2331112",
+};
+
+// Every symbol is 11 modules wide with an even number of bar modules, and
+// the stop pattern 13; checked when this header is compiled.
+constexpr bool code128_patterns_valid() {
+    for (int value = 0; value < 107; ++value) {
+        int elements = value == kCode128Stop ? 7 : 6;
+        int modules = 0;
+        int bars = 0;
+        for (int i = 0; i < 8; ++i) {
+            char c = kCode128Patterns[value][i];
+            if (i == elements) {
+                if (c != '\0') {
+                    return false;
+                }
+                break;
+            }
+            if (c < '1' || c > '4') {
+                return false;
+            }
+            modules += c - '0';
+            bars += i % 2 == 0 ? c - '0' : 0;
+        }
+        if (modules != (value == kCode128Stop ? 13 : 11) || (value != kCode128Stop && bars % 2 != 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(code128_patterns_valid(), "Code128 pattern table is malformed");
+
+// Width in modules of a symbol made of `count` values plus the stop pattern.
+constexpr int code128_modules(int count) {
+    return 11 * count + 13;
+}
+
+// Symbol values for `data`: the start value, the data in code sets B and C,
+// and the check value; the stop pattern is implied. Sets are picked by the
+// rules zint follows (ISO/IEC 15417 Annex E): a run of four or more digits,
+// or data of exactly two digits, goes to set C, and an odd run gives its
+// first digit (or, at the start, its last) to set B. Returns the number of
+// values written, or 0 for empty data, data over 128 characters, a
+// character outside ASCII 32-127 (which needs code set A or FNC4), or
+// values that do not fit in `capacity`.
+int code128_encode(const char* data, size_t length, uint8_t* values, int capacity);
+
+// How code128_row() stores a row of pixels.
+enum class RowFormat {
+    Gray8,  // one byte per pixel: 0 for a bar, 255 for a space
+    Bit1,   // 8 pixels per byte, first pixel in the high bit, 1 for a bar (as PBM)
+};
+
+// Bytes taken by a row of `width` pixels in `format`.
+constexpr size_t row_bytes(RowFormat format, int width) {
+    return format == RowFormat::Gray8 ? static_cast<size_t>(width) : (static_cast<size_t>(width) + 7) / 8;
+}
+
+// Draws `count` values and the stop pattern into `row`, `module_px` pixels
+// per module: code128_modules(count) * module_px pixels in all.
+void code128_row(const uint8_t* values, int count, int module_px, RowFormat format, unsigned char* row);
+
+// Encodes `data` and draws it as `height` identical rows, `stride` bytes
+// apart, into `pixels`, which must hold them. Returns the width in pixels,
+// or 0 when code128_encode() cannot encode `data` or the row does not fit
+// in `stride`.
+int code128_render(const std::string& data, int module_px, int height, RowFormat format,
+                   unsigned char* pixels, size_t stride);
+
+// Width in pixels code128_render() draws `data` at, or 0 as above.
+int code128_width(const std::string& data, int module_px);
+
+#endif // CODE128_H
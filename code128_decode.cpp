@@ -0,0 +1,363 @@
+#include "code128_decode.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "code128.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CODE128_DECODE_X86 1
+#include <immintrin.h>
+#endif
+
+// Rows whose gray range is narrower than this hold no bars worth reading.
+static const int kMinContrast = 64;
+// Light space the start and stop patterns need on their outer side, in
+// modules, unless it runs to the edge of the image. The standard asks for 10;
+// the check value already rules out stray matches.
+static const int kMinQuietModules = 5;
+// Start, 128 characters with a code set switch before each, check value.
+static const int kMaxValues = 2 * 128 + 2;
+
+// Symbol value of every 6-element pattern, indexed by its widths minus one,
+// two bits per element, or -1. The stop pattern is found by its first six.
+struct PatternTable {
+    signed char values[1 << 12];
+};
+
+static constexpr int pattern_key(const char* pattern) {
+    int key = 0;
+    for (int e = 0; e < 6; ++e) {
+        key |= (pattern[e] - '1') << (2 * e);
+    }
+    return key;
+}
+
+static constexpr PatternTable make_pattern_table() {
+    PatternTable table{};
+    for (int key = 0; key < (1 << 12); ++key) {
+        table.values[key] = -1;
+    }
+    for (int value = 0; value <= kCode128Stop; ++value) {
+        table.values[pattern_key(kCode128Patterns[value])] = static_cast<signed char>(value);
+    }
+    return table;
+}
+
+static constexpr PatternTable kPatternTable = make_pattern_table();
+
+static constexpr bool pattern_keys_unique() {
+    for (int value = 0; value <= kCode128Stop; ++value) {
+        if (kPatternTable.values[pattern_key(kCode128Patterns[value])] != value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(pattern_keys_unique(), "Code128 patterns share their first six elements");
+
+
+// Row kernels: the gray range of a row, and the positions where it turns
+// from light to dark or back (a pixel is dark below `threshold`). Pixels
+// outside the row count as light, so the first edge always starts a bar and
+// a bar that reaches the right end of the row closes at `width`.
+typedef void (*range_kernel)(const unsigned char* row, int width, int* low, int* high);
+typedef int (*edge_kernel)(const unsigned char* row, int width, int threshold, int* edges);
+
+static void range_scalar(const unsigned char* row, int width, int* low, int* high) {
+    int lo = 255, hi = 0;
+    for (int x = 0; x < width; ++x) {
+        lo = std::min(lo, static_cast<int>(row[x]));
+        hi = std::max(hi, static_cast<int>(row[x]));
+    }
+    *low = lo;
+    *high = hi;
+}
+
+// Edges of row[from, width) when the pixel before `from` was `dark`.
+static int edges_scalar_from(const unsigned char* row, int from, int width, int threshold, bool dark, int* edges, int count) {
+    for (int x = from; x < width; ++x) {
+        bool d = row[x] < threshold;
+        if (d != dark) {
+            edges[count++] = x;
+            dark = d;
+        }
+    }
+    if (dark) {
+        edges[count++] = width;
+    }
+    return count;
+}
+
+static int edges_scalar(const unsigned char* row, int width, int threshold, int* edges) {
+    return edges_scalar_from(row, 0, width, threshold, false, edges, 0);
+}
+
+#ifdef CODE128_DECODE_X86
+
+// Appends the set bits of `transitions` as positions from `base` on.
+static inline int push_edges(uint32_t transitions, int base, int* edges, int count) {
+    while (transitions != 0) {
+        edges[count++] = base + __builtin_ctz(transitions);
+        transitions &= transitions - 1;
+    }
+    return count;
+}
+
+static void range_sse2(const unsigned char* row, int width, int* low, int* high) {
+    __m128i lo = _mm_set1_epi8(static_cast<char>(0xFF));
+    __m128i hi = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+        lo = _mm_min_epu8(lo, v);
+        hi = _mm_max_epu8(hi, v);
+    }
+    unsigned char lanes[32];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 16), hi);
+    range_scalar(row + x, width - x, low, high);
+    for (int i = 0; i < 16; ++i) {
+        *low = std::min(*low, static_cast<int>(lanes[i]));
+        *high = std::max(*high, static_cast<int>(lanes[16 + i]));
+    }
+}
+
+// 16 pixels per step: a compare gives the dark mask, and a mask XORed with
+// itself shifted by one pixel has a bit set at every edge.
+static int edges_sse2(const unsigned char* row, int width, int threshold, int* edges) {
+    const __m128i limit = _mm_set1_epi8(static_cast<char>(threshold - 1));
+    uint32_t carry = 0;
+    int count = 0;
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+        uint32_t dark = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, limit), v)));
+        count = push_edges((dark ^ ((dark << 1) | carry)) & 0xFFFF, x, edges, count);
+        carry = dark >> 15;
+    }
+    return edges_scalar_from(row, x, width, threshold, carry != 0, edges, count);
+}
+
+#define CODE128_AVX2 __attribute__((target("avx2")))
+
+CODE128_AVX2 static void range_avx2(const unsigned char* row, int width, int* low, int* high) {
+    __m256i lo = _mm256_set1_epi8(static_cast<char>(0xFF));
+    __m256i hi = _mm256_setzero_si256();
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x));
+        lo = _mm256_min_epu8(lo, v);
+        hi = _mm256_max_epu8(hi, v);
+    }
+    unsigned char lanes[64];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), lo);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes + 32), hi);
+    range_sse2(row + x, width - x, low, high);
+    for (int i = 0; i < 32; ++i) {
+        *low = std::min(*low, static_cast<int>(lanes[i]));
+        *high = std::max(*high, static_cast<int>(lanes[32 + i]));
+    }
+}
+
+CODE128_AVX2 static int edges_avx2(const unsigned char* row, int width, int threshold, int* edges) {
+    const __m256i limit = _mm256_set1_epi8(static_cast<char>(threshold - 1));
+    uint32_t carry = 0;
+    int count = 0;
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x));
+        uint32_t dark = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(v, limit), v)));
+        count = push_edges(dark ^ ((dark << 1) | carry), x, edges, count);
+        carry = dark >> 31;
+    }
+    return edges_scalar_from(row, x, width, threshold, carry != 0, edges, count);
+}
+
+#endif // CODE128_DECODE_X86
+
+
+struct RowKernels {
+    const char* name;
+    range_kernel range;
+    edge_kernel edges;
+};
+
+static const RowKernels& row_kernels() {
+    static const RowKernels kernels = []() {
+#ifdef CODE128_DECODE_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return RowKernels{"avx2", range_avx2, edges_avx2};
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return RowKernels{"sse2", range_sse2, edges_sse2};
+        }
+#endif
+        return RowKernels{"scalar", range_scalar, edges_scalar};
+    }();
+    return kernels;
+}
+
+
+// Value of the six elements from edge `j` on, or -1; `span` gets their width.
+static int match_symbol(const int* edges, int j, int* span) {
+    int total = edges[j + 6] - edges[j];
+    int key = 0;
+    for (int e = 0; e < 6; ++e) {
+        int width = edges[j + e + 1] - edges[j + e];
+        int modules = (22 * width + total) / (2 * total);  // 11 * width / total, rounded
+        if (modules < 1 || modules > 4) {
+            return -1;
+        }
+        key |= (modules - 1) << (2 * e);
+    }
+    *span = total;
+    return kPatternTable.values[key];
+}
+
+// Checks the check value and turns values in code sets B and C into text.
+static bool values_text(const uint8_t* values, int count, std::string& data) {
+    if (count < 3) {
+        return false;
+    }
+    int check = values[0];
+    for (int i = 1; i < count - 1; ++i) {
+        check += values[i] * i;
+    }
+    if (check % 103 != values[count - 1]) {
+        return false;
+    }
+
+    data.clear();
+    bool set_c = values[0] == kCode128StartC;
+    for (int i = 1; i < count - 1; ++i) {
+        int value = values[i];
+        if (set_c && value < 100) {
+            data += static_cast<char>('0' + value / 10);
+            data += static_cast<char>('0' + value % 10);
+        }
+        else if (!set_c && value < 96) {
+            data += static_cast<char>(value + 32);
+        }
+        else if (value == (set_c ? kCode128CodeB : kCode128CodeC)) {
+            set_c = !set_c;
+        }
+        else {
+            // code set A, shift and the FNC characters are left to zbar
+            return false;
+        }
+    }
+    return !data.empty();
+}
+
+// First symbol among `count` edges of a row `width` pixels wide.
+static bool read_edges(const int* edges, int count, int width, std::string& data, int* left, int* right) {
+    uint8_t values[kMaxValues];
+    for (int j = 0; j + 6 < count; j += 2) {
+        int span;
+        int start = match_symbol(edges, j, &span);
+        if (start != kCode128StartB && start != kCode128StartC) {
+            continue;
+        }
+        if (j > 0 && (edges[j] - edges[j - 1]) * 11 < kMinQuietModules * span) {
+            continue;
+        }
+
+        int count_values = 0;
+        values[count_values++] = static_cast<uint8_t>(start);
+        int k = j + 6;
+        bool stopped = false;
+        while (k + 6 < count && count_values < kMaxValues) {
+            int symbol_span;
+            int value = match_symbol(edges, k, &symbol_span);
+            // every symbol is as wide as the start pattern, give or take a quarter
+            if (value < 0 || 4 * std::abs(symbol_span - span) > span) {
+                break;
+            }
+            if (value == kCode128Stop) {
+                stopped = true;
+                break;
+            }
+            values[count_values++] = static_cast<uint8_t>(value);
+            k += 6;
+        }
+        if (!stopped || k + 7 >= count) {
+            continue;
+        }
+
+        // the stop pattern's last bar, two modules wide, then a quiet zone
+        int symbol_span = edges[k + 6] - edges[k];
+        int bar = edges[k + 7] - edges[k + 6];
+        if ((22 * bar + symbol_span) / (2 * symbol_span) != 2) {
+            continue;
+        }
+        int end = edges[k + 7];
+        int quiet = (k + 8 < count ? edges[k + 8] : width) - end;
+        if (k + 8 < count && quiet * 11 < kMinQuietModules * symbol_span) {
+            continue;
+        }
+        if (!values_text(values, count_values, data)) {
+            continue;
+        }
+        *left = edges[j];
+        *right = end;
+        return true;
+    }
+    return false;
+}
+
+bool code128_decode(const unsigned char* gray, int width, int height, Code128Read& read) {
+    if (width < code128_modules(2) || height < 1) {
+        return false;
+    }
+
+    // Grow-only per thread, like the gray frame of the ScanContext calling this.
+    thread_local std::vector<int> edges;
+    thread_local std::string confirm;
+    if (edges.size() < static_cast<size_t>(width) + 1) {
+        edges.resize(static_cast<size_t>(width) + 1);
+    }
+    const RowKernels& kernels = row_kernels();
+
+    auto read_row = [&](int y, std::string& data, int* left, int* right) {
+        const unsigned char* row = gray + static_cast<size_t>(y) * width;
+        int low, high;
+        kernels.range(row, width, &low, &high);
+        if (high - low < kMinContrast) {
+            return false;
+        }
+        int count = kernels.edges(row, width, (low + high + 1) / 2, edges.data());
+        return read_edges(edges.data(), count, width, data, left, right);
+    };
+
+    // The middle row, then 1/8, 1/4 and 3/8 of the height above and below it.
+    // A read is confirmed on a row a little further down (or up, at the bottom).
+    static const int kOffsets[] = {0, 2, -2, 4, -4, 6, -6};
+    int step = height / 16;
+    int gap = std::max(1, height / 64);
+    for (int offset : kOffsets) {
+        int y = height / 2 + offset * step;
+        if (!read_row(y, read.data, &read.left, &read.right)) {
+            continue;
+        }
+        int other = y + gap < height ? y + gap : y - gap;
+        int left, right;
+        if (other >= 0 && read_row(other, confirm, &left, &right) && confirm == read.data) {
+            read.left = std::min(read.left, left);
+            read.right = std::max(read.right, right);
+            read.top = std::min(y, other);
+            read.bottom = std::max(y, other);
+            read.rows = 2;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* code128_decode_backend() {
+    return row_kernels().name;
+}
@@ -0,0 +1,30 @@
+#ifndef CODE128_DECODE_H
+#define CODE128_DECODE_H
+
+#include <string>
+
+// A symbol found by code128_decode(), in image pixels.
+struct Code128Read {
+    std::string data;
+    int left;       // first pixel of the start pattern
+    int right;      // one past the last bar of the stop pattern
+    int top;        // first and last of the rows that agreed on it
+    int bottom;
+    int rows;       // sampled rows that read it
+};
+
+// Fast path for the labels generate() draws: one horizontal Code128 symbol in
+// code sets B and C, bars dark on light. Samples a few rows from the middle of
+// the image outwards, run-length encodes each one against the midpoint of its
+// gray range, and rounds every 6 element widths to modules to look them up in
+// kCode128Patterns. A row reads a symbol only with a start B/C pattern, a
+// valid check value and the stop pattern. Returns true once two rows read the
+// same data; false means the caller should hand the image to zbar (rotated,
+// blurred or low-contrast labels, code set A, FNC characters, other
+// symbologies). Only the first symbol on a row is read.
+bool code128_decode(const unsigned char* gray, int width, int height, Code128Read& read);
+
+// Name of the run-length kernel picked by runtime CPU dispatch ("avx2", "sse2" or "scalar").
+const char* code128_decode_backend();
+
+#endif // CODE128_DECODE_H
@@ -1 +1 @@
-g++ -std=c++17 ../main.cpp -o ../barcode_main -lzbar -lsqlite3 -lzint -lpng
+g++ -std=c++17 -O2 -pthread ../main.cpp ../barcode_catalog.cpp ../barcode_label.cpp ../barcode_lease.cpp ../batch_scan.cpp ../bulk_generate.cpp ../code128.cpp ../code128_decode.cpp ../db_profile.cpp ../db_session.cpp ../decode_cache.cpp ../gray_convert.cpp ../jpeg_gray.cpp ../metrics.cpp ../png_gray.cpp ../product_filter.cpp ../product_lookup.cpp ../scan_client.cpp ../scan_context.cpp ../scan_profile.cpp ../scan_protocol.cpp ../schema_migrations.cpp -o ../barcode_main -lzbar -ljpeg -lsqlite3 -lzint -lpng
@@ -0,0 +1 @@
+g++ -std=c++17 -O2 -pthread ../barcode_scand.cpp ../barcode_catalog.cpp ../code128_decode.cpp ../db_profile.cpp ../decode_cache.cpp ../gray_convert.cpp ../jpeg_gray.cpp ../metrics.cpp ../png_gray.cpp ../product_filter.cpp ../scan_context.cpp ../scan_profile.cpp ../scan_protocol.cpp ../schema_migrations.cpp -o ../barcode_scand -lzbar -ljpeg -lpng -lsqlite3
@@ -0,0 +1,203 @@
+#include "db_profile.h"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include "metrics.h"
+#include "schema_migrations.h"
+
+const std::vector<DbProfile>& db_profiles() {
+    static const std::vector<DbProfile> profiles = {
+        // Scanning only reads. query_only backs up the read-only open, and the
+        // whole catalog is mapped so lookups skip read() and the page cache
+        // copy. immutable=1 would also skip locking, but the generator may be
+        // writing the same file, so it is not used.
+        {"scanner-readonly", true, 1000,
+         "PRAGMA query_only = 1;"
+         "PRAGMA mmap_size = 268435456;"
+         "PRAGMA cache_size = -16384;"
+         "PRAGMA temp_store = MEMORY;",
+         false},
+        // Interactive generation next to running scanners: WAL lets readers
+        // go on during a write, synchronous=NORMAL syncs at checkpoints
+        // instead of on every commit (a crash may lose the last commits but
+        // never corrupts), and checkpoints move off the committing thread.
+        // page_size only takes effect when the file is created.
+        {"writer", false, 5000,
+         "PRAGMA page_size = 4096;"
+         "PRAGMA journal_mode = WAL;"
+         "PRAGMA synchronous = NORMAL;"
+         "PRAGMA journal_size_limit = 67108864;"
+         "PRAGMA cache_size = -32768;"
+         "PRAGMA mmap_size = 268435456;"
+         "PRAGMA temp_store = MEMORY;",
+         true},
+        // One-off imports into a file nobody else has open. No journal and no
+        // syncs: a crash or a failed ROLLBACK can leave the file corrupt, so
+        // only use it on a copy or a file that can be rebuilt.
+        {"bulk-load", false, 5000,
+         "PRAGMA locking_mode = EXCLUSIVE;"
+         "PRAGMA journal_mode = OFF;"
+         "PRAGMA synchronous = OFF;"
+         "PRAGMA cache_size = -262144;"
+         "PRAGMA temp_store = MEMORY;",
+         false},
+    };
+    return profiles;
+}
+
+const DbProfile* find_db_profile(const std::string& name) {
+    for (const DbProfile& profile : db_profiles()) {
+        if (profile.name == name) {
+            return &profile;
+        }
+    }
+    return nullptr;
+}
+
+static const DbProfile* default_profile = nullptr;
+
+const DbProfile& default_db_profile() {
+    return default_profile ? *default_profile : *find_db_profile("writer");
+}
+
+void set_default_db_profile(const DbProfile& profile) {
+    default_profile = &profile;
+}
+
+std::string db_profile_names() {
+    std::string names;
+    for (const DbProfile& profile : db_profiles()) {
+        if (!names.empty()) {
+            names += ", ";
+        }
+        names += profile.name;
+    }
+    return names;
+}
+
+// A read-only connection cannot migrate, and would otherwise read a schema
+// it was not written for: an older one is brought up to date once through a
+// short-lived plain connection, a newer one is refused. That connection runs
+// no profile PRAGMAs, so the file keeps its journal mode.
+static void check_schema_version(sqlite3* db, const std::string& path) {
+    int version = schema_version(db);
+    if (version > kSchemaVersion) {
+        throw std::runtime_error("Database schema version " + std::to_string(version) +
+                                 " is newer than this program supports (" + std::to_string(kSchemaVersion) + ")");
+    }
+    if (version == kSchemaVersion) {
+        return;
+    }
+
+    sqlite3* writer = nullptr;
+    try {
+        if (sqlite3_open_v2(path.c_str(), &writer, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+            throw std::runtime_error(sqlite3_errmsg(writer));
+        }
+        sqlite3_busy_timeout(writer, 5000);
+        migrate_schema(writer);
+    } catch (const std::runtime_error& e) {
+        sqlite3_close(writer);
+        throw std::runtime_error("Database schema version " + std::to_string(version) + " is older than " +
+                                 std::to_string(kSchemaVersion) + " and could not be upgraded (" + e.what() +
+                                 "); run barcode_main once to upgrade it");
+    }
+    sqlite3_close(writer);
+}
+
+sqlite3* open_database(const std::string& path, const DbProfile& profile) {
+    StageTimer timer(Stage::DbOpen);
+    int flags = (profile.read_only ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) | SQLITE_OPEN_NOMUTEX;
+
+    sqlite3* db;
+    if (sqlite3_open_v2(path.c_str(), &db, flags, nullptr) != SQLITE_OK) {
+        std::string error = "Error opening database: " + std::string(sqlite3_errmsg(db));
+        sqlite3_close(db);
+        throw std::runtime_error(error);
+    }
+
+    sqlite3_busy_timeout(db, profile.busy_timeout_ms);
+    char* errMsg = nullptr;
+    if (sqlite3_exec(db, profile.pragmas.c_str(), nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        std::string error = "Database profile " + profile.name + " failed: " + (errMsg ? errMsg : sqlite3_errmsg(db));
+        sqlite3_free(errMsg);
+        sqlite3_close(db);
+        throw std::runtime_error(error);
+    }
+
+    if (profile.read_only) {
+        try {
+            check_schema_version(db, path);
+        } catch (const std::runtime_error&) {
+            sqlite3_close(db);
+            throw;
+        }
+    }
+    return db;
+}
+
+
+WalCheckpointer::WalCheckpointer(sqlite3* db, const std::string& path) : db_(db) {
+    if (sqlite3_open_v2(path.c_str(), &checkpoint_db_, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+        std::string error = "Error opening database: " + std::string(sqlite3_errmsg(checkpoint_db_));
+        sqlite3_close(checkpoint_db_);
+        throw std::runtime_error(error);
+    }
+    sqlite3_busy_timeout(checkpoint_db_, 5000);
+    // A connection only notices WAL mode once it has read the file; until then
+    // checkpoints on it are silent no-ops.
+    sqlite3_exec(checkpoint_db_, "SELECT 1 FROM sqlite_master LIMIT 1;", nullptr, nullptr, nullptr);
+    // Installing a WAL hook turns SQLite's own auto-checkpoint off.
+    sqlite3_wal_hook(db_, on_commit, this);
+    thread_ = std::thread(&WalCheckpointer::run, this);
+}
+
+WalCheckpointer::~WalCheckpointer() {
+    sqlite3_wal_hook(db_, nullptr, nullptr);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+    sqlite3_close(checkpoint_db_);
+}
+
+int WalCheckpointer::on_commit(void* self, sqlite3*, const char*, int pages) {
+    WalCheckpointer* checkpointer = static_cast<WalCheckpointer*>(self);
+    std::lock_guard<std::mutex> lock(checkpointer->mutex_);
+    checkpointer->pages_ = pages;
+    if (pages >= kCheckpointPages) {
+        checkpointer->wake_.notify_one();
+    }
+    return SQLITE_OK;
+}
+
+void WalCheckpointer::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        wake_.wait_for(lock, std::chrono::seconds(1), [this] { return stopping_ || pages_ >= kCheckpointPages; });
+        if (stopping_ || pages_ == 0) {
+            continue;
+        }
+        // PASSIVE never waits for readers or the writer, but the log is only
+        // rewound once a checkpoint catches up with it between two commits,
+        // which a steady stream of commits never allows. Past kRestartPages
+        // RESTART holds new writers back (their busy timeout) until it has.
+        int mode = pages_ >= kRestartPages ? SQLITE_CHECKPOINT_RESTART : SQLITE_CHECKPOINT_PASSIVE;
+        pages_ = 0;
+        lock.unlock();
+
+        int logged = 0, copied = 0;
+        int rc = sqlite3_wal_checkpoint_v2(checkpoint_db_, nullptr, mode, &logged, &copied);
+
+        lock.lock();
+        if (rc != SQLITE_OK || copied < logged) {
+            pages_ = std::max(pages_, 1);
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef DB_PROFILE_H
+#define DB_PROFILE_H
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct sqlite3;
+
+// Named connection setup for the products database: how it is opened and the
+// PRAGMAs run right after. Picked per process (--db-profile) so a scanner, an
+// interactive generator and a bulk import each get the trade-off they need.
+struct DbProfile {
+    std::string name;
+    bool read_only;
+    int busy_timeout_ms;          // 0 fails at once with SQLITE_BUSY
+    std::string pragmas;
+    bool background_checkpoint;   // WAL checkpoints run on a WalCheckpointer thread
+};
+
+// scanner-readonly, writer, bulk-load
+const std::vector<DbProfile>& db_profiles();
+
+const DbProfile* find_db_profile(const std::string& name);
+
+// Profile DbSession::for_this_thread() opens with; writer unless changed.
+const DbProfile& default_db_profile();
+void set_default_db_profile(const DbProfile& profile);
+
+// "scanner-readonly, writer, ..." for usage and error messages.
+std::string db_profile_names();
+
+// Opens `path` with the flags, busy timeout and PRAGMAs of `profile`. The
+// connection is NOMUTEX: use it from one thread at a time. A read-only
+// profile also checks the schema version: an older database is migrated
+// first through a plain read-write connection, a newer one is refused. Throws
+// std::runtime_error.
+sqlite3* open_database(const std::string& path, const DbProfile& profile);
+
+// Checkpoints the WAL of `db` on its own thread and connection, so commits on
+// `db` do not pay for a checkpoint. Replaces SQLite's auto-checkpoint: the WAL
+// hook wakes the thread once kCheckpointPages pages are in the log, and it
+// also runs once a second while anything is left. A log that still reaches
+// kRestartPages is rewound with a RESTART checkpoint, which makes the next
+// commit wait for it, so the file stays bounded under a constant stream of
+// writes.
+class WalCheckpointer {
+public:
+    static const int kCheckpointPages = 1000;
+    static const int kRestartPages = 10000;
+
+    WalCheckpointer(sqlite3* db, const std::string& path);
+    ~WalCheckpointer();
+    WalCheckpointer(const WalCheckpointer&) = delete;
+    WalCheckpointer& operator=(const WalCheckpointer&) = delete;
+
+private:
+    static int on_commit(void* self, sqlite3* db, const char* schema, int pages);
+    void run();
+
+    sqlite3* db_;
+    sqlite3* checkpoint_db_ = nullptr;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    int pages_ = 0;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+#endif // DB_PROFILE_H
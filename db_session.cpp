@@ -0,0 +1,202 @@
+#include "db_session.h"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "barcode_catalog.h"
+#include "barcode_key.h"
+#include "metrics.h"
+#include "product_filter.h"
+#include "schema_migrations.h"
+
+DbStatement::~DbStatement() {
+    sqlite3_reset(stmt_);
+    sqlite3_clear_bindings(stmt_);
+}
+
+int DbStatement::step() {
+    return timed(Stage::DbStep, [&] { return sqlite3_step(stmt_); });
+}
+
+
+DbSession::DbSession(const std::string& path, const DbProfile& profile) : db_(open_database(path, profile)), path_(path) {
+    try {
+        if (!profile.read_only) {
+            migrate_schema(db_);
+        }
+        layout_ = catalog_layout(db_);
+        if (profile.background_checkpoint) {
+            checkpointer_.reset(new WalCheckpointer(db_, path));
+        }
+    } catch (const std::runtime_error&) {
+        sqlite3_close(db_);
+        throw;
+    }
+}
+
+DbSession::~DbSession() {
+    filter_.reset();
+    lease_.reset();
+    checkpointer_.reset();
+    for (const auto& entry : statements_) {
+        sqlite3_finalize(entry.second);
+    }
+    sqlite3_close(db_);
+}
+
+DbSession& DbSession::for_this_thread() {
+    static thread_local DbSession session;
+    return session;
+}
+
+DbStatement DbSession::prepare(const std::string& sql) {
+    auto it = statements_.find(sql);
+    if (it != statements_.end()) {
+        return DbStatement(it->second);
+    }
+
+    sqlite3_stmt* stmt;
+    if (timed(Stage::DbPrepare, [&] { return sqlite3_prepare_v3(db_, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr); }) != SQLITE_OK) {
+        throw std::runtime_error("SQL error: " + std::string(sqlite3_errmsg(db_)));
+    }
+    statements_.emplace(sql, stmt);
+    return DbStatement(stmt);
+}
+
+
+bool DbSession::barcode_exists(const std::string& barcode) {
+    int64_t key = 0;
+    if (layout_ == CatalogLayout::Compact && !pack_barcode(barcode, key)) {
+        return false;
+    }
+    DbStatement stmt = prepare(layout_ == CatalogLayout::Compact
+        ? "SELECT 1 FROM products WHERE code = ?;"
+        : "SELECT 1 FROM products WHERE barcode = ?;");
+    if (layout_ == CatalogLayout::Compact) {
+        sqlite3_bind_int64(stmt, 1, key);
+    }
+    else {
+        sqlite3_bind_text(stmt, 1, barcode.data(), static_cast<int>(barcode.size()), SQLITE_STATIC);
+    }
+
+    int rc = stmt.step();
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+        throw std::runtime_error("Barcode check failed: " + std::string(sqlite3_errmsg(db_)));
+    }
+    return rc == SQLITE_ROW;
+}
+
+std::string DbSession::next_barcode(bool& verify) {
+    if (!permutation_) {
+        DbStatement stmt = prepare("SELECT permutation_key FROM barcode_allocator WHERE id = 0;");
+        if (stmt.step() != SQLITE_ROW) {
+            throw std::runtime_error("Barcode allocator not found: " + std::string(sqlite3_errmsg(db_)));
+        }
+        permutation_.reset(new BarcodePermutation(static_cast<uint64_t>(sqlite3_column_int64(stmt, 0))));
+        lease_.reset(new BarcodeLease(*this));
+    }
+    return barcode_at(*permutation_, lease_->next(verify));
+}
+
+std::string DbSession::generate_unique_barcode() {
+    for (;;) {
+        bool verify;
+        std::string barcode = next_barcode(verify);
+        if (!verify || !barcode_exists(barcode)) {
+            return barcode;
+        }
+    }
+}
+
+int DbSession::add_product(const std::string& barcode, const std::string& name, double price) {
+    int id;
+    if (!try_add_product(barcode, name, price, id)) {
+        throw std::runtime_error("Insert failed: barcode " + barcode + " is already in the catalog");
+    }
+    return id;
+}
+
+int DbSession::create_product(const std::string& name, double price, std::string& barcode) {
+    // Only codes of a block taken over from a dead process, or random codes
+    // from before the allocator, can be taken; a run this long means the
+    // catalog and the allocator disagree.
+    const int kMaxAttempts = 1000;
+    for (int attempt = 0; attempt < kMaxAttempts; ++attempt) {
+        bool verify;
+        barcode = next_barcode(verify);
+        int id;
+        if (try_add_product(barcode, name, price, id)) {
+            return id;
+        }
+    }
+    throw std::runtime_error("Insert failed: no free barcode after " + std::to_string(kMaxAttempts) + " attempts");
+}
+
+// A single INSERT runs in its own write transaction, so the conflict check,
+// the new id and the row are one atomic step; RETURNING gives back the id
+// without another statement, and nothing when the code is taken.
+bool DbSession::try_add_product(const std::string& barcode, const std::string& name, double price, int& id) {
+    int64_t key = 0;
+    if (layout_ == CatalogLayout::Compact && !pack_barcode(barcode, key)) {
+        throw std::runtime_error("Barcode " + barcode + " does not fit the compact catalog");
+    }
+
+    // Compact ids come from the products_sequence high-water mark in the same
+    // statement (a trigger raises it), so two writers cannot both take one
+    // and the id of a deleted product is not taken again. WITHOUT ROWID
+    // tables leave sqlite3_last_insert_rowid() alone, RETURNING works for both.
+    DbStatement stmt = prepare(layout_ == CatalogLayout::Compact
+        ? "INSERT INTO products (code, id, product_name, price_cents) "
+          "SELECT ?, seq + 1, ?, ? FROM products_sequence WHERE true "
+          "ON CONFLICT (code) DO NOTHING RETURNING id;"
+        : "INSERT INTO products (barcode, product_name, price_cents) VALUES (?, ?, ?) "
+          "ON CONFLICT (barcode) DO NOTHING RETURNING id;");
+    if (layout_ == CatalogLayout::Compact) {
+        sqlite3_bind_int64(stmt, 1, key);
+    }
+    else {
+        sqlite3_bind_text(stmt, 1, barcode.data(), static_cast<int>(barcode.size()), SQLITE_STATIC);
+    }
+    sqlite3_bind_text(stmt, 2, name.data(), static_cast<int>(name.size()), SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, std::llround(price * 100));
+
+    int rc = stmt.step();
+    if (rc == SQLITE_ROW) {
+        id = sqlite3_column_int(stmt, 0);
+        rc = stmt.step();
+        if (rc == SQLITE_DONE) {
+            if (filter_) {
+                filter_->add(barcode);
+            }
+            return true;
+        }
+    }
+    if (rc != SQLITE_DONE) {
+        throw std::runtime_error("Insert failed: " + std::string(sqlite3_errmsg(db_)));
+    }
+    return false;
+}
+
+std::unordered_map<std::string, Product> DbSession::lookup(const std::vector<std::string>& codes) {
+    std::unordered_map<std::string, Product> found;
+    std::vector<std::string> barcodes = unique_barcodes(codes);
+    ProductFilter::Snapshot snapshot(filter());
+    filter_->remove_absent(barcodes);
+
+    for (size_t start = 0; start < barcodes.size(); start += kLookupChunk) {
+        size_t count = std::min(kLookupChunk, barcodes.size() - start);
+        DbStatement stmt = prepare(lookup_products_sql(layout_, count));
+        collect_products(stmt, layout_, &barcodes[start], count, found);
+    }
+    return found;
+}
+
+ProductFilter& DbSession::filter() {
+    if (!filter_) {
+        filter_.reset(new ProductFilter(db_, layout_, product_filter_path(path_)));
+    }
+    return *filter_;
+}
@@ -0,0 +1,109 @@
+#ifndef DB_SESSION_H
+#define DB_SESSION_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "barcode_catalog.h"
+#include "barcode_lease.h"
+#include "db_profile.h"
+#include "product_lookup.h"
+
+struct sqlite3;
+struct sqlite3_stmt;
+class ProductFilter;
+
+// Cached statement in use. Resets it and clears its bindings when it goes
+// out of scope, so a half-stepped SELECT never keeps a read lock open.
+class DbStatement {
+public:
+    explicit DbStatement(sqlite3_stmt* stmt) : stmt_(stmt) {}
+    ~DbStatement();
+    DbStatement(const DbStatement&) = delete;
+    DbStatement& operator=(const DbStatement&) = delete;
+
+    operator sqlite3_stmt*() const { return stmt_; }
+
+    // sqlite3_step(), timed as Stage::DbStep.
+    int step();
+
+private:
+    sqlite3_stmt* stmt_;
+};
+
+// One open connection to the products database, set up by a DbProfile. The
+// schema is migrated once when the session opens (see migrate_schema(); not
+// for read-only profiles), and every statement is prepared once and then
+// reset and rebound, so an operation costs little more than its
+// sqlite3_step() calls. Errors throw std::runtime_error.
+class DbSession {
+public:
+    explicit DbSession(const std::string& path = "products.db", const DbProfile& profile = default_db_profile());
+    ~DbSession();
+    DbSession(const DbSession&) = delete;
+    DbSession& operator=(const DbSession&) = delete;
+
+    // Session over products.db owned by the calling thread, opened with
+    // default_db_profile() on first use and kept until the thread exits.
+    static DbSession& for_this_thread();
+
+    sqlite3* handle() const { return db_; }
+
+    // Layout of the products table when the session opened.
+    CatalogLayout layout() const { return layout_; }
+
+    // Statement for `sql`, prepared on first use and cached for the
+    // lifetime of the session.
+    DbStatement prepare(const std::string& sql);
+
+    bool barcode_exists(const std::string& barcode);
+
+    // Next code of the catalog's allocator: BarcodePermutation applied to an
+    // index from this session's BarcodeLease, so no code is handed out twice
+    // and, outside blocks taken over from dead processes, the products table
+    // is never searched. Only every BarcodeLease::kBlockSize-th code takes a
+    // write transaction. Codes generated before the allocator existed are
+    // random and could, in theory, come up again; the UNIQUE barcode then
+    // rejects the insert.
+    std::string generate_unique_barcode();
+
+    // Inserts a product and returns its id. The price is stored in cents.
+    // Throws when the barcode is already in the catalog.
+    int add_product(const std::string& barcode, const std::string& name, double price);
+
+    // add_product() that returns false instead of throwing when the barcode
+    // is taken; `id` is set otherwise.
+    bool try_add_product(const std::string& barcode, const std::string& name, double price, int& id);
+
+    // Inserts a product under the next code of the allocator, stores that
+    // code in `barcode` and returns the id. The code is not checked first:
+    // the INSERT itself skips a code already in the catalog and only then
+    // is the next one tried, so a product costs one statement and one
+    // transaction.
+    int create_product(const std::string& name, double price, std::string& barcode);
+
+    // Same result as lookup_products(), on cached statements. Barcodes the
+    // filter() rules out are not searched for.
+    std::unordered_map<std::string, Product> lookup(const std::vector<std::string>& barcodes);
+
+    // ProductFilter of this connection, saved at product_filter_path() of
+    // the database; loaded or built on first use and then kept current with
+    // this session's inserts.
+    ProductFilter& filter();
+
+private:
+    std::string next_barcode(bool& verify);
+
+    sqlite3* db_ = nullptr;
+    std::string path_;
+    CatalogLayout layout_ = CatalogLayout::Text;
+    std::unordered_map<std::string, sqlite3_stmt*> statements_;
+    std::unique_ptr<WalCheckpointer> checkpointer_;
+    std::unique_ptr<BarcodePermutation> permutation_;
+    std::unique_ptr<BarcodeLease> lease_;
+    std::unique_ptr<ProductFilter> filter_;
+};
+
+#endif // DB_SESSION_H
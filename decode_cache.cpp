@@ -0,0 +1,350 @@
+#include "decode_cache.h"
+
+#include <sqlite3.h>
+
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+
+#include "db_profile.h"
+#include "metrics.h"
+
+// xxh64
+static const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+static const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * kPrime2;
+    return rotl64(acc, 31) * kPrime1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t lane) {
+    acc ^= xxh64_round(0, lane);
+    return acc * kPrime1 + kPrime4;
+}
+
+uint64_t xxh64(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        // four independent lanes over 32-byte stripes
+        uint64_t v1 = seed + kPrime1 + kPrime2;
+        uint64_t v2 = seed + kPrime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - kPrime1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+        }
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    } else {
+        h = seed + kPrime5;
+    }
+    h += static_cast<uint64_t>(size);
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * kPrime1 + kPrime4;
+    }
+    if (p + 4 <= end) {
+        h ^= static_cast<uint64_t>(read32(p)) * kPrime1;
+        h = rotl64(h, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= *p * kPrime5;
+        h = rotl64(h, 11) * kPrime1;
+    }
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+
+// cache
+// Stored in PRAGMA user_version; a file with another value is emptied. Bump
+// it when the entry format changes or the decoders start reading more.
+static const int kCacheFormat = 1;
+
+// WAL so scanners on other threads and processes read while one stores, and
+// synchronous=NORMAL: a crash can lose the last entries, which only costs
+// decoding those images again.
+static const DbProfile kCacheProfile = {
+    "decode-cache", false, 1000,
+    "PRAGMA journal_mode = WAL;"
+    "PRAGMA synchronous = NORMAL;"
+    "PRAGMA cache_size = -8192;"
+    "PRAGMA temp_store = MEMORY;",
+    false};
+
+// decode_cache_total is kept by triggers, so every process sees the same
+// total without summing the table.
+static const char* const kCacheSchema =
+    "CREATE TABLE decode_cache ("
+    "    key INTEGER NOT NULL,"
+    "    size INTEGER NOT NULL,"
+    "    used INTEGER NOT NULL,"            // unix time of the insert or the last touch
+    "    bytes INTEGER NOT NULL,"
+    "    symbols BLOB NOT NULL,"
+    "    PRIMARY KEY (key, size)"
+    ") WITHOUT ROWID;"
+    "CREATE INDEX decode_cache_used ON decode_cache (used);"
+    "CREATE TABLE decode_cache_total (bytes INTEGER NOT NULL, entries INTEGER NOT NULL);"
+    "INSERT INTO decode_cache_total VALUES (0, 0);"
+    "CREATE TRIGGER decode_cache_added AFTER INSERT ON decode_cache BEGIN"
+    "    UPDATE decode_cache_total SET bytes = bytes + new.bytes, entries = entries + 1;"
+    "END;"
+    "CREATE TRIGGER decode_cache_removed AFTER DELETE ON decode_cache BEGIN"
+    "    UPDATE decode_cache_total SET bytes = bytes - old.bytes, entries = entries - 1;"
+    "END;";
+
+static const char* const kDropCache =
+    "DROP TABLE IF EXISTS decode_cache;"
+    "DROP TABLE IF EXISTS decode_cache_total;";
+
+std::string decode_cache_path(const std::string& database_path) {
+    size_t slash = database_path.rfind('/');
+    return (slash == std::string::npos ? std::string() : database_path.substr(0, slash + 1)) + "decode_cache.db";
+}
+
+// Resets a statement and clears its bindings when it goes out of scope.
+struct StatementReset {
+    sqlite3_stmt* stmt;
+    ~StatementReset() {
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+    }
+};
+
+DecodeCache::DecodeCache(const std::string& path, size_t max_bytes) : max_bytes_(max_bytes) {
+    db_ = open_database(path, kCacheProfile);
+    auto exec = [this](const std::string& sql) {
+        char* errMsg = nullptr;
+        if (sqlite3_exec(db_, sql.c_str(), nullptr, nullptr, &errMsg) != SQLITE_OK) {
+            std::string error = "Decode cache setup failed: " + std::string(errMsg ? errMsg : sqlite3_errmsg(db_));
+            sqlite3_free(errMsg);
+            throw std::runtime_error(error);
+        }
+    };
+
+    try {
+        exec("BEGIN IMMEDIATE;");
+        sqlite3_stmt* version = prepare("PRAGMA user_version;");
+        int format = sqlite3_step(version) == SQLITE_ROW ? sqlite3_column_int(version, 0) : -1;
+        sqlite3_finalize(version);
+        if (format != kCacheFormat) {
+            exec(std::string(kDropCache) + kCacheSchema + "PRAGMA user_version = " + std::to_string(kCacheFormat) + ";");
+        }
+        exec("COMMIT;");
+
+        find_ = prepare("SELECT used, symbols FROM decode_cache WHERE key = ? AND size = ?;");
+        touch_ = prepare("UPDATE decode_cache SET used = ? WHERE key = ? AND size = ?;");
+        insert_ = prepare("INSERT OR IGNORE INTO decode_cache (key, size, used, bytes, symbols) VALUES (?, ?, ?, ?, ?);");
+        total_ = prepare("SELECT bytes, entries FROM decode_cache_total;");
+        evict_ = prepare("DELETE FROM decode_cache WHERE (key, size) IN "
+                         "(SELECT key, size FROM decode_cache ORDER BY used LIMIT ?);");
+    } catch (const std::runtime_error&) {
+        sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
+        close();
+        throw;
+    }
+}
+
+DecodeCache::~DecodeCache() {
+    close();
+}
+
+void DecodeCache::close() {
+    for (sqlite3_stmt* stmt : {find_, touch_, insert_, total_, evict_}) {
+        sqlite3_finalize(stmt);
+    }
+    find_ = touch_ = insert_ = total_ = evict_ = nullptr;
+    sqlite3_close(db_);
+    db_ = nullptr;
+}
+
+sqlite3_stmt* DecodeCache::prepare(const char* sql) {
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("Decode cache setup failed: " + std::string(sqlite3_errmsg(db_)));
+    }
+    return stmt;
+}
+
+
+// Entries are the symbols back to back in host byte order:
+//   u32 count, then per symbol i32 type, i32 quality, i32 level,
+//   u32 data size, the data, u32 point count, i32 x/y pairs.
+template <typename T>
+static void put(std::vector<unsigned char>& out, T value) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+static bool get(const unsigned char*& p, const unsigned char* end, T& value) {
+    if (static_cast<size_t>(end - p) < sizeof(T)) {
+        return false;
+    }
+    std::memcpy(&value, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+static void encode_symbols(const std::vector<ScannedSymbol>& symbols, std::vector<unsigned char>& out) {
+    out.clear();
+    put<uint32_t>(out, static_cast<uint32_t>(symbols.size()));
+    for (const ScannedSymbol& symbol : symbols) {
+        put<int32_t>(out, static_cast<int32_t>(symbol.type));
+        put<int32_t>(out, symbol.quality);
+        put<int32_t>(out, symbol.level);
+        put<uint32_t>(out, static_cast<uint32_t>(symbol.data.size()));
+        out.insert(out.end(), symbol.data.begin(), symbol.data.end());
+        put<uint32_t>(out, static_cast<uint32_t>(symbol.polygon.size()));
+        for (const ScanPoint& point : symbol.polygon) {
+            put<int32_t>(out, point.x);
+            put<int32_t>(out, point.y);
+        }
+    }
+}
+
+static bool decode_symbols(const unsigned char* p, const unsigned char* end, std::vector<ScannedSymbol>& symbols) {
+    uint32_t count;
+    if (!get(p, end, count) || count > static_cast<size_t>(end - p)) {
+        return false;
+    }
+    // entries are overwritten in place so their buffers get reused
+    symbols.resize(count);
+    for (ScannedSymbol& symbol : symbols) {
+        int32_t type, quality, level;
+        uint32_t length, points;
+        if (!get(p, end, type) || !get(p, end, quality) || !get(p, end, level) || !get(p, end, length) ||
+            length > static_cast<size_t>(end - p)) {
+            return false;
+        }
+        symbol.type = static_cast<zbar::zbar_symbol_type_t>(type);
+        symbol.type_name = zbar_get_symbol_name(symbol.type);
+        symbol.quality = quality;
+        symbol.level = level;
+        symbol.data.assign(reinterpret_cast<const char*>(p), length);
+        p += length;
+        if (!get(p, end, points) || points > static_cast<size_t>(end - p) / 8) {
+            return false;
+        }
+        symbol.polygon.resize(points);
+        for (ScanPoint& point : symbol.polygon) {
+            get(p, end, point.x);
+            get(p, end, point.y);
+        }
+    }
+    return p == end;
+}
+
+
+bool DecodeCache::find(uint64_t key, size_t size, std::vector<ScannedSymbol>& symbols) {
+    StageTimer timer(Stage::CacheLookup);
+    int64_t used = 0;
+    bool hit = false;
+    {
+        StatementReset reset{find_};
+        sqlite3_bind_int64(find_, 1, static_cast<int64_t>(key));
+        sqlite3_bind_int64(find_, 2, static_cast<int64_t>(size));
+        if (sqlite3_step(find_) == SQLITE_ROW) {
+            used = sqlite3_column_int64(find_, 0);
+            const unsigned char* blob = static_cast<const unsigned char*>(sqlite3_column_blob(find_, 1));
+            int bytes = sqlite3_column_bytes(find_, 1);
+            hit = blob && decode_symbols(blob, blob + bytes, symbols);
+        }
+    }
+    timer.stop();
+    count_event(hit ? Counter::DecodeCacheHit : Counter::DecodeCacheMiss);
+    if (!hit) {
+        return false;
+    }
+
+    int64_t now = static_cast<int64_t>(std::time(nullptr));
+    if (now - used >= kTouchSeconds) {
+        StatementReset reset{touch_};
+        sqlite3_bind_int64(touch_, 1, now);
+        sqlite3_bind_int64(touch_, 2, static_cast<int64_t>(key));
+        sqlite3_bind_int64(touch_, 3, static_cast<int64_t>(size));
+        sqlite3_step(touch_);
+    }
+    return true;
+}
+
+void DecodeCache::store(uint64_t key, size_t size, const std::vector<ScannedSymbol>& symbols) {
+    encode_symbols(symbols, blob_);
+    {
+        StatementReset reset{insert_};
+        sqlite3_bind_int64(insert_, 1, static_cast<int64_t>(key));
+        sqlite3_bind_int64(insert_, 2, static_cast<int64_t>(size));
+        sqlite3_bind_int64(insert_, 3, static_cast<int64_t>(std::time(nullptr)));
+        sqlite3_bind_int64(insert_, 4, static_cast<int64_t>(blob_.size() + kEntryOverhead));
+        sqlite3_bind_blob(insert_, 5, blob_.data(), static_cast<int>(blob_.size()), SQLITE_STATIC);
+        if (sqlite3_step(insert_) != SQLITE_DONE || sqlite3_changes(db_) == 0) {
+            return;
+        }
+    }
+    evict();
+}
+
+// Once the total is over the limit, deletes the least recently used entries
+// in batches sized from the average entry until it is under 90% of it.
+void DecodeCache::evict() {
+    size_t limit = max_bytes_;
+    for (;;) {
+        int64_t bytes = 0, entries = 0;
+        {
+            StatementReset reset{total_};
+            if (sqlite3_step(total_) != SQLITE_ROW) {
+                return;
+            }
+            bytes = sqlite3_column_int64(total_, 0);
+            entries = sqlite3_column_int64(total_, 1);
+        }
+        if (entries <= 0 || bytes <= static_cast<int64_t>(limit)) {
+            return;
+        }
+        limit = max_bytes_ / 10 * 9;
+
+        int64_t batch = (bytes - static_cast<int64_t>(limit)) * entries / bytes + 1;
+        StatementReset reset{evict_};
+        sqlite3_bind_int64(evict_, 1, batch);
+        if (sqlite3_step(evict_) != SQLITE_DONE || sqlite3_changes(db_) == 0) {
+            return;
+        }
+        count_event(Counter::DecodeCacheEvicted, static_cast<uint64_t>(sqlite3_changes(db_)));
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef DECODE_CACHE_H
+#define DECODE_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "scan_context.h"
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+// XXH64 of `size` bytes with `seed`, as in the xxHash reference; written out
+// here so no library is needed. Reads the input as little-endian words.
+uint64_t xxh64(const void* data, size_t size, uint64_t seed = 0);
+
+// File of the decode cache that belongs to the products database at
+// `database_path`: decode_cache.db in the same directory.
+std::string decode_cache_path(const std::string& database_path);
+
+// Persistent map from image contents to the symbols decoded from them, so an
+// image scanned before costs a hash and one lookup instead of a decode. An
+// entry is keyed by the XXH64 of the file bytes, seeded with the scan
+// settings that shape the result, and by the byte count. Images without a
+// barcode are stored too; images that could not be decoded are not.
+//
+// The table is shared by every process and thread that opens the file, one
+// DecodeCache per thread (the connection is NOMUTEX). Each entry carries the
+// time it was last used, refreshed on a hit at most once per kTouchSeconds so
+// a hit rarely writes. Once the entries take more than `max_bytes` (symbols
+// plus kEntryOverhead each, not the file size) the least recently used are
+// deleted down to 90% of it. Hits, misses and evictions are counted in the
+// metrics. Only the constructor throws (std::runtime_error); a lookup or
+// store that fails, e.g. on a busy database, counts as a miss or is skipped.
+class DecodeCache {
+public:
+    static const int kTouchSeconds = 60;
+    static const size_t kEntryOverhead = 48;
+
+    DecodeCache(const std::string& path, size_t max_bytes);
+    ~DecodeCache();
+    DecodeCache(const DecodeCache&) = delete;
+    DecodeCache& operator=(const DecodeCache&) = delete;
+
+    // Fills `symbols` from the entry for (key, size), reusing its elements'
+    // buffers. Returns false when there is none.
+    bool find(uint64_t key, size_t size, std::vector<ScannedSymbol>& symbols);
+
+    void store(uint64_t key, size_t size, const std::vector<ScannedSymbol>& symbols);
+
+private:
+    sqlite3_stmt* prepare(const char* sql);
+    void evict();
+    void close();
+
+    sqlite3* db_ = nullptr;
+    sqlite3_stmt* find_ = nullptr;
+    sqlite3_stmt* touch_ = nullptr;
+    sqlite3_stmt* insert_ = nullptr;
+    sqlite3_stmt* total_ = nullptr;
+    sqlite3_stmt* evict_ = nullptr;
+    size_t max_bytes_;
+    std::vector<unsigned char> blob_;   // serialized symbols, grow-only
+};
+
+#endif // DECODE_CACHE_H
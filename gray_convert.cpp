@@ -0,0 +1,432 @@
+#include "gray_convert.h"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define GRAY_CONVERT_X86 1
+#include <immintrin.h>
+#endif
+
+// Y = (77 R + 150 G + 29 B + 128) >> 8, i.e. 0.299/0.587/0.114 in 8.8 fixed point.
+static const int kWeightR = 77;
+static const int kWeightG = 150;
+static const int kWeightB = 29;
+
+typedef void (*gray_kernel)(const unsigned char* src, size_t pixels, unsigned char* dst);
+typedef void (*sum_kernel)(const unsigned char* src, size_t pixels, uint32_t* sums);
+typedef void (*half_row_kernel)(const unsigned char* row0, const unsigned char* row1, size_t out_width, unsigned char* dst);
+
+
+// scalar kernels, one instantiation per channel count
+template <int C>
+static void gray_scalar(const unsigned char* src, size_t pixels, unsigned char* dst) {
+    for (size_t i = 0; i < pixels; ++i) {
+        const unsigned char* p = src + i * C;
+        if (C <= 2) {
+            dst[i] = p[0];
+        } else {
+            dst[i] = static_cast<unsigned char>((kWeightR * p[0] + kWeightG * p[1] + kWeightB * p[2] + 128) >> 8);
+        }
+    }
+}
+
+// Adds each pixel's luma before the final shift, 256 times its value, to sums.
+template <int C>
+static void sum_scalar(const unsigned char* src, size_t pixels, uint32_t* sums) {
+    for (size_t i = 0; i < pixels; ++i) {
+        const unsigned char* p = src + i * C;
+        if (C <= 2) {
+            sums[i] += static_cast<uint32_t>(p[0]) << 8;
+        } else {
+            sums[i] += kWeightR * p[0] + kWeightG * p[1] + kWeightB * p[2];
+        }
+    }
+}
+
+static void gray_copy(const unsigned char* src, size_t pixels, unsigned char* dst) {
+    if (src != dst) {
+        std::memmove(dst, src, pixels);
+    }
+}
+
+// 2x2 box filter over a pair of rows, rounded to nearest
+static void half_row_scalar(const unsigned char* row0, const unsigned char* row1, size_t out_width, unsigned char* dst) {
+    for (size_t i = 0; i < out_width; ++i) {
+        dst[i] = static_cast<unsigned char>((row0[2 * i] + row0[2 * i + 1] + row1[2 * i] + row1[2 * i + 1] + 2) >> 2);
+    }
+}
+
+
+#ifdef GRAY_CONVERT_X86
+
+// Every kernel reads a block before it writes the (shorter) output block, and the
+// output never overtakes the input, which keeps in-place conversion valid.
+
+// SSE2: 4 pixels packed as 32-bit RGBx lanes -> 4 x int32 weighted sums.
+static inline __m128i weigh_rgbx_sse2(__m128i px) {
+    const __m128i lo_mask = _mm_set1_epi32(0x00FF00FF);
+    const __m128i w_rb = _mm_set1_epi32((kWeightB << 16) | kWeightR);
+    const __m128i w_g = _mm_set1_epi32(kWeightG);
+    __m128i rb = _mm_and_si128(px, lo_mask);
+    __m128i g = _mm_and_si128(_mm_srli_epi32(px, 8), lo_mask);
+    return _mm_add_epi32(_mm_madd_epi16(rb, w_rb), _mm_madd_epi16(g, w_g));
+}
+
+static inline __m128i luma_rgbx_sse2(__m128i px) {
+    return _mm_srli_epi32(_mm_add_epi32(weigh_rgbx_sse2(px), _mm_set1_epi32(128)), 8);
+}
+
+static inline void add_sums_sse2(uint32_t* sums, __m128i values) {
+    __m128i* p = reinterpret_cast<__m128i*>(sums);
+    _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), values));
+}
+
+static inline void store_luma16_sse2(unsigned char* dst, __m128i y0, __m128i y1, __m128i y2, __m128i y3) {
+    __m128i lo = _mm_packs_epi32(y0, y1);
+    __m128i hi = _mm_packs_epi32(y2, y3);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(lo, hi));
+}
+
+// 4 RGB pixels (12 bytes at p, 16 readable) -> RGBx lanes without SSSE3 shuffles.
+static inline __m128i load_rgb4_sse2(const unsigned char* p) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i p01 = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+    __m128i p23 = _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9));
+    return _mm_unpacklo_epi64(p01, p23);
+}
+
+static void gray_sse2_2(const unsigned char* src, size_t pixels, unsigned char* dst) {
+    const __m128i mask = _mm_set1_epi16(0x00FF);
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2 + 16));
+        __m128i g = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), g);
+    }
+    gray_scalar<2>(src + i * 2, pixels - i, dst + i);
+}
+
+static void gray_sse2_3(const unsigned char* src, size_t pixels, unsigned char* dst) {
+    size_t i = 0;
+    // the last group of 4 reads 4 bytes past its pixels, so keep two pixels of slack
+    for (; i + 18 <= pixels; i += 16) {
+        const unsigned char* p = src + i * 3;
+        __m128i y0 = luma_rgbx_sse2(load_rgb4_sse2(p));
+        __m128i y1 = luma_rgbx_sse2(load_rgb4_sse2(p + 12));
+        __m128i y2 = luma_rgbx_sse2(load_rgb4_sse2(p + 24));
+        __m128i y3 = luma_rgbx_sse2(load_rgb4_sse2(p + 36));
+        store_luma16_sse2(dst + i, y0, y1, y2, y3);
+    }
+    gray_scalar<3>(src + i * 3, pixels - i, dst + i);
+}
+
+static void gray_sse2_4(const unsigned char* src, size_t pixels, unsigned char* dst) {
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        const __m128i* p = reinterpret_cast<const __m128i*>(src + i * 4);
+        __m128i y0 = luma_rgbx_sse2(_mm_loadu_si128(p));
+        __m128i y1 = luma_rgbx_sse2(_mm_loadu_si128(p + 1));
+        __m128i y2 = luma_rgbx_sse2(_mm_loadu_si128(p + 2));
+        __m128i y3 = luma_rgbx_sse2(_mm_loadu_si128(p + 3));
+        store_luma16_sse2(dst + i, y0, y1, y2, y3);
+    }
+    gray_scalar<4>(src + i * 4, pixels - i, dst + i);
+}
+
+// Gray bytes become the high byte of each 16-bit lane, i.e. value << 8.
+static void sum_sse2_1(const unsigned char* src, size_t pixels, uint32_t* sums) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i lo = _mm_unpacklo_epi8(zero, v);
+        __m128i hi = _mm_unpackhi_epi8(zero, v);
+        add_sums_sse2(sums + i, _mm_unpacklo_epi16(lo, zero));
+        add_sums_sse2(sums + i + 4, _mm_unpackhi_epi16(lo, zero));
+        add_sums_sse2(sums + i + 8, _mm_unpacklo_epi16(hi, zero));
+        add_sums_sse2(sums + i + 12, _mm_unpackhi_epi16(hi, zero));
+    }
+    sum_scalar<1>(src + i, pixels - i, sums + i);
+}
+
+// Shifting each gray+alpha pair left by 8 leaves gray << 8.
+static void sum_sse2_2(const unsigned char* src, size_t pixels, uint32_t* sums) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        __m128i v = _mm_slli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2)), 8);
+        add_sums_sse2(sums + i, _mm_unpacklo_epi16(v, zero));
+        add_sums_sse2(sums + i + 4, _mm_unpackhi_epi16(v, zero));
+    }
+    sum_scalar<2>(src + i * 2, pixels - i, sums + i);
+}
+
+static void sum_sse2_3(const unsigned char* src, size_t pixels, uint32_t* sums) {
+    size_t i = 0;
+    // as in gray_sse2_3(), the last load reads 4 bytes past its pixels
+    for (; i + 6 <= pixels; i += 4) {
+        add_sums_sse2(sums + i, weigh_rgbx_sse2(load_rgb4_sse2(src + i * 3)));
+    }
+    sum_scalar<3>(src + i * 3, pixels - i, sums + i);
+}
+
+static void sum_sse2_4(const unsigned char* src, size_t pixels, uint32_t* sums) {
+    size_t i = 0;
+    for (; i + 4 <= pixels; i += 4) {
+        add_sums_sse2(sums + i, weigh_rgbx_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4))));
+    }
+    sum_scalar<4>(src + i * 4, pixels - i, sums + i);
+}
+
+// 16 source bytes of each row -> 8 horizontal pair sums of both rows, as u16.
+static inline __m128i pair_sums_sse2(const unsigned char* row0, const unsigned char* row1) {
+    const __m128i mask = _mm_set1_epi16(0x00FF);
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1));
+    __m128i sa = _mm_add_epi16(_mm_and_si128(a, mask), _mm_srli_epi16(a, 8));
+    __m128i sb = _mm_add_epi16(_mm_and_si128(b, mask), _mm_srli_epi16(b, 8));
+    return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(sa, sb), _mm_set1_epi16(2)), 2);
+}
+
+static void half_row_sse2(const unsigned char* row0, const unsigned char* row1, size_t out_width, unsigned char* dst) {
+    size_t i = 0;
+    for (; i + 16 <= out_width; i += 16) {
+        __m128i lo = pair_sums_sse2(row0 + 2 * i, row1 + 2 * i);
+        __m128i hi = pair_sums_sse2(row0 + 2 * i + 16, row1 + 2 * i + 16);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    half_row_scalar(row0 + 2 * i, row1 + 2 * i, out_width - i, dst + i);
+}
+
+
+// AVX2: same arithmetic on 8 pixels per vector.
+#define GRAY_AVX2 __attribute__((target("avx2")))
+
+GRAY_AVX2 static inline __m256i weigh_rgbx_avx2(__m256i px) {
+    const __m256i lo_mask = _mm256_set1_epi32(0x00FF00FF);
+    const __m256i w_rb = _mm256_set1_epi32((kWeightB << 16) | kWeightR);
+    const __m256i w_g = _mm256_set1_epi32(kWeightG);
+    __m256i rb = _mm256_and_si256(px, lo_mask);
+    __m256i g = _mm256_and_si256(_mm256_srli_epi32(px, 8), lo_mask);
+    return _mm256_add_epi32(_mm256_madd_epi16(rb, w_rb), _mm256_madd_epi16(g, w_g));
+}
+
+GRAY_AVX2 static inline __m256i luma_rgbx_avx2(__m256i px) {
+    return _mm256_srli_epi32(_mm256_add_epi32(weigh_rgbx_avx2(px), _mm256_set1_epi32(128)), 8);
+}
+
+GRAY_AVX2 static inline void add_sums_avx2(uint32_t* sums, __m256i values) {
+    __m256i* p = reinterpret_cast<__m256i*>(sums);
+    _mm256_storeu_si256(p, _mm256_add_epi32(_mm256_loadu_si256(p), values));
+}
+
+// packs/packus work per 128-bit lane; the final dword permute restores pixel order.
+GRAY_AVX2 static inline void store_luma32_avx2(unsigned char* dst, __m256i y0, __m256i y1, __m256i y2, __m256i y3) {
+    __m256i lo = _mm256_packs_epi32(y0, y1);
+    __m256i hi = _mm256_packs_epi32(y2, y3);
+    __m256i bytes = _mm256_packus_epi16(lo, hi);
+    bytes = _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), bytes);
+}
+
+// 8 RGB pixels (24 bytes at p, 28 readable) -> RGBx lanes.
+GRAY_AVX2 static inline __m256i load_rgb8_avx2(const unsigned char* p) {
+    const __m256i shuffle = _mm256_setr_epi8(
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 12));
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(a), b, 1);
+    return _mm256_shuffle_epi8(v, shuffle);
+}
+
+GRAY_AVX2 static void gray_avx2_2(const unsigned char* src, size_t pixels, unsigned char* dst) {
+    const __m256i mask = _mm256_set1_epi16(0x00FF);
+    size_t i = 0;
+    for (; i + 32 <= pixels; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 2));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 2 + 32));
+        __m256i g = _mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask));
+        g = _mm256_permute4x64_epi64(g, 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), g);
+    }
+    gray_sse2_2(src + i * 2, pixels - i, dst + i);
+}
+
+GRAY_AVX2 static void gray_avx2_3(const unsigned char* src, size_t pixels, unsigned char* dst) {
+    size_t i = 0;
+    for (; i + 34 <= pixels; i += 32) {
+        const unsigned char* p = src + i * 3;
+        __m256i y0 = luma_rgbx_avx2(load_rgb8_avx2(p));
+        __m256i y1 = luma_rgbx_avx2(load_rgb8_avx2(p + 24));
+        __m256i y2 = luma_rgbx_avx2(load_rgb8_avx2(p + 48));
+        __m256i y3 = luma_rgbx_avx2(load_rgb8_avx2(p + 72));
+        store_luma32_avx2(dst + i, y0, y1, y2, y3);
+    }
+    gray_sse2_3(src + i * 3, pixels - i, dst + i);
+}
+
+GRAY_AVX2 static void gray_avx2_4(const unsigned char* src, size_t pixels, unsigned char* dst) {
+    size_t i = 0;
+    for (; i + 32 <= pixels; i += 32) {
+        const __m256i* p = reinterpret_cast<const __m256i*>(src + i * 4);
+        __m256i y0 = luma_rgbx_avx2(_mm256_loadu_si256(p));
+        __m256i y1 = luma_rgbx_avx2(_mm256_loadu_si256(p + 1));
+        __m256i y2 = luma_rgbx_avx2(_mm256_loadu_si256(p + 2));
+        __m256i y3 = luma_rgbx_avx2(_mm256_loadu_si256(p + 3));
+        store_luma32_avx2(dst + i, y0, y1, y2, y3);
+    }
+    gray_sse2_4(src + i * 4, pixels - i, dst + i);
+}
+
+// Zero extension keeps pixel order, which the in-lane unpacks would not.
+GRAY_AVX2 static void sum_avx2_1(const unsigned char* src, size_t pixels, uint32_t* sums) {
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+        add_sums_avx2(sums + i, _mm256_slli_epi32(_mm256_cvtepu8_epi32(v), 8));
+    }
+    sum_scalar<1>(src + i, pixels - i, sums + i);
+}
+
+GRAY_AVX2 static void sum_avx2_2(const unsigned char* src, size_t pixels, uint32_t* sums) {
+    const __m256i mask = _mm256_set1_epi32(0xFF);
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+        add_sums_avx2(sums + i, _mm256_slli_epi32(_mm256_and_si256(_mm256_cvtepu16_epi32(v), mask), 8));
+    }
+    sum_scalar<2>(src + i * 2, pixels - i, sums + i);
+}
+
+GRAY_AVX2 static void sum_avx2_3(const unsigned char* src, size_t pixels, uint32_t* sums) {
+    size_t i = 0;
+    for (; i + 10 <= pixels; i += 8) {
+        add_sums_avx2(sums + i, weigh_rgbx_avx2(load_rgb8_avx2(src + i * 3)));
+    }
+    sum_sse2_3(src + i * 3, pixels - i, sums + i);
+}
+
+GRAY_AVX2 static void sum_avx2_4(const unsigned char* src, size_t pixels, uint32_t* sums) {
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        add_sums_avx2(sums + i, weigh_rgbx_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4))));
+    }
+    sum_scalar<4>(src + i * 4, pixels - i, sums + i);
+}
+
+GRAY_AVX2 static inline __m256i pair_sums_avx2(const unsigned char* row0, const unsigned char* row1) {
+    const __m256i mask = _mm256_set1_epi16(0x00FF);
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1));
+    __m256i sa = _mm256_add_epi16(_mm256_and_si256(a, mask), _mm256_srli_epi16(a, 8));
+    __m256i sb = _mm256_add_epi16(_mm256_and_si256(b, mask), _mm256_srli_epi16(b, 8));
+    return _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(sa, sb), _mm256_set1_epi16(2)), 2);
+}
+
+GRAY_AVX2 static void half_row_avx2(const unsigned char* row0, const unsigned char* row1, size_t out_width, unsigned char* dst) {
+    size_t i = 0;
+    for (; i + 32 <= out_width; i += 32) {
+        __m256i lo = pair_sums_avx2(row0 + 2 * i, row1 + 2 * i);
+        __m256i hi = pair_sums_avx2(row0 + 2 * i + 32, row1 + 2 * i + 32);
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+    }
+    half_row_sse2(row0 + 2 * i, row1 + 2 * i, out_width - i, dst + i);
+}
+
+#endif // GRAY_CONVERT_X86
+
+
+struct GrayKernels {
+    const char* name;
+    gray_kernel by_channels[5];
+    half_row_kernel half_row;
+    sum_kernel sum_by_channels[5];
+};
+
+static const GrayKernels& gray_kernels() {
+    static const GrayKernels kernels = []() {
+#ifdef GRAY_CONVERT_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return GrayKernels{"avx2", {nullptr, gray_copy, gray_avx2_2, gray_avx2_3, gray_avx2_4}, half_row_avx2,
+                               {nullptr, sum_avx2_1, sum_avx2_2, sum_avx2_3, sum_avx2_4}};
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return GrayKernels{"sse2", {nullptr, gray_copy, gray_sse2_2, gray_sse2_3, gray_sse2_4}, half_row_sse2,
+                               {nullptr, sum_sse2_1, sum_sse2_2, sum_sse2_3, sum_sse2_4}};
+        }
+#endif
+        return GrayKernels{"scalar", {nullptr, gray_copy, gray_scalar<2>, gray_scalar<3>, gray_scalar<4>}, half_row_scalar,
+                           {nullptr, sum_scalar<1>, sum_scalar<2>, sum_scalar<3>, sum_scalar<4>}};
+    }();
+    return kernels;
+}
+
+void convert_to_gray(const unsigned char* src, int channels, size_t pixels, unsigned char* dst) {
+    if (channels < 1 || channels > 4) {
+        throw std::runtime_error("Unsupported channel count: " + std::to_string(channels));
+    }
+    gray_kernels().by_channels[channels](src, pixels, dst);
+}
+
+void downscale_half(const unsigned char* src, int width, int height, unsigned char* dst) {
+    half_row_kernel half_row = gray_kernels().half_row;
+    size_t out_width = width / 2;
+    for (int y = 0; y + 1 < height; y += 2) {
+        const unsigned char* row0 = src + static_cast<size_t>(y) * width;
+        half_row(row0, row0 + width, out_width, dst + (y / 2) * out_width);
+    }
+}
+
+void GrayShrinker::start(int width, int channels, int factor, unsigned char* dst) {
+    if (channels < 1 || channels > 4) {
+        throw std::runtime_error("Unsupported channel count: " + std::to_string(channels));
+    }
+    if (factor < 1 || factor > kMaxShrinkFactor) {
+        throw std::runtime_error("Unsupported shrink factor: " + std::to_string(factor));
+    }
+    width_ = static_cast<size_t>(width);
+    channels_ = channels;
+    factor_ = factor;
+    rows_ = 0;
+    out_ = dst;
+    sums_.assign(width_, 0);
+}
+
+void GrayShrinker::add_row(const unsigned char* row) {
+    gray_kernels().sum_by_channels[channels_](row, width_, sums_.data());
+    if (++rows_ < factor_) {
+        return;
+    }
+
+    // One output row per block of rows. Dividing the rounded block sum by
+    // 256 factor^2 is a shift by 8 and a division by factor^2 of a value
+    // below 2^24, which the multiply by 2^40 / factor^2 + 1 does exactly.
+    // Locals, since stores through `out` may alias the members.
+    const int factor = factor_;
+    const size_t out_width = width_ / factor;
+    const uint32_t half = static_cast<uint32_t>(factor) * factor * 128;
+    const uint64_t reciprocal = (uint64_t(1) << 40) / (static_cast<uint64_t>(factor) * factor) + 1;
+    const uint32_t* sum = sums_.data();
+    unsigned char* out = out_;
+    for (size_t x = 0; x < out_width; ++x, sum += factor) {
+        uint32_t total = half;
+        for (int i = 0; i < factor; ++i) {
+            total += sum[i];
+        }
+        out[x] = static_cast<unsigned char>(((total >> 8) * reciprocal) >> 40);
+    }
+    out_ = out + out_width;
+    rows_ = 0;
+    std::memset(sums_.data(), 0, width_ * sizeof(uint32_t));
+}
+
+const char* gray_convert_backend() {
+    return gray_kernels().name;
+}
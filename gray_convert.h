@@ -0,0 +1,50 @@
+#ifndef GRAY_CONVERT_H
+#define GRAY_CONVERT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Converts `pixels` interleaved pixels with `channels` components (1..4:
+// gray, gray+alpha, RGB, RGBA) into 8-bit luma. Uses BT.601 weights in 8.8
+// fixed point. `dst` may point at `src`: the conversion is safe in place, so
+// a decoded image buffer can be reused as the gray frame.
+void convert_to_gray(const unsigned char* src, int channels, size_t pixels, unsigned char* dst);
+
+// Halves an 8-bit gray image with a rounded 2x2 box filter into a
+// (width / 2) x (height / 2) frame; an odd last row or column is dropped.
+// Shares the dispatched SIMD kernels with convert_to_gray().
+void downscale_half(const unsigned char* src, int width, int height, unsigned char* dst);
+
+// Largest factor GrayShrinker takes; its 32-bit sums overflow beyond it.
+const int kMaxShrinkFactor = 256;
+
+// Converts and box-downscales an image by an integer `factor` in a single
+// pass over its rows: each row is converted to luma and added into one row
+// of column sums with the same weights as convert_to_gray(), and every
+// `factor` rows the sums are averaged in factor x factor blocks into one
+// output row, rounded to nearest. A partial block at the right or bottom
+// edge is dropped, as in downscale_half(). Decoders feed it rows as they
+// produce them, so the full-size gray frame never exists. The sums only grow.
+class GrayShrinker {
+public:
+    // Starts an image `width` pixels wide with `channels` components (1..4)
+    // per pixel; output rows of width / `factor` bytes go to `dst`.
+    void start(int width, int channels, int factor, unsigned char* dst);
+
+    // Adds the next row of width * channels bytes.
+    void add_row(const unsigned char* row);
+
+private:
+    std::vector<uint32_t> sums_;
+    size_t width_ = 0;
+    int channels_ = 1;
+    int factor_ = 1;
+    int rows_ = 0;              // rows in the current block
+    unsigned char* out_ = nullptr;
+};
+
+// Name of the kernel set picked by runtime CPU dispatch ("avx2", "sse2" or "scalar").
+const char* gray_convert_backend();
+
+#endif // GRAY_CONVERT_H
@@ -0,0 +1,116 @@
+#include "jpeg_gray.h"
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+#include <jpeglib.h>
+
+#include "gray_convert.h"
+
+// Rows handed to jpeg_read_scanlines() per call; more than any
+// rec_outbuf_height libjpeg asks for.
+static const int kRowBatch = 16;
+
+// libjpeg reports fatal errors through error_exit, which must not return, so
+// it jumps back into the call that failed. Warnings (corrupt data that
+// libjpeg recovers from) are not printed; the scan just finds nothing.
+struct JpegGrayDecoder::State {
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr error;
+    std::jmp_buf jump;
+    GrayShrinker shrinker;
+    std::vector<unsigned char> rows;    // one batch of rows to shrink, grow-only
+};
+
+static void jpeg_error_exit(j_common_ptr cinfo) {
+    std::longjmp(*static_cast<std::jmp_buf*>(cinfo->client_data), 1);
+}
+
+static void jpeg_output_message(j_common_ptr) {
+}
+
+bool is_jpeg(const unsigned char* data, size_t size) {
+    return size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+}
+
+JpegGrayDecoder::JpegGrayDecoder() : state_(new State()) {
+    jpeg_decompress_struct& cinfo = state_->cinfo;
+    cinfo.err = jpeg_std_error(&state_->error);
+    state_->error.error_exit = jpeg_error_exit;
+    state_->error.output_message = jpeg_output_message;
+    cinfo.client_data = &state_->jump;
+    if (setjmp(state_->jump)) {
+        throw std::runtime_error("Cannot create JPEG decoder");
+    }
+    jpeg_create_decompress(&cinfo);
+}
+
+JpegGrayDecoder::~JpegGrayDecoder() {
+    jpeg_destroy_decompress(&state_->cinfo);
+}
+
+bool JpegGrayDecoder::start(const unsigned char* data, size_t size, int scale) {
+    jpeg_decompress_struct& cinfo = state_->cinfo;
+    if (setjmp(state_->jump)) {
+        jpeg_abort_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_mem_src(&cinfo, data, static_cast<unsigned long>(size));
+    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK ||
+        cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+        jpeg_abort_decompress(&cinfo);
+        return false;
+    }
+    cinfo.out_color_space = JCS_GRAYSCALE;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = static_cast<unsigned int>(scale);
+    jpeg_start_decompress(&cinfo);
+    return true;
+}
+
+int JpegGrayDecoder::width() const {
+    return static_cast<int>(state_->cinfo.output_width);
+}
+
+int JpegGrayDecoder::height() const {
+    return static_cast<int>(state_->cinfo.output_height);
+}
+
+bool JpegGrayDecoder::read(unsigned char* gray, int factor) {
+    jpeg_decompress_struct& cinfo = state_->cinfo;
+    if (setjmp(state_->jump)) {
+        jpeg_abort_decompress(&cinfo);
+        return false;
+    }
+
+    size_t stride = cinfo.output_width;
+    if (factor > 1) {
+        state_->shrinker.start(static_cast<int>(stride), 1, factor, gray);
+        if (state_->rows.size() < stride * kRowBatch) {
+            state_->rows.resize(stride * kRowBatch);
+        }
+    }
+    JSAMPROW rows[kRowBatch];
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JDIMENSION first = cinfo.output_scanline;
+        int count = static_cast<int>(std::min<JDIMENSION>(kRowBatch, cinfo.output_height - first));
+        for (int i = 0; i < count; ++i) {
+            rows[i] = factor > 1 ? &state_->rows[i * stride] : gray + (first + i) * stride;
+        }
+        int done = static_cast<int>(jpeg_read_scanlines(&cinfo, rows, static_cast<JDIMENSION>(count)));
+        for (int i = 0; factor > 1 && i < done; ++i) {
+            state_->shrinker.add_row(rows[i]);
+        }
+    }
+    // the trailing markers hold nothing the scan needs
+    jpeg_abort_decompress(&cinfo);
+    return true;
+}
+
+void JpegGrayDecoder::abort() {
+    jpeg_abort_decompress(&state_->cinfo);
+}
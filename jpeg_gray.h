@@ -0,0 +1,45 @@
+#ifndef JPEG_GRAY_H
+#define JPEG_GRAY_H
+
+#include <cstddef>
+#include <memory>
+
+// True when `data` starts with a JPEG SOI marker.
+bool is_jpeg(const unsigned char* data, size_t size);
+
+// libjpeg(-turbo) decoder that only produces the luma plane. With a gray
+// output colour space libjpeg skips the IDCT, upsampling and colour
+// conversion of the chroma components, and with a scale denominator it runs
+// a reduced IDCT, so a 1/8 decode touches 1/64 of the pixels. The
+// decompress object is kept between images.
+class JpegGrayDecoder {
+public:
+    JpegGrayDecoder();
+    ~JpegGrayDecoder();
+    JpegGrayDecoder(const JpegGrayDecoder&) = delete;
+    JpegGrayDecoder& operator=(const JpegGrayDecoder&) = delete;
+
+    // Reads the header of an in-memory JPEG and sets up a decode at 1/`scale`
+    // (1, 2, 4 or 8). Returns false when libjpeg cannot decode it to gray
+    // (corrupt header, CMYK); nothing is left to clean up then.
+    bool start(const unsigned char* data, size_t size, int scale);
+
+    // Size of the scaled output, valid after start().
+    int width() const;
+    int height() const;
+
+    // Decodes the rows into `gray`, width() bytes per row, and ends the
+    // image. With a `factor` above 1 the rows go through a GrayShrinker
+    // instead and `gray` gets (width() / factor) x (height() / factor)
+    // pixels. Returns false when the data turns out to be corrupt.
+    bool read(unsigned char* gray, int factor = 1);
+
+    // Ends the image without decoding it.
+    void abort();
+
+private:
+    struct State;
+    std::unique_ptr<State> state_;
+};
+
+#endif // JPEG_GRAY_H
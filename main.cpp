@@ -1,4 +1,3 @@
-#include <zint.h>
 #include <stdio.h>
 #include <cstring>
 #include <sqlite3.h>
@@ -8,170 +7,35 @@
 #include <random>
 #include <ctime>
 #include <set>
+#include <algorithm>
+#include <cstdlib>
+#include <unordered_map>
+#include <vector>
+#include <fstream>
+#include <iterator>
 
 #include <zbar.h>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include "barcode_catalog.h"
+#include "barcode_label.h"
+#include "barcode_format.h"
+#include "batch_scan.h"
+#include "bulk_generate.h"
+#include "db_profile.h"
+#include "db_session.h"
+#include "decode_cache.h"
+#include "metrics.h"
+#include "product_lookup.h"
+#include "scan_client.h"
+#include "scan_context.h"
+#include "schema_migrations.h"
 
 #include <iomanip>
 
 
 // generator
-void ensure_table_structure(sqlite3* db) {
-    const char* tableCheckSQL = "SELECT count(*) FROM sqlite_master WHERE type='table' AND name='products';";
-    sqlite3_stmt* stmt_check;
-    if (sqlite3_prepare_v2(db, tableCheckSQL, -1, &stmt_check, nullptr) != SQLITE_OK) {
-        throw std::runtime_error("Table check failed: " + std::string(sqlite3_errmsg(db)));
-    }
-
-    int table_exists = 0;
-    if (sqlite3_step(stmt_check) == SQLITE_ROW) {
-        table_exists = sqlite3_column_int(stmt_check, 0);
-    }
-    sqlite3_finalize(stmt_check);
-
-    if (!table_exists) {
-
-        const char* createTableSQL =
-            "CREATE TABLE products ("
-            "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-            "barcode TEXT NOT NULL UNIQUE,"
-            "product_name TEXT NOT NULL,"
-            "price REAL);";
-
-        char* errMsg = nullptr;
-        if (sqlite3_exec(db, createTableSQL, nullptr, nullptr, &errMsg) != SQLITE_OK) {
-            std::string error = "SQL error (create table): " + std::string(errMsg);
-            sqlite3_free(errMsg);
-            throw std::runtime_error(error);
-        }
-        return;
-    }
-
-    const char* columnCheckSQL = "PRAGMA table_info(products);";
-    sqlite3_stmt* stmt_col;
-    if (sqlite3_prepare_v2(db, columnCheckSQL, -1, &stmt_col, nullptr) != SQLITE_OK) {
-        throw std::runtime_error("Column check failed: " + std::string(sqlite3_errmsg(db)));
-    }
-
-    bool has_id_column = false;
-    bool has_autoinc = false;
-    while (sqlite3_step(stmt_col) == SQLITE_ROW) {
-        std::string col_name = reinterpret_cast<const char*>(sqlite3_column_text(stmt_col, 1));
-        if (col_name == "id") {
-            has_id_column = true;
-            std::string type = reinterpret_cast<const char*>(sqlite3_column_text(stmt_col, 2));
-            if (type.find("AUTOINCREMENT") != std::string::npos) {
-                has_autoinc = true;
-            }
-        }
-    }
-    sqlite3_finalize(stmt_col);
-
-    if (!has_id_column || !has_autoinc) {
-        const char* tempTableSQL =
-            "CREATE TEMPORARY TABLE products_backup AS SELECT * FROM products;"
-            "DROP TABLE products;"
-            "CREATE TABLE products ("
-            "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-            "barcode TEXT NOT NULL UNIQUE,"
-            "product_name TEXT NOT NULL,"
-            "price REAL);"
-            "INSERT INTO products (barcode, product_name, price) "
-            "SELECT barcode, product_name, price FROM products_backup;"
-            "DROP TABLE products_backup;";
-
-        char* errMsg = nullptr;
-        if (sqlite3_exec(db, tempTableSQL, nullptr, nullptr, &errMsg) != SQLITE_OK) {
-            std::string error = "SQL error (migrate table): " + std::string(errMsg);
-            sqlite3_free(errMsg);
-            throw std::runtime_error(error);
-        }
-    }
-}
-
-
-bool barcode_exists(sqlite3* db, const std::string& barcode) {
-    ensure_table_structure(db);
-
-    std::string sql = "SELECT COUNT(*) FROM products WHERE barcode = ?;";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-        throw std::runtime_error("Barcode check failed: " + std::string(sqlite3_errmsg(db)));
-    }
-
-    sqlite3_bind_text(stmt, 1, barcode.c_str(), -1, SQLITE_STATIC);
-    int count = 0;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        count = sqlite3_column_int(stmt, 0);
-    }
-    sqlite3_finalize(stmt);
-
-    return count > 0;
-}
-
-
-std::string generate_random_barcode(int length = 12) {
-    static const char alphanum[] =
-        "0123456789"
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-
-    std::random_device rd;
-    std::mt19937 generator(rd());
-    std::uniform_int_distribution<> distribution(0, sizeof(alphanum) - 2);
-
-    std::string result;
-    for (int i = 0; i < length; ++i) {
-        result += alphanum[distribution(generator)];
-    }
-    return result;
-}
-
-
-std::string generate_unique_barcode() {
-    sqlite3* db;
-    if (sqlite3_open("products.db", &db) != SQLITE_OK) {
-        throw std::runtime_error("Error opening database: " + std::string(sqlite3_errmsg(db)));
-    }
-
-
-    ensure_table_structure(db);
-
-
-    std::set<std::string> generated_codes;
-    std::string barcode;
-    bool is_unique = false;
-    int attempts = 0;
-    const int max_attempts = 100;
-
-    while (!is_unique && attempts < max_attempts) {
-        barcode = generate_random_barcode();
-
-
-        if (generated_codes.find(barcode) != generated_codes.end()) {
-            attempts++;
-            continue;
-        }
-
-        generated_codes.insert(barcode);
-        if (!barcode_exists(db, barcode)) {
-            is_unique = true;
-        }
-        attempts++;
-    }
-
-    sqlite3_close(db);
-
-    if (!is_unique) {
-        throw std::runtime_error("Failed to generate unique barcode after " + std::to_string(max_attempts) + " attempts");
-    }
-
-    return barcode;
-}
-
-void add_to_database(const std::string& barcode) {
-    sqlite3* db;
+// Asks for the product and inserts it under a newly generated barcode.
+std::string add_to_database() {
     std::string name;
     std::string cost;
 
@@ -181,142 +45,44 @@ void add_to_database(const std::string& barcode) {
     std::cout << "Enter product cost: ";
     std::cin >> cost;
 
-    if (sqlite3_open("products.db", &db) != SQLITE_OK) {
-        throw std::runtime_error("Error opening database: " + std::string(sqlite3_errmsg(db)));
-    }
-
-    ensure_table_structure(db);
-
-
-    std::string sql = "INSERT INTO products (barcode, product_name, price) VALUES (?, ?, ?);";
-    sqlite3_stmt* stmt;
-
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-        sqlite3_close(db);
-        throw std::runtime_error("Failed to prepare statement: " + std::string(sqlite3_errmsg(db)));
-    }
-
-    sqlite3_bind_text(stmt, 1, barcode.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, name.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_double(stmt, 3, std::stod(cost));
-
-    if (sqlite3_step(stmt) != SQLITE_DONE) {
-        std::string error = "Insert failed: " + std::string(sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
-        throw std::runtime_error(error);
-    }
-
-    int id = sqlite3_last_insert_rowid(db);
+    std::string unique_barcode;
+    int id = DbSession::for_this_thread().create_product(name, std::stod(cost), unique_barcode);
+    std::cout << "Generated unique barcode: " << unique_barcode << std::endl;
     std::cout << "Product added successfully! ID: " << id << std::endl;
-
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    return unique_barcode;
 }
 
 int generate() {
     std::string unique_barcode;
     try {
-        unique_barcode = generate_unique_barcode();
-        std::cout << "Generated unique barcode: " << unique_barcode << std::endl;
+        unique_barcode = add_to_database();
     } catch (const std::runtime_error& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
-        return 1;
-    }
-
-    zint_symbol *barcode = ZBarcode_Create();
-    if (!barcode) {
-        fprintf(stderr, "Creation error Zint\n");
+        std::cerr << "Database error: " << e.what() << std::endl;
         return 1;
     }
 
-    barcode->symbology = BARCODE_CODE128;
-    barcode->height = 50;
-    barcode->scale = 2.0;
-
     try {
-        add_to_database(unique_barcode);
-        std::string file = "test_barcodes/" + unique_barcode + "_barcode.png";
-    	if (file.size() >= sizeof(barcode->outfile)) {
-            fprintf(stderr, "File path too long\n");
-            ZBarcode_Delete(barcode);
-            return 1;
-        }
-        strcpy(barcode->outfile, file.c_str());
-
-        if (ZBarcode_Encode(barcode, (unsigned char*)unique_barcode.c_str(), 0) != 0) {
-           fprintf(stderr, "Error: %s\n", barcode->errtxt);
-            ZBarcode_Delete(barcode);
-            return 1;
-        }
-
-        if (ZBarcode_Print(barcode, 0) != 0) {
-            fprintf(stderr, "Error of save: %s\n", barcode->errtxt);
-            ZBarcode_Delete(barcode);
-            return 1;
-        }
-
-        printf("Barcode successfully saved to %s\n", barcode->outfile);
-        }
-    catch (const std::runtime_error& e) {
-        std::cerr << "Database error: " << e.what() << std::endl;
-        ZBarcode_Delete(barcode);
-            return 1;
+        std::string file = label_path(unique_barcode);
+        LabelRenderer().save(unique_barcode, file);
+        printf("Barcode successfully saved to %s\n", file.c_str());
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
     }
-
-    ZBarcode_Delete(barcode);
     return 0;
 }
 
 
 
 // scanner
-// Real Barcode Recognition Function Using ZBar
-std::string barcode_reader(const char* filename) {
-    int width, height, channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-
-    if (!image) {
-        std::cerr << "Error loading image: " << filename << std::endl;
-        return "";
-    }
-
-
-    unsigned char* gray_image = nullptr;
-    if (channels == 1) {
-        gray_image = image;
-    }
-    else {
-        gray_image = new unsigned char[width * height];
-        for (int i = 0; i < width * height; ++i) {
-            unsigned char r = image[i * channels];
-            unsigned char g = image[i * channels + 1];
-            unsigned char b = image[i * channels + 2];
-            gray_image[i] = static_cast<unsigned char>(0.299 * r + 0.587 * g + 0.114 * b);
-        }
-    }
-
-
-    zbar::ImageScanner scanner;
-    scanner.set_config(zbar::ZBAR_NONE, zbar::ZBAR_CFG_ENABLE, 1);
-
-
-    zbar::Image zimg(width, height, "Y800", gray_image, width * height);
-
-
-    std::string result;
-    if (scanner.scan(zimg) > 0) {
-
-        zbar::Image::SymbolIterator symbol = zimg.symbol_begin();
-        result = symbol->get_data();
-    }
-
-    if (channels != 1) {
-        delete[] gray_image;
+static void print_product(const std::string& barcode, const Product* product) {
+    if (product) {
+        std::cout << "Product ID: " << product->id << "\n"
+                  << "Name: " << product->name << "\n"
+                  << "Price: $" << std::fixed << std::setprecision(2) << product->price << std::endl;
+    } else {
+        std::cout << "Product not found for barcode: " << barcode << std::endl;
     }
-    stbi_image_free(image);
-
-    return result;
 }
 
 int scan() {
@@ -324,72 +90,296 @@ int scan() {
     std::cout << "Enter file name: ";
     std::cin >> file;
 
-    std::string barcode = barcode_reader(file.c_str());
+    const std::vector<ScannedSymbol>& symbols = barcode_symbols(ScanContext::for_this_thread(), file.c_str());
 
-    if (barcode.empty()) {
+    if (symbols.empty()) {
         std::cerr << "Barcode not found or error occurred" << std::endl;
         return 1;
     }
 
-    std::cout << "Recognized barcode: " << barcode << std::endl;
-
-    sqlite3* db;
-    sqlite3_stmt* stmt;
+    // every symbol in the image is resolved by the same query
+    std::vector<std::string> barcodes;
+    for (const ScannedSymbol& symbol : symbols) {
+        barcodes.push_back(symbol.data);
+    }
 
-    if (sqlite3_open("products.db", &db) != SQLITE_OK) {
-        std::cerr << "Database error: " << sqlite3_errmsg(db) << std::endl;
+    std::unordered_map<std::string, Product> products;
+    try {
+        products = DbSession::for_this_thread().lookup(barcodes);
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Database error: " << e.what() << std::endl;
         return 1;
     }
 
-    std::string sql = "SELECT id, product_name, price FROM products WHERE barcode = ?";
-
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "SQL error: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_close(db);
-        return 1;
+    if (symbols.size() > 1) {
+        std::cout << "Found " << symbols.size() << " barcodes" << std::endl;
     }
 
-    sqlite3_bind_text(stmt, 1, barcode.c_str(), -1, SQLITE_STATIC);
+    for (const ScannedSymbol& symbol : symbols) {
+        std::cout << "Recognized barcode: " << symbol.data;
+        if (symbols.size() > 1) {
+            std::cout << " (" << symbol.type_name << ", quality " << symbol.quality;
+            if (!symbol.polygon.empty()) {
+                std::cout << ", at";
+                for (const ScanPoint& point : symbol.polygon) {
+                    std::cout << " " << point.x << "," << point.y;
+                }
+            }
+            std::cout << ")";
+        }
+        std::cout << std::endl;
+        if (ScanContext::for_this_thread().pyramid_levels() > 0) {
+            std::cout << "Pyramid level: " << symbol.level << std::endl;
+        }
+
+        auto it = products.find(symbol.data);
+        print_product(symbol.data, it != products.end() ? &it->second : nullptr);
+    }
 
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
+    return 0;
+}
 
-       int id = sqlite3_column_int(stmt, 0);
-       const unsigned char* productName = sqlite3_column_text(stmt, 1);
-       double price = sqlite3_column_double(stmt, 2);
 
+// Sends every path read from stdin to a running barcode_scand.
+int daemon_client(const std::string& socket_path, bool send_image) {
+    try {
+        ScanClient client(socket_path);
+        std::vector<unsigned char> image;
+        std::string file;
+        int status = 0;
+
+        while (std::getline(std::cin, file)) {
+            if (file.empty()) {
+                continue;
+            }
 
-       std::string nameStr(reinterpret_cast<const char*>(productName));
+            ScanReply reply;
+            if (send_image) {
+                std::ifstream in(file, std::ios::binary);
+                if (!in) {
+                    std::cerr << "Error loading image: " << file << std::endl;
+                    status = 1;
+                    continue;
+                }
+                image.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+                reply = client.scan_image(image.data(), image.size());
+            } else {
+                reply = client.scan_path(file);
+            }
 
+            std::cout << "File: " << file << std::endl;
+            if (reply.status != ScanStatus::Ok) {
+                std::cerr << (reply.status == ScanStatus::Error ? reply.error : "Barcode not found or error occurred") << std::endl;
+                status = 1;
+                continue;
+            }
 
-       std::cout << "Product ID: " << id << "\n"
-                 << "Name: " << nameStr << "\n"
-                 << "Price: $" << std::fixed << std::setprecision(2) << price << std::endl;
-    } else {
-       std::cout << "Product not found for barcode: " << barcode << std::endl;
+            for (const ScanReplySymbol& symbol : reply.symbols) {
+                std::cout << "Recognized barcode: " << symbol.data;
+                if (reply.symbols.size() > 1) {
+                    std::cout << " (" << symbol.type << ", quality " << symbol.quality << ", at " << symbol.x << "," << symbol.y
+                              << " " << symbol.width << "x" << symbol.height << ")";
+                }
+                std::cout << std::endl;
+                print_product(symbol.data, symbol.found ? &symbol.product : nullptr);
+            }
+        }
+        return status;
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
     }
+}
 
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
-    return 0;
+
+// catalog
+int convert_catalog_layout(CatalogLayout layout) {
+    try {
+        DbSession session;
+        convert_catalog(session.handle(), layout);
+        std::cout << "products.db now uses the " << (layout == CatalogLayout::Compact ? "compact" : "text") << " layout" << std::endl;
+        return 0;
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
 }
 
 
-int main() {
-    std::string choice;
-    std::cout << "Choice a function generate/scanner (Enter a name of function):";
-    std::cin >> choice;
+static void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [--profile NAME] [--pyramid 0-3] [--bar-width PX] [--max-megapixels MP] [--decode-cache MB] [--db-profile NAME] [--barcode-seed N] [--metrics PREFIX]\n"
+              << "       " << program << " --daemon-client [--socket PATH] [--send-image]   (image paths on stdin)\n"
+              << "       " << program << " --convert-catalog compact|text [--db-profile NAME]\n"
+              << "       " << program << " --batch DIR|GLOB|LIST|- [--format jsonl|csv] [--order input|completion] [--jobs N] [--profile NAME] [--pyramid 0-3] [--bar-width PX] [--max-megapixels MP] [--decode-cache MB] [--metrics PREFIX]\n"
+              << "       " << program << " --generate CSV|JSONL|- [--format jsonl|csv] [--batch-size N] [--jobs N] [--output-dir DIR] [--db-profile NAME] [--barcode-seed N] [--metrics PREFIX]\n"
+              << "Scan profiles: " << scan_profile_names() << "\n"
+              << "Database profiles: " << db_profile_names() << std::endl;
+}
 
-    if (choice == "generate") {
-	generate();
+int main(int argc, char* argv[]) {
+    BatchOptions batch;
+    BulkOptions bulk;
+    bool use_daemon = false;
+    bool send_image = false;
+    std::string convert_to;
+    std::string socket_path = kDefaultScanSocket;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--profile" && has_value) {
+            const ScanProfile* profile = find_scan_profile(argv[++i]);
+            if (!profile) {
+                std::cerr << "Unknown scan profile: " << argv[i] << " (available: " << scan_profile_names() << ")" << std::endl;
+                return 1;
+            }
+            ScanContext::for_this_thread().set_profile(*profile);
+            batch.profile = profile;
+        }
+        else if (arg == "--batch" && has_value) {
+            batch.input = argv[++i];
+        }
+        else if (arg == "--format" && has_value) {
+            std::string format = argv[++i];
+            if (format != "jsonl" && format != "csv") {
+                usage(argv[0]);
+                return 1;
+            }
+            batch.format = format == "csv" ? BatchFormat::Csv : BatchFormat::Jsonl;
+            bulk.format = batch.format;
+        }
+        else if (arg == "--order" && has_value) {
+            std::string order = argv[++i];
+            if (order != "input" && order != "completion") {
+                usage(argv[0]);
+                return 1;
+            }
+            batch.order = order == "completion" ? BatchOrder::Completion : BatchOrder::Input;
+        }
+        else if (arg == "--pyramid" && has_value) {
+            int levels = std::atoi(argv[++i]);
+            if (levels < 0 || levels > kMaxPyramidLevels) {
+                usage(argv[0]);
+                return 1;
+            }
+            ScanContext::for_this_thread().set_pyramid_levels(levels);
+            batch.pyramid_levels = levels;
+        }
+        else if (arg == "--bar-width" && has_value) {
+            int pixels = std::atoi(argv[++i]);
+            if (pixels < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            ScanContext::for_this_thread().set_bar_width(pixels);
+            batch.bar_width = pixels;
+        }
+        else if (arg == "--max-megapixels" && has_value) {
+            double megapixels = std::atof(argv[++i]);
+            if (megapixels <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            size_t pixels = static_cast<size_t>(megapixels * 1e6);
+            ScanContext::for_this_thread().set_pixel_budget(pixels);
+            batch.pixel_budget = pixels;
+        }
+        else if (arg == "--decode-cache" && has_value) {
+            double megabytes = std::atof(argv[++i]);
+            if (megabytes <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            batch.decode_cache_bytes = static_cast<size_t>(megabytes * 1048576);
+        }
+        else if (arg == "--db-profile" && has_value) {
+            const DbProfile* profile = find_db_profile(argv[++i]);
+            if (!profile) {
+                std::cerr << "Unknown database profile: " << argv[i] << " (available: " << db_profile_names() << ")" << std::endl;
+                return 1;
+            }
+            set_default_db_profile(*profile);
+        }
+        else if (arg == "--metrics" && has_value) {
+            enable_metrics_dump(argv[++i]);
+        }
+        else if (arg == "--daemon-client") {
+            use_daemon = true;
+        }
+        else if (arg == "--socket" && has_value) {
+            socket_path = argv[++i];
+        }
+        else if (arg == "--send-image") {
+            send_image = true;
+        }
+        else if (arg == "--barcode-seed" && has_value) {
+            set_barcode_seed(std::strtoull(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--convert-catalog" && has_value) {
+            convert_to = argv[++i];
+            if (convert_to != "compact" && convert_to != "text") {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--jobs" && has_value) {
+            batch.jobs = static_cast<unsigned>(std::max(0, std::atoi(argv[++i])));
+            bulk.jobs = batch.jobs;
+        }
+        else if (arg == "--generate" && has_value) {
+            bulk.input = argv[++i];
+        }
+        else if (arg == "--batch-size" && has_value) {
+            bulk.batch_rows = static_cast<size_t>(std::max(1, std::atoi(argv[++i])));
+        }
+        else if (arg == "--output-dir" && has_value) {
+            bulk.output_dir = argv[++i];
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!convert_to.empty()) {
+        return convert_catalog_layout(convert_to == "compact" ? CatalogLayout::Compact : CatalogLayout::Text);
+    }
+    if (!bulk.input.empty()) {
+        return run_bulk_generate(bulk, std::cout, std::cerr);
+    }
+    if (!batch.input.empty()) {
+        return run_batch_scan(batch, std::cout, std::cerr);
+    }
+    if (use_daemon) {
+        return daemon_client(socket_path, send_image);
     }
 
-    else if (choice == "scanner") {
-	scan();
+    if (batch.decode_cache_bytes > 0) {
+        try {
+            ScanContext::for_this_thread().open_decode_cache(decode_cache_path("products.db"), batch.decode_cache_bytes);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
     }
 
-    else {
-	std::cout << "Please enter a correct name of function" << std::endl;
-	main();
+    std::string choice;
+    while (true) {
+        std::cout << "Choice a function generate/scanner (Enter a name of function):";
+        if (!(std::cin >> choice)) {
+            return 1;
+        }
+
+        if (choice == "generate") {
+            generate();
+            break;
+        }
+        else if (choice == "scanner") {
+            scan();
+            break;
+        }
+
+        std::cout << "Please enter a correct name of function" << std::endl;
     }
 
     return 0;
@@ -0,0 +1,289 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include <pthread.h>
+#include <signal.h>
+
+static const int kStages = static_cast<int>(Stage::Count);
+static const int kCounters = static_cast<int>(Counter::Count);
+
+// Log-linear buckets: values below 16 ns are exact, every power of two above
+// is split into 16 linear sub-buckets. Values from 2^41 ns (~37 min) on share
+// the last bucket.
+static const int kSubBits = 4;
+static const int kSubBuckets = 1 << kSubBits;
+static const int kMaxExponent = 40;
+static const int kBuckets = (kMaxExponent - kSubBits + 2) * kSubBuckets;
+
+static int bucket_index(uint64_t value) {
+    if (value < static_cast<uint64_t>(kSubBuckets)) {
+        return static_cast<int>(value);
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent > kMaxExponent) {
+        return kBuckets - 1;
+    }
+    int shift = exponent - kSubBits;
+    return (shift + 1) * kSubBuckets + static_cast<int>((value >> shift) & (kSubBuckets - 1));
+}
+
+// Highest value that falls into bucket `index`.
+static uint64_t bucket_upper(int index) {
+    if (index < kSubBuckets) {
+        return static_cast<uint64_t>(index);
+    }
+    int shift = index / kSubBuckets - 1;
+    uint64_t lower = static_cast<uint64_t>(kSubBuckets + index % kSubBuckets) << shift;
+    return lower + (uint64_t(1) << shift) - 1;
+}
+
+// One per recording thread. Only the owner writes, so increments are a
+// relaxed load and store; readers merge whatever has been published.
+struct ThreadHistograms {
+    std::atomic<uint64_t> buckets[kStages][kBuckets];
+    std::atomic<uint64_t> count[kStages];
+    std::atomic<uint64_t> sum[kStages];
+    std::atomic<uint64_t> max[kStages];
+    std::atomic<uint64_t> events[kCounters];
+};
+
+static void bump(std::atomic<uint64_t>& counter, uint64_t amount) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+// Histograms outlive their threads so short-lived workers still count.
+struct HistogramRegistry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadHistograms>> threads;
+};
+
+static HistogramRegistry& registry() {
+    static HistogramRegistry instance;
+    return instance;
+}
+
+static ThreadHistograms& this_thread_histograms() {
+    static thread_local ThreadHistograms* histograms = nullptr;
+    if (!histograms) {
+        HistogramRegistry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.threads.emplace_back(new ThreadHistograms());
+        histograms = reg.threads.back().get();
+    }
+    return *histograms;
+}
+
+const char* stage_name(Stage stage) {
+    static const char* const names[kStages] = {
+        "file_read", "image_load", "jpeg_decode", "png_decode", "gray", "zbar_scan", "db_open", "db_prepare", "db_step", "zint_encode", "zint_print",
+        "zint_buffer", "code128_render", "code128_fast_hit", "code128_fast_miss",
+        "content_hash", "decode_cache_lookup",
+    };
+    return names[static_cast<int>(stage)];
+}
+
+const char* counter_name(Counter counter) {
+    static const char* const names[kCounters] = {
+        "image_downscaled", "image_rejected", "decode_cache_hit", "decode_cache_miss", "decode_cache_evicted",
+        "product_filter_skipped",
+    };
+    return names[static_cast<int>(counter)];
+}
+
+void count_event(Counter counter, uint64_t amount) {
+    bump(this_thread_histograms().events[static_cast<int>(counter)], amount);
+}
+
+void record_stage(Stage stage, uint64_t nanoseconds) {
+    ThreadHistograms& h = this_thread_histograms();
+    int s = static_cast<int>(stage);
+    bump(h.buckets[s][bucket_index(nanoseconds)], 1);
+    bump(h.count[s], 1);
+    bump(h.sum[s], nanoseconds);
+    if (nanoseconds > h.max[s].load(std::memory_order_relaxed)) {
+        h.max[s].store(nanoseconds, std::memory_order_relaxed);
+    }
+}
+
+std::vector<StageSummary> stage_summaries() {
+    std::vector<uint64_t> merged(static_cast<size_t>(kStages) * kBuckets, 0);
+    std::vector<StageSummary> summaries(kStages);
+    for (int s = 0; s < kStages; ++s) {
+        summaries[s] = {static_cast<Stage>(s), 0, 0, 0, 0, 0, 0};
+    }
+
+    {
+        HistogramRegistry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (const auto& h : reg.threads) {
+            for (int s = 0; s < kStages; ++s) {
+                for (int b = 0; b < kBuckets; ++b) {
+                    merged[static_cast<size_t>(s) * kBuckets + b] += h->buckets[s][b].load(std::memory_order_relaxed);
+                }
+                summaries[s].sum += h->sum[s].load(std::memory_order_relaxed);
+                summaries[s].max = std::max(summaries[s].max, h->max[s].load(std::memory_order_relaxed));
+            }
+        }
+    }
+
+    // The count comes from the merged buckets so the quantiles stay consistent
+    // with it even while other threads keep recording.
+    for (int s = 0; s < kStages; ++s) {
+        StageSummary& summary = summaries[s];
+        const uint64_t* buckets = &merged[static_cast<size_t>(s) * kBuckets];
+        for (int b = 0; b < kBuckets; ++b) {
+            summary.count += buckets[b];
+        }
+        if (summary.count == 0) {
+            continue;
+        }
+
+        const double quantiles[3] = {0.50, 0.90, 0.99};
+        uint64_t* targets[3] = {&summary.p50, &summary.p90, &summary.p99};
+        uint64_t seen = 0;
+        int q = 0;
+        for (int b = 0; b < kBuckets && q < 3; ++b) {
+            seen += buckets[b];
+            while (q < 3 && seen >= static_cast<uint64_t>(quantiles[q] * summary.count + 0.5) && seen > 0) {
+                *targets[q++] = std::min(bucket_upper(b), summary.max);
+            }
+        }
+    }
+    return summaries;
+}
+
+std::vector<uint64_t> counter_totals() {
+    std::vector<uint64_t> totals(kCounters, 0);
+    HistogramRegistry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (const auto& h : reg.threads) {
+        for (int c = 0; c < kCounters; ++c) {
+            totals[c] += h->events[c].load(std::memory_order_relaxed);
+        }
+    }
+    return totals;
+}
+
+
+// export
+static void write_file_atomically(const std::string& path, const std::string& text) {
+    std::string temporary = path + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "w");
+    if (!file) {
+        throw std::runtime_error("Cannot write metrics file: " + temporary);
+    }
+    bool ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        throw std::runtime_error("Cannot write metrics file: " + path);
+    }
+}
+
+static std::string format_number(const char* format, double value) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), format, value);
+    return buf;
+}
+
+void write_metrics(const std::string& prefix) {
+    std::vector<StageSummary> summaries = stage_summaries();
+
+    std::string json = "{\"unit\":\"us\",\"stages\":{";
+    bool first = true;
+    for (const StageSummary& s : summaries) {
+        if (s.count == 0) {
+            continue;
+        }
+        json += first ? "" : ",";
+        first = false;
+        json += std::string("\"") + stage_name(s.stage) + "\":{\"count\":" + std::to_string(s.count)
+              + ",\"mean\":" + format_number("%.3f", s.sum / 1e3 / s.count)
+              + ",\"p50\":" + format_number("%.3f", s.p50 / 1e3)
+              + ",\"p90\":" + format_number("%.3f", s.p90 / 1e3)
+              + ",\"p99\":" + format_number("%.3f", s.p99 / 1e3)
+              + ",\"max\":" + format_number("%.3f", s.max / 1e3) + "}";
+    }
+    std::vector<uint64_t> counters = counter_totals();
+    json += "},\"counters\":{";
+    for (int c = 0; c < kCounters; ++c) {
+        json += std::string(c ? "," : "") + "\"" + counter_name(static_cast<Counter>(c)) + "\":" + std::to_string(counters[c]);
+    }
+    json += "}}\n";
+
+    std::string prom =
+        "# HELP barcode_stage_duration_seconds Duration of barcode scanner pipeline stages.\n"
+        "# TYPE barcode_stage_duration_seconds summary\n";
+    std::string prom_max =
+        "# HELP barcode_stage_duration_max_seconds Longest duration seen per stage.\n"
+        "# TYPE barcode_stage_duration_max_seconds gauge\n";
+    for (const StageSummary& s : summaries) {
+        if (s.count == 0) {
+            continue;
+        }
+        std::string label = std::string("stage=\"") + stage_name(s.stage) + "\"";
+        const std::pair<const char*, uint64_t> quantiles[3] = {{"0.5", s.p50}, {"0.9", s.p90}, {"0.99", s.p99}};
+        for (const auto& q : quantiles) {
+            prom += "barcode_stage_duration_seconds{" + label + ",quantile=\"" + q.first + "\"} " + format_number("%.9f", q.second / 1e9) + "\n";
+        }
+        prom += "barcode_stage_duration_seconds_sum{" + label + "} " + format_number("%.9f", s.sum / 1e9) + "\n";
+        prom += "barcode_stage_duration_seconds_count{" + label + "} " + std::to_string(s.count) + "\n";
+        prom_max += "barcode_stage_duration_max_seconds{" + label + "} " + format_number("%.9f", s.max / 1e9) + "\n";
+    }
+
+    std::string prom_events =
+        "# HELP barcode_events_total Events counted by the barcode scanner pipeline.\n"
+        "# TYPE barcode_events_total counter\n";
+    for (int c = 0; c < kCounters; ++c) {
+        prom_events += std::string("barcode_events_total{event=\"") + counter_name(static_cast<Counter>(c)) + "\"} " + std::to_string(counters[c]) + "\n";
+    }
+
+    write_file_atomically(prefix + ".json", json);
+    write_file_atomically(prefix + ".prom", prom + prom_max + prom_events);
+}
+
+
+// dumping
+static std::string dump_prefix;
+
+static void dump_metrics() {
+    try {
+        write_metrics(dump_prefix);
+    } catch (const std::runtime_error& e) {
+        fprintf(stderr, "%s\n", e.what());
+    }
+}
+
+void enable_metrics_dump(const std::string& prefix) {
+    bool first = dump_prefix.empty();
+    dump_prefix = prefix;
+    if (!first) {
+        return;
+    }
+
+    // The registry is created before the handler is registered, so it is
+    // still alive when the handler runs at exit.
+    registry();
+    std::atexit(dump_metrics);
+
+    // SIGUSR1 is taken by sigwait() on a helper thread; file I/O is not
+    // allowed in a signal handler.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    std::thread([signals]() {
+        int signal_number;
+        while (sigwait(&signals, &signal_number) == 0) {
+            dump_metrics();
+        }
+    }).detach();
+}
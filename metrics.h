@@ -0,0 +1,110 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Pipeline stages that are timed on every call.
+enum class Stage {
+    FileRead,       // reading the image file into memory
+    ImageLoad,      // stbi_load_from_memory
+    JpegDecode,     // JpegGrayDecoder, luma only
+    PngDecode,      // PngGrayDecoder, row by row
+    Gray,           // convert_to_gray
+    ZbarScan,       // zbar::ImageScanner::scan
+    DbOpen,         // sqlite3_open*
+    DbPrepare,      // sqlite3_prepare*
+    DbStep,         // sqlite3_step
+    ZintEncode,     // ZBarcode_Encode
+    ZintPrint,      // ZBarcode_Print
+    ZintBuffer,     // ZBarcode_Buffer
+    Code128Render,  // code128_render, in place of zint
+    Code128Hit,     // code128_decode calls that read the label
+    Code128Miss,    // code128_decode calls that fell back to zbar
+    ContentHash,    // xxh64 of an image file for the decode cache
+    CacheLookup,    // DecodeCache::find
+    Count
+};
+
+const char* stage_name(Stage stage);
+
+// Events that are counted rather than timed.
+enum class Counter {
+    ImageDownscaled,    // shrunk while decoding to fit the pixel budget
+    ImageRejected,      // over the pixel budget even at the smallest scale the bars allow
+    DecodeCacheHit,     // images answered from the decode cache
+    DecodeCacheMiss,    // images the decode cache did not have
+    DecodeCacheEvicted, // entries deleted to keep the decode cache under its size
+    ProductFilterSkipped, // barcode lookups the product filter answered without SQLite
+    Count
+};
+
+const char* counter_name(Counter counter);
+
+// Adds one sample to the calling thread's histogram for `stage`. Each thread
+// writes only its own log-linear (HDR-style, ~6% precision) buckets, so
+// recording takes no lock and no atomic read-modify-write.
+void record_stage(Stage stage, uint64_t nanoseconds);
+
+// Adds `amount` to the calling thread's total for `counter`, lock-free like record_stage().
+void count_event(Counter counter, uint64_t amount = 1);
+
+// Times the enclosing scope, or up to stop(), on the monotonic clock.
+class StageTimer {
+public:
+    explicit StageTimer(Stage stage) : stage_(stage), start_(std::chrono::steady_clock::now()) {}
+    ~StageTimer() { stop(); }
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    void stop() {
+        if (running_) {
+            running_ = false;
+            auto elapsed = std::chrono::steady_clock::now() - start_;
+            record_stage(stage_, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+        }
+    }
+
+private:
+    Stage stage_;
+    std::chrono::steady_clock::time_point start_;
+    bool running_ = true;
+};
+
+// Runs `call` under a StageTimer and returns its result, e.g.
+//   if (timed(Stage::DbStep, [&] { return sqlite3_step(stmt); }) == SQLITE_ROW)
+template <typename Call>
+auto timed(Stage stage, Call&& call) -> decltype(call()) {
+    StageTimer timer(stage);
+    return call();
+}
+
+// All threads merged; durations in nanoseconds.
+struct StageSummary {
+    Stage stage;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+};
+
+std::vector<StageSummary> stage_summaries();
+
+// All threads merged, indexed by Counter.
+std::vector<uint64_t> counter_totals();
+
+// Writes <prefix>.json and <prefix>.prom (Prometheus text format). Each file
+// is written next to its final name and renamed into place, so a collector
+// never reads a partial file.
+void write_metrics(const std::string& prefix);
+
+// Writes the metrics at exit and whenever the process gets SIGUSR1. Call it
+// before starting other threads: it blocks SIGUSR1 in the caller, and the
+// threads created afterwards inherit the mask.
+void enable_metrics_dump(const std::string& prefix);
+
+#endif // METRICS_H
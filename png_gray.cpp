@@ -0,0 +1,186 @@
+#include "png_gray.h"
+
+#include <png.h>
+
+#include <climits>
+#include <cstring>
+
+#include "gray_convert.h"
+
+// Encoded bytes libpng reads through png_read_memory().
+struct PngSource {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    size_t offset = 0;
+};
+
+// The read struct lives for one image: libpng has no way to rewind it.
+struct PngGrayDecoder::State {
+    png_structp png = nullptr;
+    png_infop info = nullptr;
+    PngSource source;
+    int width = 0;
+    int height = 0;
+    int channels = 0;           // bytes per pixel after the transforms
+    bool palette = false;
+    unsigned char luma[256];    // palette index -> luma
+    GrayShrinker shrinker;
+};
+
+static void png_read_memory(png_structp png, png_bytep out, png_size_t length) {
+    PngSource* source = static_cast<PngSource*>(png_get_io_ptr(png));
+    if (length > source->size - source->offset) {
+        png_error(png, "unexpected end of data");
+    }
+    std::memcpy(out, source->data + source->offset, length);
+    source->offset += length;
+}
+
+// Errors jump back into the call that failed; neither they nor warnings are
+// printed, the scan just finds nothing.
+static void png_quiet_error(png_structp png, png_const_charp) {
+    png_longjmp(png, 1);
+}
+
+static void png_quiet_warning(png_structp, png_const_charp) {
+}
+
+bool is_png(const unsigned char* data, size_t size) {
+    return size >= 8 && png_sig_cmp(data, 0, 8) == 0;
+}
+
+PngGrayDecoder::PngGrayDecoder() : state_(new State()) {
+}
+
+PngGrayDecoder::~PngGrayDecoder() {
+    abort();
+}
+
+void PngGrayDecoder::abort() {
+    if (state_->png) {
+        png_destroy_read_struct(&state_->png, &state_->info, nullptr);
+    }
+    state_->png = nullptr;
+    state_->info = nullptr;
+}
+
+bool PngGrayDecoder::start(const unsigned char* data, size_t size) {
+    abort();
+    State& s = *state_;
+    s.png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, png_quiet_error, png_quiet_warning);
+    s.info = s.png ? png_create_info_struct(s.png) : nullptr;
+    if (!s.info) {
+        abort();
+        return false;
+    }
+    if (setjmp(png_jmpbuf(s.png))) {
+        abort();
+        return false;
+    }
+
+    s.source = {data, size, 0};
+    png_set_read_fn(s.png, &s.source, png_read_memory);
+    png_read_info(s.png, s.info);
+
+    png_uint_32 width, height;
+    int depth, color, interlace;
+    png_get_IHDR(s.png, s.info, &width, &height, &depth, &color, &interlace, nullptr, nullptr);
+    if (interlace != PNG_INTERLACE_NONE || width > INT_MAX || height > INT_MAX) {
+        abort();
+        return false;
+    }
+    s.width = static_cast<int>(width);
+    s.height = static_cast<int>(height);
+    s.palette = false;
+
+    if (depth == 16) {
+        png_set_strip_16(s.png);
+    }
+    switch (color) {
+        case PNG_COLOR_TYPE_GRAY:
+            if (depth < 8) {
+                png_set_expand_gray_1_2_4_to_8(s.png);
+            }
+            s.channels = 1;
+            break;
+        case PNG_COLOR_TYPE_GRAY_ALPHA:
+            png_set_strip_alpha(s.png);
+            s.channels = 1;
+            break;
+        case PNG_COLOR_TYPE_PALETTE: {
+            // one index per byte, looked up in a table built with the same
+            // weights as convert_to_gray(); missing entries are black
+            if (depth < 8) {
+                png_set_packing(s.png);
+            }
+            png_colorp colors = nullptr;
+            int count = 0;
+            png_get_PLTE(s.png, s.info, &colors, &count);
+            unsigned char rgb[256 * 3] = {};
+            for (int i = 0; i < count && i < 256; ++i) {
+                rgb[3 * i] = colors[i].red;
+                rgb[3 * i + 1] = colors[i].green;
+                rgb[3 * i + 2] = colors[i].blue;
+            }
+            convert_to_gray(rgb, 3, 256, s.luma);
+            s.palette = true;
+            s.channels = 1;
+            break;
+        }
+        case PNG_COLOR_TYPE_RGB:
+            s.channels = 3;
+            break;
+        default:
+            s.channels = 4;
+            break;
+    }
+    png_read_update_info(s.png, s.info);
+    if (png_get_rowbytes(s.png, s.info) != width * static_cast<size_t>(s.channels)) {
+        abort();
+        return false;
+    }
+    if (row_.size() < width * static_cast<size_t>(s.channels)) {
+        row_.resize(width * static_cast<size_t>(s.channels));
+    }
+    return true;
+}
+
+int PngGrayDecoder::width() const {
+    return state_->width;
+}
+
+int PngGrayDecoder::height() const {
+    return state_->height;
+}
+
+bool PngGrayDecoder::read(unsigned char* gray, int factor) {
+    State& s = *state_;
+    if (setjmp(png_jmpbuf(s.png))) {
+        abort();
+        return false;
+    }
+
+    size_t width = static_cast<size_t>(s.width);
+    if (factor > 1) {
+        s.shrinker.start(s.width, s.channels, factor, gray);
+    }
+    for (int y = 0; y < s.height; ++y) {
+        // gray rows are decoded in place unless they are shrunk
+        unsigned char* out = factor > 1 || s.channels > 1 ? row_.data() : gray + y * width;
+        png_read_row(s.png, out, nullptr);
+        if (s.palette) {
+            for (size_t x = 0; x < width; ++x) {
+                out[x] = s.luma[out[x]];
+            }
+        }
+        if (factor > 1) {
+            s.shrinker.add_row(out);
+        }
+        else if (s.channels > 1) {
+            convert_to_gray(out, s.channels, width, gray + y * width);
+        }
+    }
+    // the trailing chunks hold nothing the scan needs
+    abort();
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef PNG_GRAY_H
+#define PNG_GRAY_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// True when `data` starts with the PNG signature.
+bool is_png(const unsigned char* data, size_t size);
+
+// libpng decoder that writes luma one row at a time, so the image never
+// exists in colour: gray images (1 to 16 bits) are expanded or stripped
+// straight into the destination row, palette images are read as indices
+// and mapped through a 256-entry luma table, and RGB(A) rows pass through
+// one row buffer and convert_to_gray(). Alpha is ignored, as stb_image's
+// path through convert_to_gray() does. Interlaced images are not handled.
+class PngGrayDecoder {
+public:
+    PngGrayDecoder();
+    ~PngGrayDecoder();
+    PngGrayDecoder(const PngGrayDecoder&) = delete;
+    PngGrayDecoder& operator=(const PngGrayDecoder&) = delete;
+
+    // Reads the header of an in-memory PNG and sets up the row transforms.
+    // Returns false for data it does not handle (corrupt, interlaced);
+    // nothing is left to clean up then.
+    bool start(const unsigned char* data, size_t size);
+
+    // Size of the image, valid after start().
+    int width() const;
+    int height() const;
+
+    // Decodes the rows into `gray`, width() bytes per row, and ends the
+    // image. With a `factor` above 1 the rows go through a GrayShrinker
+    // instead and `gray` gets (width() / factor) x (height() / factor)
+    // pixels. Returns false when the data turns out to be corrupt.
+    bool read(unsigned char* gray, int factor = 1);
+
+    // Ends the image without reading its rows.
+    void abort();
+
+private:
+    struct State;
+    std::unique_ptr<State> state_;
+    std::vector<unsigned char> row_;    // one row to convert or shrink, grow-only
+};
+
+#endif // PNG_GRAY_H
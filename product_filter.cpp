@@ -0,0 +1,404 @@
+#include "product_filter.h"
+
+#include <sqlite3.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include "barcode_key.h"
+#include "metrics.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define PRODUCT_FILTER_X86 1
+#include <immintrin.h>
+#endif
+
+// Odd multipliers, one per word of a block; the top 6 bits of the low hash
+// word times the salt pick the bit in that word.
+static const uint32_t kSalts[8] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+};
+
+// FNV-1a, then the murmur3 finalizer so every output bit depends on every
+// input byte. Barcodes are short, so this beats a block hash.
+static uint64_t barcode_hash(const std::string& barcode) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : barcode) {
+        h = (h ^ c) * 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+typedef bool (*probe_kernel)(const uint64_t* words, uint32_t hash);
+
+static bool probe_scalar(const uint64_t* words, uint32_t hash) {
+    for (int i = 0; i < 8; ++i) {
+        if (!(words[i] >> ((hash * kSalts[i]) >> 26) & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#ifdef PRODUCT_FILTER_X86
+
+#define PRODUCT_FILTER_AVX2 __attribute__((target("avx2")))
+
+// The eight bit numbers in one multiply and shift, widened to 64-bit shift
+// counts for the two halves of the block; testc is true when every bit of
+// the mask is set in the block.
+PRODUCT_FILTER_AVX2 static bool probe_avx2(const uint64_t* words, uint32_t hash) {
+    const __m256i salts = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(kSalts));
+    __m256i bits = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(static_cast<int>(hash)), salts), 26);
+    const __m256i one = _mm256_set1_epi64x(1);
+    __m256i low = _mm256_sllv_epi64(one, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(bits)));
+    __m256i high = _mm256_sllv_epi64(one, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(bits, 1)));
+    const __m256i* block = reinterpret_cast<const __m256i*>(words);
+    return _mm256_testc_si256(_mm256_load_si256(block), low) & _mm256_testc_si256(_mm256_load_si256(block + 1), high);
+}
+
+#endif // PRODUCT_FILTER_X86
+
+
+struct ProbeKernel {
+    const char* name;
+    probe_kernel probe;
+};
+
+static const ProbeKernel& probe_kernel_in_use() {
+    static const ProbeKernel kernel = []() {
+#ifdef PRODUCT_FILTER_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return ProbeKernel{"avx2", probe_avx2};
+        }
+#endif
+        return ProbeKernel{"scalar", probe_scalar};
+    }();
+    return kernel;
+}
+
+const char* product_filter_backend() {
+    return probe_kernel_in_use().name;
+}
+
+std::string product_filter_path(const std::string& database_path) {
+    return database_path + ".filter";
+}
+
+
+// Saved file: this header, then the blocks, in host byte order.
+struct FilterFileHeader {
+    char magic[8];
+    uint64_t catalog_key;
+    int64_t stamp;
+    int64_t last_id;
+    uint64_t last_hash;
+    uint64_t count;
+    uint64_t blocks;
+};
+
+static const char kFilterMagic[8] = {'B', 'C', 'F', 'I', 'L', 'T', '0', '2'};
+
+ProductFilter::ProductFilter(sqlite3* db, CatalogLayout layout, const std::string& path)
+    : db_(db), layout_(layout), path_(path) {
+    auto prepare = [this](const char* sql, sqlite3_stmt** stmt) {
+        if (timed(Stage::DbPrepare, [&] { return sqlite3_prepare_v3(db_, sql, -1, SQLITE_PREPARE_PERSISTENT, stmt, nullptr); }) != SQLITE_OK) {
+            throw std::runtime_error("SQL error: " + std::string(sqlite3_errmsg(db_)));
+        }
+    };
+
+    try {
+        prepare("PRAGMA data_version;", &version_);
+        prepare(layout_ == CatalogLayout::Compact
+                    ? "SELECT id, code FROM products WHERE id > ?;"
+                    : "SELECT id, barcode FROM products WHERE id > ?;",
+                &rows_);
+        prepare("SELECT stamp FROM products_changes WHERE id = 0;", &stamp_query_);
+        prepare(layout_ == CatalogLayout::Compact
+                    ? "SELECT code FROM products WHERE id = ?;"
+                    : "SELECT barcode FROM products WHERE id = ?;",
+                &last_row_);
+        prepare("BEGIN;", &begin_);
+        prepare("COMMIT;", &commit_);
+
+        // a catalog from before the allocator has no key; its files match
+        // each other, which only costs the check below
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db_, "SELECT permutation_key FROM barcode_allocator WHERE id = 0;", -1, &stmt, nullptr) == SQLITE_OK) {
+            if (sqlite3_step(stmt) == SQLITE_ROW) {
+                catalog_key_ = static_cast<uint64_t>(sqlite3_column_int64(stmt, 0));
+            }
+            sqlite3_finalize(stmt);
+        }
+
+        if (sqlite3_step(version_) == SQLITE_ROW) {
+            data_version_ = sqlite3_column_int64(version_, 0);
+        }
+        sqlite3_reset(version_);
+
+        if (load() && unchanged()) {
+            add_new_rows();
+        }
+        else {
+            size_t products = 0;
+            if (sqlite3_prepare_v2(db_, "SELECT count(*) FROM products;", -1, &stmt, nullptr) == SQLITE_OK) {
+                if (sqlite3_step(stmt) == SQLITE_ROW) {
+                    products = static_cast<size_t>(sqlite3_column_int64(stmt, 0));
+                }
+                sqlite3_finalize(stmt);
+            }
+            rebuild(products);
+        }
+        if (count_ * kBitsPerProduct > blocks_.size() * 512) {
+            rebuild(count_);
+        }
+    } catch (const std::runtime_error&) {
+        sqlite3_finalize(version_);
+        sqlite3_finalize(rows_);
+        sqlite3_finalize(stamp_query_);
+        sqlite3_finalize(last_row_);
+        sqlite3_finalize(begin_);
+        sqlite3_finalize(commit_);
+        throw;
+    }
+    if (changed_) {
+        save();
+    }
+}
+
+ProductFilter::~ProductFilter() {
+    if (changed_) {
+        save();
+    }
+    sqlite3_finalize(version_);
+    sqlite3_finalize(rows_);
+    sqlite3_finalize(stamp_query_);
+    sqlite3_finalize(last_row_);
+    sqlite3_finalize(begin_);
+    sqlite3_finalize(commit_);
+}
+
+ProductFilter::Snapshot::Snapshot(ProductFilter& filter) : filter_(filter) {
+    if (sqlite3_get_autocommit(filter_.db_)) {
+        int rc = sqlite3_step(filter_.begin_);
+        sqlite3_reset(filter_.begin_);
+        if (rc != SQLITE_DONE) {
+            throw std::runtime_error("Product filter transaction failed: " + std::string(sqlite3_errmsg(filter_.db_)));
+        }
+        began_ = true;
+    }
+    try {
+        filter_.refresh();
+    } catch (const std::runtime_error&) {
+        if (began_) {
+            sqlite3_step(filter_.commit_);
+            sqlite3_reset(filter_.commit_);
+        }
+        throw;
+    }
+}
+
+// A read transaction always commits.
+ProductFilter::Snapshot::~Snapshot() {
+    if (began_) {
+        sqlite3_step(filter_.commit_);
+        sqlite3_reset(filter_.commit_);
+    }
+}
+
+bool ProductFilter::may_contain(const std::string& barcode) const {
+    uint64_t h = barcode_hash(barcode);
+    const Block& block = blocks_[((h >> 32) * blocks_.size()) >> 32];
+    return probe_kernel_in_use().probe(block.words, static_cast<uint32_t>(h));
+}
+
+void ProductFilter::add(const std::string& barcode) {
+    uint64_t h = barcode_hash(barcode);
+    Block& block = blocks_[((h >> 32) * blocks_.size()) >> 32];
+    uint32_t hash = static_cast<uint32_t>(h);
+    for (int i = 0; i < 8; ++i) {
+        block.words[i] |= uint64_t(1) << ((hash * kSalts[i]) >> 26);
+    }
+    ++count_;
+    changed_ = true;
+}
+
+void ProductFilter::refresh() {
+    int rc = sqlite3_step(version_);
+    int64_t version = rc == SQLITE_ROW ? sqlite3_column_int64(version_, 0) : data_version_;
+    sqlite3_reset(version_);
+    if (rc != SQLITE_ROW) {
+        throw std::runtime_error("Product filter refresh failed: " + std::string(sqlite3_errmsg(db_)));
+    }
+    if (version == data_version_) {
+        return;
+    }
+    data_version_ = version;
+
+    if (!unchanged()) {
+        rebuild(count_);
+    }
+    else {
+        add_new_rows();
+    }
+    if (count_ * kBitsPerProduct > blocks_.size() * 512) {
+        rebuild(count_);
+    }
+}
+
+void ProductFilter::remove_absent(std::vector<std::string>& barcodes) {
+    auto kept = std::remove_if(barcodes.begin(), barcodes.end(), [this](const std::string& barcode) { return !may_contain(barcode); });
+    count_event(Counter::ProductFilterSkipped, static_cast<uint64_t>(barcodes.end() - kept));
+    barcodes.erase(kept, barcodes.end());
+}
+
+// The whole table in storage order: through the id index, a compact
+// catalog would look every row up by its code again.
+void ProductFilter::rebuild(size_t products) {
+    size_t capacity = std::max(products * 2, kMinProducts);
+    blocks_.assign((capacity * kBitsPerProduct + 511) / 512, Block());
+    count_ = 0;
+    last_id_ = INT64_MIN;
+    last_hash_ = 0;
+    changed_ = true;
+    // read first: a change during the scan shows as a newer stamp
+    stamp_ = stamp();
+
+    sqlite3_stmt* stmt;
+    const char* sql = layout_ == CatalogLayout::Compact ? "SELECT id, code FROM products;" : "SELECT id, barcode FROM products;";
+    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("SQL error: " + std::string(sqlite3_errmsg(db_)));
+    }
+    int rc = add_rows(stmt);
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        throw std::runtime_error("Product filter build failed: " + std::string(sqlite3_errmsg(db_)));
+    }
+}
+
+void ProductFilter::add_new_rows() {
+    sqlite3_bind_int64(rows_, 1, last_id_);
+    int rc = add_rows(rows_);
+    sqlite3_reset(rows_);
+    if (rc != SQLITE_DONE) {
+        throw std::runtime_error("Product filter update failed: " + std::string(sqlite3_errmsg(db_)));
+    }
+}
+
+int ProductFilter::add_rows(sqlite3_stmt* stmt) {
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        std::string barcode = row_barcode(stmt, 1);
+        add(barcode);
+        int64_t id = sqlite3_column_int64(stmt, 0);
+        if (id > last_id_) {
+            last_id_ = id;
+            last_hash_ = barcode_hash(barcode);
+        }
+    }
+    return rc;
+}
+
+std::string ProductFilter::row_barcode(sqlite3_stmt* stmt, int column) const {
+    if (layout_ == CatalogLayout::Compact) {
+        return unpack_barcode(sqlite3_column_int64(stmt, column));
+    }
+    const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, column));
+    return std::string(text ? text : "", static_cast<size_t>(sqlite3_column_bytes(stmt, column)));
+}
+
+int64_t ProductFilter::stamp() {
+    int rc = sqlite3_step(stamp_query_);
+    int64_t stamp = rc == SQLITE_ROW ? sqlite3_column_int64(stamp_query_, 0) : 0;
+    sqlite3_reset(stamp_query_);
+    if (rc != SQLITE_ROW) {
+        throw std::runtime_error("Product filter check failed: " + std::string(sqlite3_errmsg(db_)));
+    }
+    return stamp;
+}
+
+// Rows up to last_id_ are only trusted while products_changes shows no
+// changed barcode and no insert below the highest id since, and the row at
+// last_id_ still holds the barcode the filter saw there. The second check
+// catches a database file replaced by another copy of the same catalog.
+bool ProductFilter::unchanged() {
+    if (stamp() != stamp_) {
+        return false;
+    }
+    if (last_id_ == INT64_MIN) {
+        return true;
+    }
+    sqlite3_bind_int64(last_row_, 1, last_id_);
+    int rc = sqlite3_step(last_row_);
+    bool same = rc == SQLITE_ROW && barcode_hash(row_barcode(last_row_, 0)) == last_hash_;
+    sqlite3_reset(last_row_);
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+        throw std::runtime_error("Product filter check failed: " + std::string(sqlite3_errmsg(db_)));
+    }
+    return same;
+}
+
+bool ProductFilter::load() {
+    FILE* file = fopen(path_.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    FilterFileHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              std::memcmp(header.magic, kFilterMagic, sizeof(kFilterMagic)) == 0 &&
+              header.catalog_key == catalog_key_ &&
+              header.blocks > 0 && header.blocks <= (uint64_t(1) << 32);
+    if (ok) {
+        blocks_.resize(header.blocks);
+        ok = fread(blocks_.data(), sizeof(Block), blocks_.size(), file) == blocks_.size() && fgetc(file) == EOF;
+    }
+    fclose(file);
+    if (!ok) {
+        blocks_.clear();
+        return false;
+    }
+    stamp_ = header.stamp;
+    last_id_ = header.last_id;
+    last_hash_ = header.last_hash;
+    count_ = header.count;
+    changed_ = false;
+    return true;
+}
+
+// Written next to the file and renamed over it, so a reader never sees half
+// a filter and concurrent writers leave one whole file.
+bool ProductFilter::save() {
+    FilterFileHeader header;
+    std::memcpy(header.magic, kFilterMagic, sizeof(kFilterMagic));
+    header.catalog_key = catalog_key_;
+    header.stamp = stamp_;
+    header.last_id = last_id_;
+    header.last_hash = last_hash_;
+    header.count = count_;
+    header.blocks = blocks_.size();
+
+    std::string temporary = path_ + ".tmp" + std::to_string(getpid()) + "-" + std::to_string(reinterpret_cast<uintptr_t>(this));
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(blocks_.data(), sizeof(Block), blocks_.size(), file) == blocks_.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), path_.c_str()) != 0) {
+        remove(temporary.c_str());
+        return false;
+    }
+    changed_ = false;
+    return true;
+}
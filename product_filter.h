@@ -0,0 +1,124 @@
+#ifndef PRODUCT_FILTER_H
+#define PRODUCT_FILTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "schema_migrations.h"
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+// File the ProductFilter of the products database at `database_path` is
+// saved to: the same path with ".filter" appended.
+std::string product_filter_path(const std::string& database_path);
+
+// Probe in use: "avx2" or "scalar".
+const char* product_filter_backend();
+
+// Blocked Bloom filter over the barcodes of one connection's products table,
+// so a barcode that is not in the catalog is turned away without a b-tree
+// search. Each barcode sets one bit in each of the eight 64-bit words of a
+// single 64-byte block, so a probe reads one cache line; the filter is sized
+// at kBitsPerProduct bits per product for twice the catalog, which keeps
+// false positives well under 1%. There are no false negatives.
+//
+// The filter covers every product up to the highest id it has seen. Before
+// each use refresh() asks the connection (PRAGMA data_version) whether
+// another one has committed, and only then adds the products with higher
+// ids; add() covers inserts on this connection. That question starts a read
+// transaction, which costs about what the b-tree search saves, so a
+// Snapshot keeps that transaction open for the lookup that follows. Ids
+// only grow: neither layout hands out the id of a deleted product again.
+// Anything else that could hide a product from the filter (an UPDATE of a
+// barcode or id, an insert below the highest id) changes the stamp in
+// products_changes, and the filter is rebuilt. So is a filter whose last
+// row no longer holds the barcode it saw, as after the database file was
+// replaced.
+//
+// The bits are saved to `path` after they are built and when the filter is
+// destroyed with products added, so the next process loads them and reads
+// only the newer rows. A file of another catalog (by its barcode allocator
+// key), that fails those checks or that does not parse is ignored.
+// Failing to read the table throws std::runtime_error; failing to save does
+// not.
+class ProductFilter {
+public:
+    static const int kBitsPerProduct = 16;
+    static const size_t kMinProducts = 4096;
+
+    ProductFilter(sqlite3* db, CatalogLayout layout, const std::string& path);
+    ~ProductFilter();
+    ProductFilter(const ProductFilter&) = delete;
+    ProductFilter& operator=(const ProductFilter&) = delete;
+
+    // Read transaction from a refresh() through the lookup that follows,
+    // so both see one snapshot and take the locks once. Only refreshes when
+    // the connection is already in a transaction.
+    class Snapshot {
+    public:
+        explicit Snapshot(ProductFilter& filter);
+        ~Snapshot();
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+    private:
+        ProductFilter& filter_;
+        bool began_ = false;
+    };
+
+    // False when `barcode` is certainly not in the catalog as of the last
+    // refresh().
+    bool may_contain(const std::string& barcode) const;
+
+    void add(const std::string& barcode);
+
+    // Catches up with products other connections added.
+    void refresh();
+
+    // Drops the barcodes the catalog cannot have from `barcodes`, counting
+    // them as Counter::ProductFilterSkipped.
+    void remove_absent(std::vector<std::string>& barcodes);
+
+    // Products added since the filter was sized, an upper bound, and the
+    // memory its bits take.
+    size_t products() const { return count_; }
+    size_t size_bytes() const { return blocks_.size() * sizeof(Block); }
+
+    bool save();
+
+private:
+    struct alignas(64) Block {
+        uint64_t words[8];
+    };
+
+    bool load();
+    void rebuild(size_t products);
+    void add_new_rows();
+    int add_rows(sqlite3_stmt* stmt);
+    std::string row_barcode(sqlite3_stmt* stmt, int column) const;
+    int64_t stamp();
+    bool unchanged();
+
+    sqlite3* db_;
+    CatalogLayout layout_;
+    std::string path_;
+    sqlite3_stmt* version_ = nullptr;
+    sqlite3_stmt* rows_ = nullptr;
+    sqlite3_stmt* stamp_query_ = nullptr;
+    sqlite3_stmt* last_row_ = nullptr;
+    sqlite3_stmt* begin_ = nullptr;
+    sqlite3_stmt* commit_ = nullptr;
+    int64_t data_version_ = 0;
+    uint64_t catalog_key_ = 0;
+    int64_t stamp_ = 0;             // products_changes.stamp the rows were read at
+    int64_t last_id_ = INT64_MIN;   // highest id added from the table
+    uint64_t last_hash_ = 0;        // barcode_hash() of the product there
+    size_t count_ = 0;
+    bool changed_ = false;          // added to since loaded or saved
+    std::vector<Block> blocks_;
+};
+
+#endif // PRODUCT_FILTER_H
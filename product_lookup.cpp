@@ -0,0 +1,92 @@
+#include "product_lookup.h"
+
+#include "barcode_key.h"
+#include "metrics.h"
+
+#include <sqlite3.h>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_set>
+
+std::string lookup_products_sql(CatalogLayout layout, size_t count) {
+    std::string sql = layout == CatalogLayout::Compact
+        ? "SELECT code, id, product_name, price_cents FROM products WHERE code IN ("
+        : "SELECT barcode, id, product_name, price_cents FROM products WHERE barcode IN (";
+    for (size_t i = 0; i < count; ++i) {
+        sql += i == 0 ? "?" : ",?";
+    }
+    sql += ");";
+    return sql;
+}
+
+std::vector<std::string> unique_barcodes(const std::vector<std::string>& codes) {
+    // a label photographed twice in one image is looked up once
+    std::vector<std::string> barcodes;
+    std::unordered_set<std::string> seen;
+    for (const std::string& code : codes) {
+        if (seen.insert(code).second) {
+            barcodes.push_back(code);
+        }
+    }
+    return barcodes;
+}
+
+void collect_products(sqlite3_stmt* stmt, CatalogLayout layout, const std::string* barcodes, size_t count,
+                      std::unordered_map<std::string, Product>& found) {
+    for (size_t i = 0; i < count; ++i) {
+        int index = static_cast<int>(i + 1);
+        int64_t key;
+        if (layout == CatalogLayout::Text) {
+            sqlite3_bind_text(stmt, index, barcodes[i].c_str(), -1, SQLITE_STATIC);
+        }
+        else if (pack_barcode(barcodes[i], key)) {
+            sqlite3_bind_int64(stmt, index, key);
+        }
+        else {
+            // cannot be in a compact catalog; NULL matches nothing
+            sqlite3_bind_null(stmt, index);
+        }
+    }
+
+    int rc;
+    while ((rc = timed(Stage::DbStep, [&] { return sqlite3_step(stmt); })) == SQLITE_ROW) {
+        Product product;
+        product.id = sqlite3_column_int(stmt, 1);
+        product.name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+        product.price = sqlite3_column_int64(stmt, 3) / 100.0;
+        if (layout == CatalogLayout::Compact) {
+            found[unpack_barcode(sqlite3_column_int64(stmt, 0))] = product;
+        }
+        else {
+            found[reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0))] = product;
+        }
+    }
+    if (rc != SQLITE_DONE) {
+        throw std::runtime_error("Lookup failed: " + std::string(sqlite3_errmsg(sqlite3_db_handle(stmt))));
+    }
+}
+
+std::unordered_map<std::string, Product> lookup_products(sqlite3* db, CatalogLayout layout, const std::vector<std::string>& codes) {
+    std::unordered_map<std::string, Product> found;
+    std::vector<std::string> barcodes = unique_barcodes(codes);
+
+    for (size_t start = 0; start < barcodes.size(); start += kLookupChunk) {
+        size_t count = std::min(kLookupChunk, barcodes.size() - start);
+
+        sqlite3_stmt* stmt;
+        std::string sql = lookup_products_sql(layout, count);
+        if (timed(Stage::DbPrepare, [&] { return sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr); }) != SQLITE_OK) {
+            throw std::runtime_error("SQL error: " + std::string(sqlite3_errmsg(db)));
+        }
+
+        try {
+            collect_products(stmt, layout, &barcodes[start], count, found);
+        } catch (const std::runtime_error&) {
+            sqlite3_finalize(stmt);
+            throw;
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    return found;
+}
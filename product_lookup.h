@@ -0,0 +1,42 @@
+#ifndef PRODUCT_LOOKUP_H
+#define PRODUCT_LOOKUP_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "schema_migrations.h"
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+struct Product {
+    int id;
+    std::string name;
+    double price;
+};
+
+// Resolves a group of barcodes with one "WHERE barcode IN (...)" query per
+// kLookupChunk codes instead of one round trip per code. Barcodes that are
+// not in the catalog are absent from the result. `layout` is
+// catalog_layout(db), looked up once per connection.
+std::unordered_map<std::string, Product> lookup_products(sqlite3* db, CatalogLayout layout, const std::vector<std::string>& barcodes);
+
+// "SELECT barcode, id, product_name, price_cents ... WHERE barcode IN (?, ...)"
+// with `count` parameters (code instead of barcode for the compact layout);
+// the statement collect_products() expects.
+std::string lookup_products_sql(CatalogLayout layout, size_t count);
+
+// `codes` without repeats, in first-seen order.
+std::vector<std::string> unique_barcodes(const std::vector<std::string>& codes);
+
+// Binds `count` barcodes to a fresh or reset lookup_products_sql(layout,
+// count) statement, steps it to completion and adds the rows to `found`.
+// Throws std::runtime_error when a step fails.
+void collect_products(sqlite3_stmt* stmt, CatalogLayout layout, const std::string* barcodes, size_t count,
+                      std::unordered_map<std::string, Product>& found);
+
+// Stays well below SQLite's host parameter limit.
+const size_t kLookupChunk = 500;
+
+#endif // PRODUCT_LOOKUP_H
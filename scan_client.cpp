@@ -0,0 +1,50 @@
+#include "scan_client.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+ScanClient::ScanClient(const std::string& socket_path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Socket path too long: " + socket_path);
+    }
+    std::strcpy(address.sun_path, socket_path.c_str());
+
+    fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd_ < 0) {
+        throw std::runtime_error("Cannot create socket: " + std::string(strerror(errno)));
+    }
+    if (connect(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        std::string error = "Cannot connect to " + socket_path + ": " + strerror(errno);
+        close(fd_);
+        throw std::runtime_error(error);
+    }
+}
+
+ScanClient::~ScanClient() {
+    close(fd_);
+}
+
+ScanReply ScanClient::scan_path(const std::string& path) {
+    return request(ScanRequestKind::Path, path.data(), path.size());
+}
+
+ScanReply ScanClient::scan_image(const unsigned char* data, size_t size) {
+    return request(ScanRequestKind::Image, data, size);
+}
+
+ScanReply ScanClient::request(ScanRequestKind kind, const void* payload, size_t length) {
+    write_frame(fd_, static_cast<uint8_t>(kind), 0, payload, length);
+
+    FrameHeader header;
+    if (!read_frame(fd_, header, buffer_)) {
+        throw std::runtime_error("Scan daemon closed the connection");
+    }
+    return decode_reply(header, buffer_);
+}
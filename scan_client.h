@@ -0,0 +1,32 @@
+#ifndef SCAN_CLIENT_H
+#define SCAN_CLIENT_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "scan_protocol.h"
+
+// Connection to a running barcode_scand. One client keeps its socket open
+// for any number of requests; it is not safe to share between threads.
+// Connection and protocol failures throw std::runtime_error.
+class ScanClient {
+public:
+    explicit ScanClient(const std::string& socket_path = kDefaultScanSocket);
+    ~ScanClient();
+    ScanClient(const ScanClient&) = delete;
+    ScanClient& operator=(const ScanClient&) = delete;
+
+    // The daemon opens `path` itself, so it must be visible to the daemon.
+    ScanReply scan_path(const std::string& path);
+    // Sends the encoded image (PNG, JPEG, ...) in the request.
+    ScanReply scan_image(const unsigned char* data, size_t size);
+
+private:
+    ScanReply request(ScanRequestKind kind, const void* payload, size_t length);
+
+    int fd_;
+    std::vector<unsigned char> buffer_;
+};
+
+#endif // SCAN_CLIENT_H
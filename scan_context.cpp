@@ -0,0 +1,659 @@
+#include "scan_context.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "decode_cache.h"
+#include "gray_convert.h"
+#include "metrics.h"
+
+// stbi allocates through the arena of the scan in progress on this thread,
+// and through the C heap when it is used outside barcode_reader().
+static thread_local ScanArena* active_arena = nullptr;
+
+static void* scan_arena_malloc(size_t size) {
+    return active_arena ? active_arena->allocate(size) : std::malloc(size);
+}
+
+static void* scan_arena_realloc(void* ptr, size_t old_size, size_t new_size) {
+    if (active_arena && (!ptr || active_arena->owns(ptr))) {
+        return active_arena->reallocate(ptr, old_size, new_size);
+    }
+    return std::realloc(ptr, new_size);
+}
+
+static void scan_arena_free(void* ptr) {
+    if (active_arena && active_arena->owns(ptr)) {
+        return;
+    }
+    std::free(ptr);
+}
+
+#define STBI_MALLOC(sz) scan_arena_malloc(sz)
+#define STBI_REALLOC_SIZED(p, oldsz, newsz) scan_arena_realloc(p, oldsz, newsz)
+#define STBI_FREE(p) scan_arena_free(p)
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+
+// arena
+static const size_t kArenaAlign = 16;
+static const size_t kArenaMinBlock = 1 << 20;
+
+static size_t arena_align(size_t n) {
+    return (n + kArenaAlign - 1) & ~(kArenaAlign - 1);
+}
+
+ScanArena::ScanArena() {
+    blocks_.reserve(16);
+}
+
+ScanArena::~ScanArena() {
+    for (const Block& block : blocks_) {
+        std::free(block.data);
+    }
+}
+
+void* ScanArena::allocate(size_t size) {
+    size_t offset = arena_align(used_);
+    if (blocks_.empty() || offset + size > blocks_.back().size) {
+        size_t grown = blocks_.empty() ? 0 : blocks_.back().size * 2;
+        size_t block_size = std::max(std::max(arena_align(size), grown), kArenaMinBlock);
+        unsigned char* data = static_cast<unsigned char*>(std::malloc(block_size));
+        if (!data) {
+            return nullptr;
+        }
+        blocks_.push_back({data, block_size});
+        offset = 0;
+    }
+
+    last_ = blocks_.back().data + offset;
+    used_ = offset + size;
+    return last_;
+}
+
+void* ScanArena::reallocate(void* ptr, size_t old_size, size_t new_size) {
+    if (!ptr) {
+        return allocate(new_size);
+    }
+
+    if (ptr == last_) {
+        size_t offset = static_cast<unsigned char*>(ptr) - blocks_.back().data;
+        if (offset + new_size <= blocks_.back().size) {
+            used_ = offset + new_size;
+            return ptr;
+        }
+    }
+
+    void* moved = allocate(new_size);
+    if (moved) {
+        std::memcpy(moved, ptr, std::min(old_size, new_size));
+    }
+    return moved;
+}
+
+bool ScanArena::owns(const void* ptr) const {
+    const unsigned char* p = static_cast<const unsigned char*>(ptr);
+    for (const Block& block : blocks_) {
+        if (p >= block.data && p < block.data + block.size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ScanArena::reset() {
+    if (blocks_.size() > 1) {
+        size_t total = capacity();
+        for (const Block& block : blocks_) {
+            std::free(block.data);
+        }
+        blocks_.clear();
+
+        unsigned char* data = static_cast<unsigned char*>(std::malloc(total));
+        if (data) {
+            blocks_.push_back({data, total});
+        }
+    }
+    used_ = 0;
+    last_ = nullptr;
+}
+
+size_t ScanArena::capacity() const {
+    size_t total = 0;
+    for (const Block& block : blocks_) {
+        total += block.size;
+    }
+    return total;
+}
+
+
+// Routes stbi into `arena` for the lifetime of one request and releases the
+// request's temporaries when it ends.
+class ArenaScope {
+public:
+    explicit ArenaScope(ScanArena& arena) : arena_(arena), previous_(active_arena) {
+        active_arena = &arena_;
+    }
+    ~ArenaScope() {
+        active_arena = previous_;
+        arena_.reset();
+    }
+
+private:
+    ScanArena& arena_;
+    ScanArena* previous_;
+};
+
+
+// context
+ScanContext::ScanContext() {
+    set_profile(default_scan_profile());
+    image_.set_format("Y800");
+}
+
+ScanContext::~ScanContext() {
+}
+
+void ScanContext::set_profile(const ScanProfile& profile) {
+    if (profile_ != &profile) {
+        apply_scan_profile(scanner_, profile);
+        profile_ = &profile;
+    }
+}
+
+ScanContext& ScanContext::for_this_thread() {
+    thread_local ScanContext context;
+    return context;
+}
+
+unsigned char* GrowBuffer::reserve(size_t size) {
+    if (size > capacity_) {
+        data_.reset(new unsigned char[size]);
+        capacity_ = size;
+    }
+    return data_.get();
+}
+
+unsigned char* ScanContext::gray_frame(size_t pixels) {
+    return gray_.reserve(pixels);
+}
+
+void ScanContext::set_pyramid_levels(int levels) {
+    pyramid_levels_ = std::max(0, std::min(levels, kMaxPyramidLevels));
+}
+
+void ScanContext::set_bar_width(int pixels) {
+    bar_width_ = std::max(0, pixels);
+}
+
+int ScanContext::bar_scale(int limit) const {
+    int scale = 1;
+    while (bar_width_ > 0 && scale * 2 <= limit && bar_width_ / (scale * 2) >= kMinBarPx) {
+        scale *= 2;
+    }
+    return scale;
+}
+
+void ScanContext::set_pixel_budget(size_t pixels) {
+    pixel_budget_ = pixels;
+}
+
+int ScanContext::budget_factor(int width, int height, int scale) const {
+    size_t pixels = static_cast<size_t>(width) * height;
+    if (pixel_budget_ == 0 || pixels <= pixel_budget_) {
+        return 1;
+    }
+    int factor = std::max(2, static_cast<int>(std::sqrt(static_cast<double>(pixels) / pixel_budget_)));
+    while (static_cast<size_t>(width / factor) * (height / factor) > pixel_budget_) {
+        ++factor;
+    }
+    if (factor > kMaxShrinkFactor || bar_width_ < kMinBarPx * scale * factor) {
+        return 0;
+    }
+    return factor;
+}
+
+void ScanContext::open_decode_cache(const std::string& path, size_t max_bytes) {
+    cache_.reset(new DecodeCache(path, max_bytes));
+}
+
+void ScanContext::close_decode_cache() {
+    cache_.reset();
+}
+
+uint64_t ScanContext::settings_hash() const {
+    const uint64_t settings[4] = {
+        xxh64(profile_->name.data(), profile_->name.size()),
+        static_cast<uint64_t>(pyramid_levels_),
+        static_cast<uint64_t>(bar_width_),
+        static_cast<uint64_t>(pixel_budget_),
+    };
+    return xxh64(settings, sizeof(settings));
+}
+
+bool ScanContext::find_cached(const unsigned char* data, size_t size, uint64_t& key) {
+    if (!cache_) {
+        return false;
+    }
+    key = timed(Stage::ContentHash, [&] { return xxh64(data, size, settings_hash()); });
+    return cache_->find(key, size, symbols_);
+}
+
+void ScanContext::store_cached(uint64_t key, size_t size) {
+    if (cache_) {
+        cache_->store(key, size, symbols_);
+    }
+}
+
+void ScanContext::scale_symbols(int scale) {
+    if (scale == 1) {
+        return;
+    }
+    for (ScannedSymbol& symbol : symbols_) {
+        for (ScanPoint& point : symbol.polygon) {
+            point.x *= scale;
+            point.y *= scale;
+        }
+    }
+}
+
+size_t ScanContext::scan_into(const unsigned char* gray, int width, int height, int scale, int x0, int y0, int level, size_t at) {
+    image_.set_size(width, height);
+    image_.set_data(gray, static_cast<unsigned long>(width) * height);
+
+    size_t count = at;
+    if (timed(Stage::ZbarScan, [&] { return scanner_.scan(image_); }) > 0) {
+        // Entries are overwritten in place so their buffers get reused.
+        for (zbar::Image::SymbolIterator it = image_.symbol_begin(); it != image_.symbol_end(); ++it, ++count) {
+            if (count == symbols_.size()) {
+                symbols_.emplace_back();
+            }
+            ScannedSymbol& symbol = symbols_[count];
+            symbol.type = it->get_type();
+            symbol.type_name = zbar_get_symbol_name(symbol.type);
+            symbol.data = it->get_data();
+            symbol.quality = it->get_quality();
+            symbol.level = level;
+            symbol.polygon.clear();
+            for (int i = 0; i < it->get_location_size(); ++i) {
+                symbol.polygon.push_back({x0 + it->get_location_x(i) * scale, y0 + it->get_location_y(i) * scale});
+            }
+        }
+    }
+    return count;
+}
+
+int ScanContext::scan_gray(const unsigned char* gray, int width, int height) {
+    if (profile_->fast_code128 && scan_code128(gray, width, height)) {
+        return 1;
+    }
+    if (pyramid_levels_ > 0) {
+        return scan_pyramid(gray, width, height);
+    }
+
+    size_t count = scan_into(gray, width, height, 1, 0, 0, 0, 0);
+    symbols_.resize(count);
+    return static_cast<int>(count);
+}
+
+bool ScanContext::scan_code128(const unsigned char* gray, int width, int height) {
+    auto start = std::chrono::steady_clock::now();
+    bool hit = code128_decode(gray, width, height, code128_);
+    int length = hit ? static_cast<int>(code128_.data.size()) : 0;
+    if ((profile_->min_length > 0 && length < profile_->min_length) ||
+        (profile_->max_length > 0 && length > profile_->max_length)) {
+        hit = false;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    record_stage(hit ? Stage::Code128Hit : Stage::Code128Miss,
+                 static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    if (!hit) {
+        return false;
+    }
+
+    symbols_.resize(1);
+    ScannedSymbol& symbol = symbols_[0];
+    symbol.type = zbar::ZBAR_CODE128;
+    symbol.type_name = zbar_get_symbol_name(symbol.type);
+    symbol.data = code128_.data;
+    symbol.quality = code128_.rows;
+    symbol.level = 0;
+    symbol.polygon.assign({{code128_.left, code128_.top}, {code128_.left, code128_.bottom},
+                           {code128_.right, code128_.bottom}, {code128_.right, code128_.top}});
+    return true;
+}
+
+
+// pyramid
+// Levels smaller than this are not worth scanning.
+static const int kMinLevelSide = 64;
+// Agreeing scanlines a linear symbol needs before a coarse read is trusted.
+static const int kCoarseMinQuality = 2;
+
+static bool coarse_symbol_verified(const ScannedSymbol& symbol, const ScanProfile& profile) {
+    int length = static_cast<int>(symbol.data.size());
+    if ((profile.min_length > 0 && length < profile.min_length) ||
+        (profile.max_length > 0 && length > profile.max_length)) {
+        return false;
+    }
+    // zbar reports quality 1 for QR; its error correction is the check there
+    if (symbol.type == zbar::ZBAR_QRCODE) {
+        return true;
+    }
+    return symbol.quality >= kCoarseMinQuality;
+}
+
+// Full-resolution region around a symbol read at a coarse level. Linear codes
+// are located as a thin band of scanlines, so the band is widened to cover
+// the bars' height and the quiet zones.
+static ScanRegion coarse_symbol_region(const ScannedSymbol& symbol, int width, int height) {
+    if (symbol.polygon.empty()) {
+        return {0, 0, width, height};
+    }
+
+    int min_x = width, min_y = height, max_x = 0, max_y = 0;
+    for (const ScanPoint& point : symbol.polygon) {
+        min_x = std::min(min_x, point.x);
+        min_y = std::min(min_y, point.y);
+        max_x = std::max(max_x, point.x);
+        max_y = std::max(max_y, point.y);
+    }
+
+    int scale = 1 << symbol.level;
+    int pad_x = (max_x - min_x) / 4 + 8 * scale;
+    int pad_y = std::max(max_y - min_y, 16 * scale);
+
+    int x = std::max(0, min_x - pad_x);
+    int y = std::max(0, min_y - pad_y);
+    int right = std::min(width, max_x + pad_x + scale);
+    int bottom = std::min(height, max_y + pad_y + scale);
+    return {x, y, std::max(1, right - x), std::max(1, bottom - y)};
+}
+
+int ScanContext::scan_pyramid(const unsigned char* gray, int width, int height) {
+    const unsigned char* levels[kMaxPyramidLevels + 1] = {gray};
+    int widths[kMaxPyramidLevels + 1] = {width};
+    int heights[kMaxPyramidLevels + 1] = {height};
+
+    int top = 0;
+    size_t level_bytes = 0;
+    while (top < pyramid_levels_ && widths[top] / 2 >= kMinLevelSide && heights[top] / 2 >= kMinLevelSide) {
+        ++top;
+        widths[top] = widths[top - 1] / 2;
+        heights[top] = heights[top - 1] / 2;
+        level_bytes += static_cast<size_t>(widths[top]) * heights[top];
+    }
+
+    unsigned char* next = pyramid_.reserve(level_bytes);
+    for (int level = 1; level <= top; ++level) {
+        downscale_half(levels[level - 1], widths[level - 1], heights[level - 1], next);
+        levels[level] = next;
+        next += static_cast<size_t>(widths[level]) * heights[level];
+    }
+
+    for (int level = top; level >= 0; --level) {
+        size_t count = scan_into(levels[level], widths[level], heights[level], 1 << level, 0, 0, level, 0);
+        if (count == 0) {
+            continue;
+        }
+        if (level == 0) {
+            symbols_.resize(count);
+            return static_cast<int>(count);
+        }
+
+        // Verified symbols move to the front; the rest are decoded again at
+        // full resolution, each inside its own region.
+        size_t kept = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (coarse_symbol_verified(symbols_[i], *profile_)) {
+                if (i != kept) {
+                    std::swap(symbols_[i], symbols_[kept]);
+                }
+                ++kept;
+            }
+        }
+        regions_.clear();
+        for (size_t i = kept; i < count; ++i) {
+            regions_.push_back(coarse_symbol_region(symbols_[i], width, height));
+        }
+
+        for (const ScanRegion& region : regions_) {
+            unsigned char* crop = region_.reserve(static_cast<size_t>(region.width) * region.height);
+            for (int y = 0; y < region.height; ++y) {
+                std::memcpy(crop + static_cast<size_t>(y) * region.width,
+                            gray + static_cast<size_t>(region.y + y) * width + region.x, region.width);
+            }
+
+            size_t end = scan_into(crop, region.width, region.height, 1, region.x, region.y, 0, kept);
+            for (size_t i = kept; i < end; ++i) {
+                // overlapping regions can decode the same label twice
+                bool seen = false;
+                for (size_t j = 0; j < kept && !seen; ++j) {
+                    seen = symbols_[j].type == symbols_[i].type && symbols_[j].data == symbols_[i].data;
+                }
+                if (!seen) {
+                    if (i != kept) {
+                        std::swap(symbols_[i], symbols_[kept]);
+                    }
+                    ++kept;
+                }
+            }
+        }
+
+        if (kept > 0) {
+            symbols_.resize(kept);
+            return static_cast<int>(kept);
+        }
+        // nothing held up at this level: scan the next finer one in full
+    }
+
+    symbols_.clear();
+    return 0;
+}
+
+
+// Reads the whole file into the arena with plain syscalls; stdio would
+// malloc a FILE and its buffer on every open.
+static unsigned char* read_file(ScanArena& arena, const char* filename, size_t* size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st;
+    unsigned char* data = nullptr;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = static_cast<unsigned char*>(arena.allocate(st.st_size));
+    }
+
+    size_t done = 0;
+    while (data && done < static_cast<size_t>(st.st_size)) {
+        ssize_t n = read(fd, data + done, st.st_size - done);
+        if (n <= 0) {
+            data = nullptr;
+            break;
+        }
+        done += n;
+    }
+    close(fd);
+
+    *size = done;
+    return data;
+}
+
+enum class Decoded { Ok, Unreadable, OverBudget };
+
+// Shrink factor for an image decoded at 1/`scale`, counted in the metrics;
+// 0 when the image is over the pixel budget.
+static int budget_factor(ScanContext& ctx, int width, int height, int scale) {
+    int factor = ctx.budget_factor(width, height, scale);
+    if (factor != 1) {
+        count_event(factor ? Counter::ImageDownscaled : Counter::ImageRejected);
+    }
+    return factor;
+}
+
+// JPEGs are decoded to luma only, straight into the gray frame, and scaled
+// down in the DCT as far as the expected bar width allows, then shrunk
+// further when that is still over the pixel budget. Returns Unreadable when
+// libjpeg cannot decode the image, which then goes to stbi.
+static Decoded decode_jpeg(ScanContext& ctx, const unsigned char* data, size_t size) {
+    JpegGrayDecoder& jpeg = ctx.jpeg();
+    int scale = ctx.bar_scale(8);
+    StageTimer timer(Stage::JpegDecode);
+    if (!jpeg.start(data, size, scale)) {
+        return Decoded::Unreadable;
+    }
+    int factor = budget_factor(ctx, jpeg.width(), jpeg.height(), scale);
+    if (factor == 0) {
+        jpeg.abort();
+        return Decoded::OverBudget;
+    }
+    int width = jpeg.width() / factor;
+    int height = jpeg.height() / factor;
+    unsigned char* gray = ctx.gray_frame(static_cast<size_t>(width) * height);
+    if (!jpeg.read(gray, factor)) {
+        return Decoded::Unreadable;
+    }
+    timer.stop();
+
+    ctx.scan_gray(gray, width, height);
+    ctx.scale_symbols(scale * factor);
+    return Decoded::Ok;
+}
+
+// PNGs are decoded a row at a time into the gray frame, so the only other
+// buffer is one row. Returns Unreadable when the image is left to stbi.
+static Decoded decode_png(ScanContext& ctx, const unsigned char* data, size_t size) {
+    PngGrayDecoder& png = ctx.png();
+    StageTimer timer(Stage::PngDecode);
+    if (!png.start(data, size)) {
+        return Decoded::Unreadable;
+    }
+    int factor = budget_factor(ctx, png.width(), png.height(), 1);
+    if (factor == 0) {
+        png.abort();
+        return Decoded::OverBudget;
+    }
+    int width = png.width() / factor;
+    int height = png.height() / factor;
+    unsigned char* gray = ctx.gray_frame(static_cast<size_t>(width) * height);
+    if (!png.read(gray, factor)) {
+        return Decoded::Unreadable;
+    }
+    timer.stop();
+
+    ctx.scan_gray(gray, width, height);
+    ctx.scale_symbols(factor);
+    return Decoded::Ok;
+}
+
+// Decodes an encoded image that is already in memory; the arena scope is the
+// caller's. stbi still decodes the whole image, but its header is checked
+// against the pixel budget first and an oversized image is shrunk into the
+// gray frame rather than converted at full size.
+static Decoded decode_image(ScanContext& ctx, const unsigned char* data, size_t size) {
+    Decoded decoded = Decoded::Unreadable;
+    if (data && is_jpeg(data, size)) {
+        decoded = decode_jpeg(ctx, data, size);
+    }
+    if (data && decoded == Decoded::Unreadable && is_png(data, size)) {
+        decoded = decode_png(ctx, data, size);
+    }
+    if (decoded != Decoded::Unreadable) {
+        if (decoded == Decoded::OverBudget) {
+            ctx.clear_symbols();
+        }
+        return decoded;
+    }
+
+    int width, height, channels;
+    int factor = 1;
+    unsigned char* image = nullptr;
+    if (data && stbi_info_from_memory(data, static_cast<int>(size), &width, &height, &channels)) {
+        factor = budget_factor(ctx, width, height, 1);
+        if (factor == 0) {
+            ctx.clear_symbols();
+            return Decoded::OverBudget;
+        }
+        StageTimer timer(Stage::ImageLoad);
+        image = stbi_load_from_memory(data, static_cast<int>(size), &width, &height, &channels, 0);
+    }
+    if (!image) {
+        ctx.clear_symbols();
+        return Decoded::Unreadable;
+    }
+
+    int out_width = width / factor;
+    int out_height = height / factor;
+    unsigned char* gray = ctx.gray_frame(static_cast<size_t>(out_width) * out_height);
+    {
+        StageTimer timer(Stage::Gray);
+        if (factor == 1) {
+            convert_to_gray(image, channels, static_cast<size_t>(width) * height, gray);
+        }
+        else {
+            GrayShrinker& shrinker = ctx.shrinker();
+            shrinker.start(width, channels, factor, gray);
+            for (int y = 0; y < height; ++y) {
+                shrinker.add_row(image + static_cast<size_t>(y) * width * channels);
+            }
+        }
+    }
+    stbi_image_free(image);
+
+    ctx.scan_gray(gray, out_width, out_height);
+    ctx.scale_symbols(factor);
+    return Decoded::Ok;
+}
+
+// decode_image() behind the decode cache, when one is open. Only images that
+// decoded are stored: an unreadable file may still be being written, and an
+// image over the pixel budget is rejected again from its header alone.
+static Decoded decode_cached(ScanContext& ctx, const unsigned char* data, size_t size) {
+    uint64_t key = 0;
+    if (data && ctx.find_cached(data, size, key)) {
+        return Decoded::Ok;
+    }
+    Decoded decoded = decode_image(ctx, data, size);
+    if (data && decoded == Decoded::Ok) {
+        ctx.store_cached(key, size);
+    }
+    return decoded;
+}
+
+// Real Barcode Recognition Function Using ZBar
+const std::vector<ScannedSymbol>& barcode_symbols(ScanContext& ctx, const char* filename) {
+    ArenaScope scope(ctx.arena());
+
+    size_t size = 0;
+    unsigned char* file = timed(Stage::FileRead, [&] { return read_file(ctx.arena(), filename, &size); });
+    Decoded decoded = decode_cached(ctx, file, size);
+    if (decoded == Decoded::Unreadable) {
+        std::cerr << "Error loading image: " << filename << std::endl;
+    }
+    else if (decoded == Decoded::OverBudget) {
+        std::cerr << "Image over the pixel budget: " << filename << std::endl;
+    }
+    return ctx.symbols();
+}
+
+const std::vector<ScannedSymbol>& barcode_symbols_from_memory(ScanContext& ctx, const unsigned char* data, size_t size) {
+    ArenaScope scope(ctx.arena());
+    decode_cached(ctx, data, size);
+    return ctx.symbols();
+}
+
+std::string barcode_reader(ScanContext& ctx, const char* filename) {
+    const std::vector<ScannedSymbol>& symbols = barcode_symbols(ctx, filename);
+    return symbols.empty() ? std::string() : symbols.front().data;
+}
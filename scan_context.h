@@ -0,0 +1,216 @@
+#ifndef SCAN_CONTEXT_H
+#define SCAN_CONTEXT_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <zbar.h>
+
+#include "code128_decode.h"
+#include "gray_convert.h"
+#include "jpeg_gray.h"
+#include "png_gray.h"
+#include "scan_profile.h"
+
+class DecodeCache;
+
+// Bump allocator for the temporaries of one scan request (the decoded image
+// and the decoder's working buffers). Everything is released at once by
+// reset(), which also folds the blocks grown during the request into a single
+// block, so after warm-up a request is served without touching the heap.
+class ScanArena {
+public:
+    ScanArena();
+    ~ScanArena();
+    ScanArena(const ScanArena&) = delete;
+    ScanArena& operator=(const ScanArena&) = delete;
+
+    void* allocate(size_t size);
+    // Grows the last allocation in place when possible, otherwise copies.
+    void* reallocate(void* ptr, size_t old_size, size_t new_size);
+    bool owns(const void* ptr) const;
+    void reset();
+
+    size_t capacity() const;
+
+private:
+    struct Block {
+        unsigned char* data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks_;
+    size_t used_ = 0;          // bytes taken from blocks_.back()
+    void* last_ = nullptr;     // most recent allocation, the only one that can grow in place
+};
+
+struct ScanPoint {
+    int x;
+    int y;
+};
+
+struct ScanRegion {
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+// One decoded symbol with the outline zbar located it at, in image pixels.
+struct ScannedSymbol {
+    zbar::zbar_symbol_type_t type;
+    const char* type_name;      // static zbar name, e.g. "CODE-128"
+    std::string data;
+    int quality;
+    std::vector<ScanPoint> polygon;
+    int level;                  // pyramid level it was decoded at, 0 is full resolution
+};
+
+// Heap buffer that only ever grows.
+class GrowBuffer {
+public:
+    unsigned char* reserve(size_t size);
+
+private:
+    std::unique_ptr<unsigned char[]> data_;
+    size_t capacity_ = 0;
+};
+
+// Deepest supported pyramid level (1/8 scale).
+const int kMaxPyramidLevels = 3;
+
+// Narrowest bar, in pixels, that decoding at a reduced scale may leave.
+const int kMinBarPx = 2;
+
+// Long-lived per-thread scanning state: a configured zbar scanner and image
+// header, a grow-only gray frame and the request arena. barcode_reader()
+// reuses all of it, so a stream of scans costs no scanner setup and, once the
+// buffers have grown to the largest image, no heap allocations.
+class ScanContext {
+public:
+    ScanContext();
+    ~ScanContext();
+    ScanContext(const ScanContext&) = delete;
+    ScanContext& operator=(const ScanContext&) = delete;
+
+    // Context owned by the calling thread; lives until the thread exits.
+    static ScanContext& for_this_thread();
+
+    // Starts out with default_scan_profile(); reconfigures zbar only on change.
+    void set_profile(const ScanProfile& profile);
+    const ScanProfile& profile() const { return *profile_; }
+
+    zbar::ImageScanner& scanner() { return scanner_; }
+    const zbar::Image& image() const { return image_; }
+    ScanArena& arena() { return arena_; }
+
+    // Gray frame with room for at least `pixels` bytes. Never shrinks.
+    unsigned char* gray_frame(size_t pixels);
+
+    // Coarse-to-fine decoding: with N > 0 levels scan_gray() first scans the
+    // image at 1/2^N scale and only goes finer when nothing is found there.
+    // Symbols that fail verification at a coarse level are rescanned at full
+    // resolution within their own region. 0 (the default) scans full frames.
+    void set_pyramid_levels(int levels);
+    int pyramid_levels() const { return pyramid_levels_; }
+
+    // Width of the narrowest bar expected in the input images, in pixels at
+    // full resolution; 0 (the default) when unknown. Images may then be
+    // decoded at a reduced scale that keeps that bar kMinBarPx wide.
+    void set_bar_width(int pixels);
+    int bar_width() const { return bar_width_; }
+
+    // Largest power of two up to `limit` to divide the image size by
+    // without narrowing the expected bars below kMinBarPx; 1 when the bar
+    // width is unknown.
+    int bar_scale(int limit) const;
+
+    // Most pixels the gray frame of one image may have; 0 (the default) sets
+    // no limit. Larger images are shrunk by an integer factor while they are
+    // decoded, so their full-size gray frame never exists, as long as the
+    // expected bars stay kMinBarPx wide. Otherwise, and always when the bar
+    // width is unknown, they are rejected.
+    void set_pixel_budget(size_t pixels);
+    size_t pixel_budget() const { return pixel_budget_; }
+
+    // Factor to shrink a width x height image, already decoded at
+    // 1/`scale`, by to fit the pixel budget: 1 when it fits, 0 when it has
+    // to be rejected.
+    int budget_factor(int width, int height, int scale) const;
+
+    // From now on images are first looked up in the DecodeCache at `path`
+    // (see decode_cache.h), by their bytes and the settings above, and what
+    // they decode to is stored there. Throws std::runtime_error when the
+    // cache cannot be opened.
+    void open_decode_cache(const std::string& path, size_t max_bytes);
+    void close_decode_cache();
+    DecodeCache* decode_cache() { return cache_.get(); }
+
+    // Seed of the cache key: a hash of the settings that change what an
+    // image decodes to (profile, pyramid levels, bar width, pixel budget).
+    uint64_t settings_hash() const;
+
+    // With a decode cache open, true when an image with these bytes was
+    // decoded before under the same settings; symbols() then holds its
+    // symbols. `key` is set for store_cached() either way.
+    bool find_cached(const unsigned char* data, size_t size, uint64_t& key);
+    // Stores symbols() for the image of `size` bytes find_cached() missed.
+    void store_cached(uint64_t key, size_t size);
+
+    JpegGrayDecoder& jpeg() { return jpeg_; }
+    PngGrayDecoder& png() { return png_; }
+    GrayShrinker& shrinker() { return shrinker_; }
+
+    // Runs the scanner over an 8-bit gray image and collects every symbol it
+    // found into symbols(), with coordinates in `gray` pixels. Returns the
+    // number of symbols. With a fast_code128 profile, code128_decode() gets
+    // the image first and zbar only runs when it reads nothing; its latency
+    // is recorded as Stage::Code128Hit or Stage::Code128Miss.
+    int scan_gray(const unsigned char* gray, int width, int height);
+    const std::vector<ScannedSymbol>& symbols() const { return symbols_; }
+    void clear_symbols() { symbols_.clear(); }
+
+    // Maps symbols() from a frame decoded at 1/`scale` back to full-resolution pixels.
+    void scale_symbols(int scale);
+
+private:
+    // Scans one image and stores its symbols from index `at` on, mapped back
+    // to full resolution by `scale` and the (x0, y0) offset. Returns the new count.
+    size_t scan_into(const unsigned char* gray, int width, int height, int scale, int x0, int y0, int level, size_t at);
+    int scan_pyramid(const unsigned char* gray, int width, int height);
+    bool scan_code128(const unsigned char* gray, int width, int height);
+
+    zbar::ImageScanner scanner_;
+    zbar::Image image_;
+    const ScanProfile* profile_ = nullptr;
+    int pyramid_levels_ = 0;
+    int bar_width_ = 0;
+    size_t pixel_budget_ = 0;
+    std::vector<ScannedSymbol> symbols_;
+    std::vector<ScanRegion> regions_;
+    Code128Read code128_;
+    GrowBuffer gray_;
+    GrowBuffer pyramid_;
+    GrowBuffer region_;
+    ScanArena arena_;
+    JpegGrayDecoder jpeg_;
+    PngGrayDecoder png_;
+    GrayShrinker shrinker_;
+    std::unique_ptr<DecodeCache> cache_;
+};
+
+// Decodes `filename` and returns every symbol in it; empty when the image
+// cannot be loaded or holds no barcode. The list is owned by `ctx` and stays
+// valid until its next scan.
+const std::vector<ScannedSymbol>& barcode_symbols(ScanContext& ctx, const char* filename);
+
+// Same as barcode_symbols() for an encoded image (PNG, JPEG, ...) that is
+// already in memory, e.g. received over a socket.
+const std::vector<ScannedSymbol>& barcode_symbols_from_memory(ScanContext& ctx, const unsigned char* data, size_t size);
+
+// Data of the first symbol barcode_symbols() finds, or an empty string.
+std::string barcode_reader(ScanContext& ctx, const char* filename);
+
+#endif // SCAN_CONTEXT_H
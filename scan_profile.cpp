@@ -0,0 +1,71 @@
+#include "scan_profile.h"
+
+#include "barcode_code.h"
+
+const std::vector<ScanProfile>& scan_profiles() {
+    static const std::vector<ScanProfile> profiles = {
+        // Our own labels: horizontal Code128 with kBarcodeLength characters.
+        // Bars are vertical, so only horizontal scanlines can cross them, and
+        // the native decoder reads the clean ones before zbar is asked.
+        {"code128-only", {zbar::ZBAR_CODE128}, 0, 2, kBarcodeLength, kBarcodeLength, true},
+        {"retail", {zbar::ZBAR_EAN13, zbar::ZBAR_EAN8, zbar::ZBAR_UPCA, zbar::ZBAR_UPCE}, 1, 1, 0, 0, false},
+        {"all", {}, 1, 1, 0, 0, false},
+        {"qr", {zbar::ZBAR_QRCODE}, 1, 1, 0, 0, false},
+    };
+    return profiles;
+}
+
+const ScanProfile* find_scan_profile(const std::string& name) {
+    for (const ScanProfile& profile : scan_profiles()) {
+        if (profile.name == name) {
+            return &profile;
+        }
+    }
+    return nullptr;
+}
+
+const ScanProfile& default_scan_profile() {
+    static const ScanProfile& profile = *find_scan_profile(kBarcodeScanProfile);
+    return profile;
+}
+
+std::string scan_profile_names() {
+    std::string names;
+    for (const ScanProfile& profile : scan_profiles()) {
+        if (!names.empty()) {
+            names += ", ";
+        }
+        names += profile.name;
+    }
+    return names;
+}
+
+void apply_scan_profile(zbar::ImageScanner& scanner, const ScanProfile& profile) {
+    // Length limits outlive a profile switch, so clear those set by other profiles.
+    for (const ScanProfile& other : scan_profiles()) {
+        if (other.min_length > 0 || other.max_length > 0) {
+            for (zbar::zbar_symbol_type_t symbology : other.symbologies) {
+                scanner.set_config(symbology, zbar::ZBAR_CFG_MIN_LEN, 0);
+                scanner.set_config(symbology, zbar::ZBAR_CFG_MAX_LEN, 0);
+            }
+        }
+    }
+
+    if (profile.symbologies.empty()) {
+        scanner.set_config(zbar::ZBAR_NONE, zbar::ZBAR_CFG_ENABLE, 1);
+    } else {
+        scanner.set_config(zbar::ZBAR_NONE, zbar::ZBAR_CFG_ENABLE, 0);
+        for (zbar::zbar_symbol_type_t symbology : profile.symbologies) {
+            scanner.set_config(symbology, zbar::ZBAR_CFG_ENABLE, 1);
+            if (profile.min_length > 0) {
+                scanner.set_config(symbology, zbar::ZBAR_CFG_MIN_LEN, profile.min_length);
+            }
+            if (profile.max_length > 0) {
+                scanner.set_config(symbology, zbar::ZBAR_CFG_MAX_LEN, profile.max_length);
+            }
+        }
+    }
+
+    scanner.set_config(zbar::ZBAR_NONE, zbar::ZBAR_CFG_X_DENSITY, profile.x_density);
+    scanner.set_config(zbar::ZBAR_NONE, zbar::ZBAR_CFG_Y_DENSITY, profile.y_density);
+}
@@ -0,0 +1,35 @@
+#ifndef SCAN_PROFILE_H
+#define SCAN_PROFILE_H
+
+#include <string>
+#include <vector>
+
+#include <zbar.h>
+
+// Named decoder setup for zbar: which symbologies are enabled, how dense the
+// scanlines are and which data lengths are accepted. Fewer decoders and
+// sparser scanlines make each scan cheaper.
+struct ScanProfile {
+    std::string name;
+    std::vector<zbar::zbar_symbol_type_t> symbologies;  // empty enables every decoder
+    int x_density;    // column stride of vertical scanlines, 0 disables them
+    int y_density;    // row stride of horizontal scanlines, 0 disables them
+    int min_length;   // 0 keeps zbar's default
+    int max_length;   // 0 keeps zbar's default
+    bool fast_code128;  // try code128_decode() before zbar
+};
+
+// code128-only, retail, all, qr
+const std::vector<ScanProfile>& scan_profiles();
+
+const ScanProfile* find_scan_profile(const std::string& name);
+
+// Profile that reads the labels the generator emits (kBarcodeScanProfile).
+const ScanProfile& default_scan_profile();
+
+// "code128-only, retail, ..." for usage and error messages.
+std::string scan_profile_names();
+
+void apply_scan_profile(zbar::ImageScanner& scanner, const ScanProfile& profile);
+
+#endif // SCAN_PROFILE_H
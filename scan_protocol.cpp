@@ -0,0 +1,258 @@
+#include "scan_protocol.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+
+// byte order
+static void put_u8(std::vector<unsigned char>& out, uint8_t value) {
+    out.push_back(value);
+}
+
+static void put_u16(std::vector<unsigned char>& out, uint16_t value) {
+    out.push_back(static_cast<unsigned char>(value));
+    out.push_back(static_cast<unsigned char>(value >> 8));
+}
+
+static void put_u32(std::vector<unsigned char>& out, uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+        out.push_back(static_cast<unsigned char>(value >> shift));
+    }
+}
+
+static void put_u64(std::vector<unsigned char>& out, uint64_t value) {
+    for (int shift = 0; shift < 64; shift += 8) {
+        out.push_back(static_cast<unsigned char>(value >> shift));
+    }
+}
+
+static void put_bytes(std::vector<unsigned char>& out, const std::string& value) {
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+static uint64_t get_le(const unsigned char* p, int bytes) {
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; --i) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+// Bounds-checked cursor over a response payload.
+class PayloadReader {
+public:
+    PayloadReader(const std::vector<unsigned char>& payload) : data_(payload.data()), left_(payload.size()) {}
+
+    uint64_t number(int bytes) {
+        const unsigned char* p = take(bytes);
+        return get_le(p, bytes);
+    }
+
+    std::string text(size_t length) {
+        const unsigned char* p = take(length);
+        return std::string(reinterpret_cast<const char*>(p), length);
+    }
+
+private:
+    const unsigned char* take(size_t n) {
+        if (n > left_) {
+            throw std::runtime_error("Truncated scan response");
+        }
+        const unsigned char* p = data_;
+        data_ += n;
+        left_ -= n;
+        return p;
+    }
+
+    const unsigned char* data_;
+    size_t left_;
+};
+
+
+// socket I/O
+// Waits until `fd` is ready for `events`. With a deadline the calls below do
+// not block, so this is the only place they wait, and it stops at the
+// deadline however slowly the peer trickles bytes.
+static void wait_ready(int fd, short events, FrameDeadline deadline) {
+    if (deadline == kNoDeadline) {
+        return;
+    }
+    for (;;) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0) {
+            throw std::runtime_error("Socket timed out");
+        }
+        pollfd ready = {fd, events, 0};
+        int n = poll(&ready, 1, static_cast<int>(std::min<int64_t>(left.count(), 60000)));
+        if (n > 0) {
+            return;
+        }
+        if (n < 0 && errno != EINTR) {
+            throw std::runtime_error("Socket poll failed: " + std::string(strerror(errno)));
+        }
+    }
+}
+
+// Returns the number of bytes read before end of stream.
+static size_t read_full(int fd, unsigned char* data, size_t size, FrameDeadline deadline) {
+    int flags = deadline == kNoDeadline ? 0 : MSG_DONTWAIT;
+    size_t done = 0;
+    while (done < size) {
+        wait_ready(fd, POLLIN, deadline);
+        ssize_t n = recv(fd, data + done, size - done, flags);
+        if (n < 0 && (errno == EINTR || (flags && (errno == EAGAIN || errno == EWOULDBLOCK)))) {
+            continue;
+        }
+        if (n < 0) {
+            throw std::runtime_error("Socket read failed: " + std::string(strerror(errno)));
+        }
+        if (n == 0) {
+            break;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return done;
+}
+
+bool read_frame(int fd, FrameHeader& header, std::vector<unsigned char>& payload, FrameDeadline deadline) {
+    unsigned char raw[kFrameHeaderSize];
+    size_t got = read_full(fd, raw, sizeof(raw), deadline);
+    if (got == 0) {
+        return false;
+    }
+    if (got < sizeof(raw)) {
+        throw std::runtime_error("Truncated frame header");
+    }
+
+    header.version = raw[0];
+    header.kind = raw[1];
+    header.count = static_cast<uint16_t>(get_le(raw + 2, 2));
+    header.length = static_cast<uint32_t>(get_le(raw + 4, 4));
+    if (header.version != kScanProtocolVersion) {
+        throw std::runtime_error("Unsupported protocol version " + std::to_string(header.version));
+    }
+    if (header.length > kMaxFramePayload) {
+        throw std::runtime_error("Frame payload too large: " + std::to_string(header.length));
+    }
+
+    payload.resize(header.length);
+    if (read_full(fd, payload.data(), header.length, deadline) < header.length) {
+        throw std::runtime_error("Truncated frame payload");
+    }
+    return true;
+}
+
+void write_frame(int fd, uint8_t kind, uint16_t count, const void* payload, size_t length, FrameDeadline deadline) {
+    if (length > kMaxFramePayload) {
+        throw std::runtime_error("Frame payload too large: " + std::to_string(length));
+    }
+
+    unsigned char raw[kFrameHeaderSize] = {
+        kScanProtocolVersion, kind,
+        static_cast<unsigned char>(count), static_cast<unsigned char>(count >> 8),
+        static_cast<unsigned char>(length), static_cast<unsigned char>(length >> 8),
+        static_cast<unsigned char>(length >> 16), static_cast<unsigned char>(length >> 24),
+    };
+
+    iovec parts[2] = {
+        {raw, sizeof(raw)},
+        {const_cast<void*>(payload), length},
+    };
+    int flags = MSG_NOSIGNAL | (deadline == kNoDeadline ? 0 : MSG_DONTWAIT);
+    int part = 0;
+    while (part < 2) {
+        wait_ready(fd, POLLOUT, deadline);
+        // sendmsg() rather than writev() so a peer that hung up yields EPIPE, not SIGPIPE
+        msghdr message = {};
+        message.msg_iov = parts + part;
+        message.msg_iovlen = 2 - part;
+        ssize_t n = sendmsg(fd, &message, flags);
+        if (n < 0 && (errno == EINTR || ((flags & MSG_DONTWAIT) && (errno == EAGAIN || errno == EWOULDBLOCK)))) {
+            continue;
+        }
+        if (n < 0) {
+            throw std::runtime_error("Socket write failed: " + std::string(strerror(errno)));
+        }
+        // skip what was written, resuming mid-part on a short write
+        size_t written = static_cast<size_t>(n);
+        while (part < 2 && written >= parts[part].iov_len) {
+            written -= parts[part].iov_len;
+            ++part;
+        }
+        if (part < 2) {
+            parts[part].iov_base = static_cast<char*>(parts[part].iov_base) + written;
+            parts[part].iov_len -= written;
+        }
+    }
+}
+
+
+// symbols
+void encode_reply_symbol(std::vector<unsigned char>& out, const ScanReplySymbol& symbol) {
+    std::string type = symbol.type.substr(0, 0xff);
+    std::string data = symbol.data.substr(0, 0xffff);
+
+    put_u8(out, static_cast<uint8_t>(type.size()));
+    put_bytes(out, type);
+    put_u16(out, static_cast<uint16_t>(data.size()));
+    put_bytes(out, data);
+    put_u32(out, static_cast<uint32_t>(symbol.quality));
+    put_u8(out, static_cast<uint8_t>(symbol.level));
+    put_u32(out, static_cast<uint32_t>(symbol.x));
+    put_u32(out, static_cast<uint32_t>(symbol.y));
+    put_u32(out, static_cast<uint32_t>(symbol.width));
+    put_u32(out, static_cast<uint32_t>(symbol.height));
+    put_u8(out, symbol.found ? 1 : 0);
+    if (symbol.found) {
+        std::string name = symbol.product.name.substr(0, 0xffff);
+        uint64_t price;
+        std::memcpy(&price, &symbol.product.price, sizeof(price));
+
+        put_u32(out, static_cast<uint32_t>(symbol.product.id));
+        put_u64(out, price);
+        put_u16(out, static_cast<uint16_t>(name.size()));
+        put_bytes(out, name);
+    }
+}
+
+ScanReply decode_reply(const FrameHeader& header, const std::vector<unsigned char>& payload) {
+    ScanReply reply;
+    if (header.kind > static_cast<uint8_t>(ScanStatus::Error)) {
+        throw std::runtime_error("Unknown scan status " + std::to_string(header.kind));
+    }
+    reply.status = static_cast<ScanStatus>(header.kind);
+
+    if (reply.status == ScanStatus::Error) {
+        reply.error.assign(payload.begin(), payload.end());
+        return reply;
+    }
+
+    PayloadReader in(payload);
+    reply.symbols.resize(header.count);
+    for (ScanReplySymbol& symbol : reply.symbols) {
+        symbol.type = in.text(in.number(1));
+        symbol.data = in.text(in.number(2));
+        symbol.quality = static_cast<int32_t>(in.number(4));
+        symbol.level = static_cast<int>(in.number(1));
+        symbol.x = static_cast<int32_t>(in.number(4));
+        symbol.y = static_cast<int32_t>(in.number(4));
+        symbol.width = static_cast<int32_t>(in.number(4));
+        symbol.height = static_cast<int32_t>(in.number(4));
+        symbol.found = in.number(1) != 0;
+        symbol.product = Product();
+        if (symbol.found) {
+            symbol.product.id = static_cast<int32_t>(in.number(4));
+            uint64_t price = in.number(8);
+            std::memcpy(&symbol.product.price, &price, sizeof(price));
+            symbol.product.name = in.text(in.number(2));
+        }
+    }
+    return reply;
+}
@@ -0,0 +1,80 @@
+#ifndef SCAN_PROTOCOL_H
+#define SCAN_PROTOCOL_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "product_lookup.h"
+
+// Framing between barcode_scand and its clients on a Unix stream socket.
+// Every message is an 8-byte header followed by `length` payload bytes;
+// integers are little-endian:
+//
+//   u8 version | u8 kind | u16 count | u32 length | payload
+//
+// A request's kind is a ScanRequestKind and its payload is a file path (read
+// by the daemon, which only takes paths from its own user and root) or the
+// encoded image itself. A response's kind is a
+// ScanStatus, `count` is the number of symbols and the payload holds the
+// symbols, or the error text for ScanStatus::Error. A connection carries any
+// number of request/response pairs.
+
+const uint8_t kScanProtocolVersion = 1;
+const size_t kFrameHeaderSize = 8;
+const uint32_t kMaxFramePayload = 64u << 20;
+const char* const kDefaultScanSocket = "/tmp/barcode_scand.sock";
+
+enum class ScanRequestKind : uint8_t { Path = 1, Image = 2 };
+enum class ScanStatus : uint8_t { Ok = 0, NoBarcode = 1, Error = 2 };
+
+struct FrameHeader {
+    uint8_t version;
+    uint8_t kind;
+    uint16_t count;
+    uint32_t length;
+};
+
+// One symbol of a response. On the wire:
+//   u8 type length, type | u16 data length, data | i32 quality | u8 level |
+//   i32 x, y, width, height | u8 found [| i32 id | f64 price | u16 name length, name]
+struct ScanReplySymbol {
+    std::string type;
+    std::string data;
+    int quality;
+    int level;
+    int x, y, width, height;    // bounding box of the symbol outline, in image pixels
+    bool found;
+    Product product;
+};
+
+struct ScanReply {
+    ScanStatus status;
+    std::string error;
+    std::vector<ScanReplySymbol> symbols;
+};
+
+// Time by which a whole frame has to be read or written; kNoDeadline waits
+// as long as it takes.
+using FrameDeadline = std::chrono::steady_clock::time_point;
+const FrameDeadline kNoDeadline = FrameDeadline::max();
+
+// Reads one frame into `payload` (reusing its capacity). Returns false on a
+// clean end of stream before the header; throws std::runtime_error on a
+// truncated or malformed frame, or once `deadline` passes.
+bool read_frame(int fd, FrameHeader& header, std::vector<unsigned char>& payload,
+                FrameDeadline deadline = kNoDeadline);
+
+// Sends the header and payload in one system call when the socket takes
+// them. Throws on failure and once `deadline` passes.
+void write_frame(int fd, uint8_t kind, uint16_t count, const void* payload, size_t length,
+                 FrameDeadline deadline = kNoDeadline);
+
+void encode_reply_symbol(std::vector<unsigned char>& out, const ScanReplySymbol& symbol);
+
+// Parses a response frame. Throws std::runtime_error when it is malformed.
+ScanReply decode_reply(const FrameHeader& header, const std::vector<unsigned char>& payload);
+
+#endif // SCAN_PROTOCOL_H
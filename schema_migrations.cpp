@@ -0,0 +1,366 @@
+#include "schema_migrations.h"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <string>
+
+#include "barcode_catalog.h"
+#include "barcode_key.h"
+
+static void exec(sqlite3* db, const char* sql, const char* what) {
+    char* errMsg = nullptr;
+    if (sqlite3_exec(db, sql, nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        std::string error = std::string("SQL error (") + what + "): " + (errMsg ? errMsg : sqlite3_errmsg(db));
+        sqlite3_free(errMsg);
+        throw std::runtime_error(error);
+    }
+}
+
+// CREATE statement of `table` as stored in sqlite_master, or "" when it does not exist.
+static std::string table_sql(sqlite3* db, const char* table) {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, "SELECT sql FROM sqlite_master WHERE type='table' AND name=?;", -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("Table check failed: " + std::string(sqlite3_errmsg(db)));
+    }
+    sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+
+    std::string sql;
+    if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_text(stmt, 0)) {
+        sql = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+    return sql;
+}
+
+static bool table_has_column(sqlite3* db, const char* table, const char* column) {
+    sqlite3_stmt* stmt;
+    std::string sql = std::string("PRAGMA table_info(") + table + ");";
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("Column check failed: " + std::string(sqlite3_errmsg(db)));
+    }
+
+    bool found = false;
+    while (!found && sqlite3_step(stmt) == SQLITE_ROW) {
+        found = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1))) == column;
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+
+// migrations
+// Each step brings a database of any earlier shape to its version, so it is
+// safe to run on a database that was created by hand or by init_database.
+
+// 1: products with AUTOINCREMENT ids. The keyword only appears in the table's
+// CREATE statement, not in PRAGMA table_info's column type.
+static void migrate_products_autoincrement(sqlite3* db) {
+    std::string sql = table_sql(db, "products");
+    if (sql.empty()) {
+        exec(db,
+             "CREATE TABLE products ("
+             "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+             "barcode TEXT NOT NULL UNIQUE,"
+             "product_name TEXT NOT NULL,"
+             "price REAL);",
+             "create table");
+        return;
+    }
+
+    std::transform(sql.begin(), sql.end(), sql.begin(), [](unsigned char c) { return std::toupper(c); });
+    bool has_id = table_has_column(db, "products", "id");
+    if (has_id && sql.find("AUTOINCREMENT") != std::string::npos) {
+        return;
+    }
+
+    // existing ids are kept, so products keep the ids users were shown
+    std::string copy = has_id
+        ? "INSERT INTO products (id, barcode, product_name, price) SELECT id, barcode, product_name, price FROM products_backup;"
+        : "INSERT INTO products (barcode, product_name, price) SELECT barcode, product_name, price FROM products_backup;";
+    std::string rebuild =
+        "CREATE TEMPORARY TABLE products_backup AS SELECT * FROM products;"
+        "DROP TABLE products;"
+        "CREATE TABLE products ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "barcode TEXT NOT NULL UNIQUE,"
+        "product_name TEXT NOT NULL,"
+        "price REAL);" +
+        copy +
+        "DROP TABLE products_backup;";
+    exec(db, rebuild.c_str(), "migrate table");
+}
+
+// 2: prices as integer cents instead of REAL. The AUTOINCREMENT high-water
+// mark is carried over, so ids of deleted products are not handed out again.
+static void migrate_products_price_cents(sqlite3* db) {
+    if (table_has_column(db, "products", "price_cents")) {
+        return;
+    }
+    exec(db,
+         "CREATE TEMPORARY TABLE products_backup AS SELECT * FROM products;"
+         "CREATE TEMPORARY TABLE products_sequence AS SELECT seq FROM sqlite_sequence WHERE name = 'products';"
+         "DROP TABLE products;"
+         "CREATE TABLE products ("
+         "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+         "barcode TEXT NOT NULL UNIQUE,"
+         "product_name TEXT NOT NULL,"
+         "price_cents INTEGER);"
+         "INSERT INTO products (id, barcode, product_name, price_cents) "
+         "SELECT id, barcode, product_name, CAST(round(price * 100) AS INTEGER) FROM products_backup;"
+         "INSERT INTO sqlite_sequence (name, seq) SELECT 'products', 0 "
+         "WHERE NOT EXISTS (SELECT 1 FROM sqlite_sequence WHERE name = 'products');"
+         "UPDATE sqlite_sequence SET seq = max(seq, ifnull((SELECT seq FROM products_sequence), 0)) WHERE name = 'products';"
+         "DROP TABLE products_backup;"
+         "DROP TABLE products_sequence;",
+         "migrate prices");
+}
+
+// 3: counter and permutation key for BarcodePermutation, so codes are
+// allocated without checking the catalog for them first. One row, id 0.
+static void migrate_barcode_allocator(sqlite3* db) {
+    if (!table_sql(db, "barcode_allocator").empty()) {
+        return;
+    }
+    std::string sql =
+        "CREATE TABLE barcode_allocator ("
+        "id INTEGER PRIMARY KEY CHECK (id = 0),"
+        "permutation_key INTEGER NOT NULL,"
+        "next_index INTEGER NOT NULL);"
+        "INSERT INTO barcode_allocator (id, permutation_key, next_index) VALUES (0, " +
+        std::to_string(static_cast<int64_t>(new_barcode_key())) + ", 0);";
+    exec(db, sql.c_str(), "create barcode allocator");
+}
+
+// 4: blocks of allocator indexes leased to sessions (see BarcodeLease).
+static void migrate_barcode_allocations(sqlite3* db) {
+    exec(db,
+         "CREATE TABLE IF NOT EXISTS barcode_allocations ("
+         "start INTEGER PRIMARY KEY,"
+         "end INTEGER NOT NULL,"
+         "next INTEGER NOT NULL,"
+         "owner TEXT,"
+         "expires_at INTEGER NOT NULL);",
+         "create barcode allocations");
+}
+
+// 5: rows of each bulk import input already committed, so an interrupted
+// run picks up after them (see run_bulk_generate()).
+static void migrate_bulk_imports(sqlite3* db) {
+    exec(db,
+         "CREATE TABLE IF NOT EXISTS bulk_imports ("
+         "source TEXT PRIMARY KEY,"
+         "rows INTEGER NOT NULL,"
+         "updated_at INTEGER NOT NULL);",
+         "create bulk imports");
+}
+
+static void keep_compact_ids(sqlite3* db);
+static void track_product_changes(sqlite3* db);
+
+// 6: a high-water mark for compact catalogs, so they stop handing out the
+// ids of deleted products again (see keep_compact_ids()).
+static void migrate_compact_ids(sqlite3* db) {
+    if (table_has_column(db, "products", "code")) {
+        keep_compact_ids(db);
+    }
+}
+
+// 7: a stamp that changes whenever a product could have left a ProductFilter
+// stale (see track_product_changes()).
+static void migrate_product_changes(sqlite3* db) {
+    track_product_changes(db);
+}
+
+struct Migration {
+    int version;
+    void (*apply)(sqlite3* db);
+};
+
+static const Migration kMigrations[] = {
+    {1, migrate_products_autoincrement},
+    {2, migrate_products_price_cents},
+    {3, migrate_barcode_allocator},
+    {4, migrate_barcode_allocations},
+    {5, migrate_bulk_imports},
+    {6, migrate_compact_ids},
+    {7, migrate_product_changes},
+};
+
+
+int schema_version(sqlite3* db) {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("Schema version check failed: " + std::string(sqlite3_errmsg(db)));
+    }
+    int version = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : 0;
+    sqlite3_finalize(stmt);
+    return version;
+}
+
+void migrate_schema(sqlite3* db) {
+    if (schema_version(db) == kSchemaVersion) {
+        return;
+    }
+
+    // Another process may be migrating too: take the write lock first, then
+    // look at the version again.
+    exec(db, "BEGIN IMMEDIATE;", "begin migration");
+    try {
+        int version = schema_version(db);
+        if (version > kSchemaVersion) {
+            throw std::runtime_error("Database schema version " + std::to_string(version) +
+                                     " is newer than this program supports (" + std::to_string(kSchemaVersion) + ")");
+        }
+
+        for (const Migration& migration : kMigrations) {
+            if (migration.version > version) {
+                migration.apply(db);
+            }
+        }
+
+        std::string stamp = "PRAGMA user_version = " + std::to_string(kSchemaVersion) + ";";
+        exec(db, stamp.c_str(), "set schema version");
+        exec(db, "COMMIT;", "commit migration");
+    } catch (const std::runtime_error&) {
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        throw;
+    }
+}
+
+
+// layouts
+static void pack_barcode_function(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    int64_t key;
+    const char* text = reinterpret_cast<const char*>(sqlite3_value_text(argv[0]));
+    if (text && pack_barcode(text, static_cast<size_t>(sqlite3_value_bytes(argv[0])), key)) {
+        sqlite3_result_int64(ctx, key);
+    }
+    else {
+        sqlite3_result_null(ctx);
+    }
+}
+
+static void unpack_barcode_function(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    std::string barcode = unpack_barcode(sqlite3_value_int64(argv[0]));
+    sqlite3_result_text(ctx, barcode.data(), static_cast<int>(barcode.size()), SQLITE_TRANSIENT);
+}
+
+// A WITHOUT ROWID table cannot be AUTOINCREMENT, so the compact catalog's
+// high-water mark is a one-row table (id 0) that a trigger raises on every
+// insert. New compact ids start above it.
+static void keep_compact_ids(sqlite3* db) {
+    exec(db,
+         "CREATE TABLE IF NOT EXISTS products_sequence ("
+         "id INTEGER PRIMARY KEY CHECK (id = 0),"
+         "seq INTEGER NOT NULL);"
+         "INSERT OR IGNORE INTO products_sequence (id, seq) VALUES (0, 0);"
+         "UPDATE products_sequence SET seq = max(seq, ifnull((SELECT max(id) FROM products), 0));"
+         "CREATE TRIGGER IF NOT EXISTS products_sequence_insert AFTER INSERT ON products BEGIN "
+         "UPDATE products_sequence SET seq = NEW.id WHERE seq < NEW.id; "
+         "END;",
+         "keep compact ids");
+}
+
+// products_changes holds one random stamp (id 0). It is redrawn when a
+// barcode or id is updated and when a product is inserted below the highest
+// id, the changes a filter that adds rows by rising id cannot see. Deletes
+// only leave a filter with extra bits, so they do not count. The triggers
+// belong to the products table and are made again when it is rebuilt.
+static void track_product_changes(sqlite3* db) {
+    std::string barcode = table_has_column(db, "products", "code") ? "code" : "barcode";
+    std::string sql =
+        "CREATE TABLE IF NOT EXISTS products_changes ("
+        "id INTEGER PRIMARY KEY CHECK (id = 0),"
+        "stamp INTEGER NOT NULL);"
+        "INSERT OR IGNORE INTO products_changes (id, stamp) VALUES (0, random());"
+        "CREATE TRIGGER IF NOT EXISTS products_changes_update AFTER UPDATE OF " + barcode + ", id ON products BEGIN "
+        "UPDATE products_changes SET stamp = random(); "
+        "END;"
+        "CREATE TRIGGER IF NOT EXISTS products_changes_insert AFTER INSERT ON products "
+        "WHEN NEW.id < (SELECT max(id) FROM products) BEGIN "
+        "UPDATE products_changes SET stamp = random(); "
+        "END;";
+    exec(db, sql.c_str(), "track product changes");
+}
+
+CatalogLayout catalog_layout(sqlite3* db) {
+    return table_has_column(db, "products", "code") ? CatalogLayout::Compact : CatalogLayout::Text;
+}
+
+static void rebuild_products(sqlite3* db, CatalogLayout layout) {
+    sqlite3_create_function(db, "pack_barcode", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, pack_barcode_function, nullptr, nullptr);
+    sqlite3_create_function(db, "unpack_barcode", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, unpack_barcode_function, nullptr, nullptr);
+
+    if (layout == CatalogLayout::Compact) {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, "SELECT barcode FROM products WHERE pack_barcode(barcode) IS NULL LIMIT 1;", -1, &stmt, nullptr) != SQLITE_OK) {
+            throw std::runtime_error("Barcode check failed: " + std::string(sqlite3_errmsg(db)));
+        }
+        std::string invalid;
+        bool found = sqlite3_step(stmt) == SQLITE_ROW;
+        if (found && sqlite3_column_text(stmt, 0)) {
+            invalid = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        }
+        sqlite3_finalize(stmt);
+        if (found) {
+            throw std::runtime_error("Barcode " + invalid + " does not fit the compact catalog (" +
+                                     std::to_string(kBarcodeLength) + " characters of 0-9A-Z)");
+        }
+
+        // inserted in key order, so the new b-tree is filled page by page;
+        // the AUTOINCREMENT high-water mark moves to products_sequence
+        exec(db,
+             "DROP TABLE IF EXISTS products_sequence;"
+             "CREATE TABLE products_sequence ("
+             "id INTEGER PRIMARY KEY CHECK (id = 0),"
+             "seq INTEGER NOT NULL);"
+             "INSERT INTO products_sequence (id, seq) "
+             "SELECT 0, ifnull((SELECT seq FROM sqlite_sequence WHERE name = 'products'), 0);"
+             "CREATE TABLE products_compact ("
+             "code INTEGER PRIMARY KEY,"
+             "id INTEGER NOT NULL UNIQUE,"
+             "product_name TEXT NOT NULL,"
+             "price_cents INTEGER) WITHOUT ROWID;"
+             "INSERT INTO products_compact (code, id, product_name, price_cents) "
+             "SELECT pack_barcode(barcode), id, product_name, price_cents FROM products ORDER BY 1;"
+             "DROP TABLE products;"
+             "ALTER TABLE products_compact RENAME TO products;",
+             "compact catalog");
+        keep_compact_ids(db);
+    }
+    else {
+        exec(db,
+             "CREATE TABLE products_text ("
+             "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+             "barcode TEXT NOT NULL UNIQUE,"
+             "product_name TEXT NOT NULL,"
+             "price_cents INTEGER);"
+             "INSERT INTO products_text (id, barcode, product_name, price_cents) "
+             "SELECT id, unpack_barcode(code), product_name, price_cents FROM products ORDER BY id;"
+             "INSERT INTO sqlite_sequence (name, seq) SELECT 'products_text', 0 "
+             "WHERE NOT EXISTS (SELECT 1 FROM sqlite_sequence WHERE name = 'products_text');"
+             "UPDATE sqlite_sequence SET seq = max(seq, ifnull((SELECT seq FROM products_sequence), 0)) "
+             "WHERE name = 'products_text';"
+             "DROP TABLE products;"
+             "DROP TABLE IF EXISTS products_sequence;"
+             "ALTER TABLE products_text RENAME TO products;",
+             "expand catalog");
+    }
+    track_product_changes(db);
+}
+
+void convert_catalog(sqlite3* db, CatalogLayout layout) {
+    exec(db, "BEGIN IMMEDIATE;", "begin conversion");
+    try {
+        if (catalog_layout(db) != layout) {
+            rebuild_products(db, layout);
+        }
+        exec(db, "COMMIT;", "commit conversion");
+    } catch (const std::runtime_error&) {
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        throw;
+    }
+}
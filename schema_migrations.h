@@ -0,0 +1,38 @@
+#ifndef SCHEMA_MIGRATIONS_H
+#define SCHEMA_MIGRATIONS_H
+
+struct sqlite3;
+
+// Schema version this build writes, kept in PRAGMA user_version.
+const int kSchemaVersion = 7;
+
+// PRAGMA user_version of `db`; 0 for a database no migration has touched.
+int schema_version(sqlite3* db);
+
+// Runs the migrations between the stored version and kSchemaVersion, in
+// order, inside one BEGIN IMMEDIATE transaction, then stores the new version.
+// On a database that is already current this is a single PRAGMA read. Throws
+// std::runtime_error on failure (the transaction is rolled back) and for a
+// database written by a newer build.
+void migrate_schema(sqlite3* db);
+
+// How the products table is stored. Both keep prices as integer cents.
+//   Text:    rowid table, id INTEGER PRIMARY KEY AUTOINCREMENT, barcode TEXT
+//            UNIQUE. Takes any barcode; what migrate_schema() creates.
+//   Compact: WITHOUT ROWID table keyed by the packed barcode (barcode_key.h),
+//            id INTEGER UNIQUE. A lookup is one b-tree search instead of an
+//            index search plus a table search, and the file is smaller, but
+//            only kBarcodeLength-character 0-9A-Z codes can be stored. New ids
+//            come from a high-water mark in products_sequence that a
+//            trigger keeps, so neither layout hands out a deleted product's id.
+enum class CatalogLayout { Text, Compact };
+
+CatalogLayout catalog_layout(sqlite3* db);
+
+// Rebuilds the products table in `layout`, keeping ids, inside one BEGIN
+// IMMEDIATE transaction. Does nothing when the table already has that layout.
+// Throws std::runtime_error (and rolls back), e.g. for a barcode that cannot
+// be packed.
+void convert_catalog(sqlite3* db, CatalogLayout layout);
+
+#endif // SCHEMA_MIGRATIONS_H